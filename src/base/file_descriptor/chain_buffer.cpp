@@ -0,0 +1,149 @@
+#include "chain_buffer.h"
+
+#include <string.h>
+
+#include <utility>
+#include <vector>
+
+namespace base {
+
+namespace {
+
+const size_t kMaxPooledBlocks = 256;
+
+// Free blocks of the current thread; records of a loop are used only by its
+// thread, so the pool needs no locking.
+struct BlockPool {
+  ~BlockPool() {
+    for (void* block : blocks) {
+      ::operator delete(block);
+    }
+  }
+
+  std::vector<void*> blocks;
+};
+
+thread_local BlockPool block_pool;
+
+}  // namespace
+
+ChainBuffer::ChainBuffer() : head_offset_(0), tail_size_(0), size_(0) {}
+
+ChainBuffer::ChainBuffer(ChainBuffer&& other) :
+    blocks_(std::move(other.blocks_)),
+    head_offset_(other.head_offset_),
+    tail_size_(other.tail_size_),
+    size_(other.size_) {
+  other.blocks_.clear();
+  other.head_offset_ = 0;
+  other.tail_size_ = 0;
+  other.size_ = 0;
+}
+
+ChainBuffer& ChainBuffer::operator=(ChainBuffer&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  Clear();
+  std::swap(blocks_, other.blocks_);
+  std::swap(head_offset_, other.head_offset_);
+  std::swap(tail_size_, other.tail_size_);
+  std::swap(size_, other.size_);
+  return *this;
+}
+
+ChainBuffer::~ChainBuffer() {
+  Clear();
+}
+
+void ChainBuffer::Append(const char* data, size_t size) {
+  while (size > 0) {
+    if (blocks_.empty() || tail_size_ == kBlockSize) {
+      blocks_.push_back(AllocateBlock());
+      tail_size_ = 0;
+    }
+    size_t chunk = kBlockSize - tail_size_;
+    if (chunk > size) {
+      chunk = size;
+    }
+    memcpy(blocks_.back()->data + tail_size_, data, chunk);
+    tail_size_ += chunk;
+    size_ += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+size_t ChainBuffer::GetIovecs(iovec* iovecs, size_t max_count) const {
+  size_t count = 0;
+  for (size_t i = 0; i < blocks_.size() && count < max_count; ++i) {
+    size_t begin = (i == 0) ? (head_offset_) : (0);
+    size_t end = (i + 1 == blocks_.size()) ? (tail_size_) : (kBlockSize);
+    if (begin == end) {
+      continue;
+    }
+    iovecs[count].iov_base = blocks_[i]->data + begin;
+    iovecs[count].iov_len = end - begin;
+    ++count;
+  }
+  return count;
+}
+
+void ChainBuffer::Consume(size_t size) {
+  if (size >= size_) {
+    Clear();
+    return;
+  }
+  size_ -= size;
+  while (size > 0) {
+    size_t block_end = (blocks_.size() == 1) ? (tail_size_) : (kBlockSize);
+    size_t available = block_end - head_offset_;
+    if (size < available) {
+      head_offset_ += size;
+      return;
+    }
+    size -= available;
+    FreeBlock(blocks_.front());
+    blocks_.pop_front();
+    head_offset_ = 0;
+  }
+}
+
+void ChainBuffer::Clear() {
+  for (Block* block : blocks_) {
+    FreeBlock(block);
+  }
+  blocks_.clear();
+  head_offset_ = 0;
+  tail_size_ = 0;
+  size_ = 0;
+}
+
+size_t ChainBuffer::GetSize() const {
+  return size_;
+}
+
+bool ChainBuffer::IsEmpty() const {
+  return size_ == 0;
+}
+
+// static
+ChainBuffer::Block* ChainBuffer::AllocateBlock() {
+  if (block_pool.blocks.empty()) {
+    return static_cast<Block*>(::operator new(sizeof(Block)));
+  }
+  Block* block = static_cast<Block*>(block_pool.blocks.back());
+  block_pool.blocks.pop_back();
+  return block;
+}
+
+// static
+void ChainBuffer::FreeBlock(Block* block) {
+  if (block_pool.blocks.size() >= kMaxPooledBlocks) {
+    ::operator delete(block);
+    return;
+  }
+  block_pool.blocks.push_back(block);
+}
+
+}  // namespace base
@@ -0,0 +1,56 @@
+#ifndef BASE_FILE_DESCRIPTOR_CHAIN_BUFFER_H_
+#define BASE_FILE_DESCRIPTOR_CHAIN_BUFFER_H_
+
+#include <sys/uio.h>
+
+#include <deque>
+
+#include "macros.h"
+
+namespace base {
+
+// Buffer made of fixed-size blocks. Data is appended to the last block and
+// consumed from the first one by offset, so buffered bytes are never moved;
+// whole buffer can be written with one writev. Emptied blocks go to a pool
+// of the current thread.
+class ChainBuffer {
+ public:
+  static const size_t kBlockSize = 16 * 1024;
+
+  ChainBuffer();
+  ChainBuffer(ChainBuffer&& other);
+  ChainBuffer& operator=(ChainBuffer&& other);
+  ~ChainBuffer();
+
+  void Append(const char* data, size_t size);
+  // Describes buffered data with at most max_count iovecs; returns their
+  // number.
+  size_t GetIovecs(iovec* iovecs, size_t max_count) const;
+  // Drops first size bytes.
+  void Consume(size_t size);
+  void Clear();
+
+  size_t GetSize() const;
+  bool IsEmpty() const;
+
+ private:
+  struct Block {
+    char data[kBlockSize];
+  };
+
+  static Block* AllocateBlock();
+  static void FreeBlock(Block* block);
+
+  std::deque<Block*> blocks_;
+  // Consumed bytes of the first block.
+  size_t head_offset_;
+  // Used bytes of the last block.
+  size_t tail_size_;
+  size_t size_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(ChainBuffer);
+};
+
+}  // namespace base
+
+#endif  // BASE_FILE_DESCRIPTOR_CHAIN_BUFFER_H_
@@ -1,5 +1,7 @@
 #include "file_descriptor.h"
 
+#include <errno.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <utility>
@@ -54,57 +56,145 @@ int FileDescriptor::GetFD() const {
   return fd_;
 }
 
-IOFileDescriptor::IOFileDescriptor() {}
+IOFileDescriptor::IOFileDescriptor() : max_buffer_size_(kMaxBufferSize),
+                                       read_size_(kMinReadSize) {}
 IOFileDescriptor::IOFileDescriptor(int fd, size_t max_buffer_size) :
-    FileDescriptor(fd), max_buffer_size_(max_buffer_size) {}
+    FileDescriptor(fd), max_buffer_size_(max_buffer_size),
+    read_size_(kMinReadSize) {}
 
 IOFileDescriptor::IOFileDescriptor(IOFileDescriptor&& other) :
     FileDescriptor(std::move(static_cast<FileDescriptor&>(other))),
     buffer_(std::move(other.buffer_)),
-    max_buffer_size_(other.max_buffer_size_) {}
+    max_buffer_size_(other.max_buffer_size_),
+    read_size_(other.read_size_) {}
 
 IOFileDescriptor& IOFileDescriptor::operator=(IOFileDescriptor&& other) {
   FileDescriptor::operator=(std::move(static_cast<FileDescriptor&>(other)));
-  buffer_.clear();
   buffer_ = std::move(other.buffer_);
+  max_buffer_size_ = other.max_buffer_size_;
+  read_size_ = other.read_size_;
   return *this;
 }
 
 bool IOFileDescriptor::Append(const char* data, size_t size) {
-  if (max_buffer_size_ - buffer_.size() < size) {
+  if (max_buffer_size_ - buffer_.GetSize() < size) {
     LOGE << "Buffer is overflowed for fd: " << GetFD();
     return false;
   }
-  buffer_.append(data, size);
+  buffer_.Append(data, size);
   return true;
 }
 
-std::string IOFileDescriptor::Read() {
-  int was_read = ::read(GetFD(), read_buffer_, kReadBufferSize - 1);
+bool IOFileDescriptor::Read(ReceiveBuffer* data, size_t limit) {
+  size_t to_read = GetReadSize(*data, limit);
+  if (to_read == 0) {
+    return true;
+  }
+  ssize_t was_read = ::read(GetFD(), data->GetTail(), to_read);
+  if (was_read > 0) {
+    data->Commit(was_read);
+    AdaptReadSize(to_read, was_read);
+    return true;
+  }
+  if (was_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                       errno == EINTR)) {
+    return true;
+  }
   if (was_read < 0) {
     LOGE << "Reading error for fd: " << GetFD();
-    return "";
   }
-  return std::string(read_buffer_, was_read);
+  return false;
+}
+
+IOFileDescriptor::ReadResult IOFileDescriptor::Drain(ReceiveBuffer* data,
+                                                    size_t budget) {
+  size_t was_read = 0;
+  while (was_read < budget) {
+    size_t to_read = GetReadSize(*data, budget - was_read);
+    if (to_read == 0) {
+      break;
+    }
+    ssize_t ret = ::read(GetFD(), data->GetTail(), to_read);
+    if (ret > 0) {
+      data->Commit(ret);
+      AdaptReadSize(to_read, ret);
+      was_read += ret;
+      continue;
+    }
+    if (ret == 0) {
+      return END_OF_FILE;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return WOULD_BLOCK;
+    }
+    LOGE << "Reading error for fd: " << GetFD();
+    return READ_ERROR;
+  }
+  return BUDGET_EXHAUSTED;
+}
+
+size_t IOFileDescriptor::GetReadSize(const ReceiveBuffer& data,
+                                     size_t limit) const {
+  size_t size = read_size_;
+  if (size > limit) {
+    size = limit;
+  }
+  if (size > data.GetFreeSpace()) {
+    size = data.GetFreeSpace();
+  }
+  return size;
+}
+
+void IOFileDescriptor::AdaptReadSize(size_t requested, size_t was_read) {
+  if (was_read == read_size_ && read_size_ < ReceiveBuffer::kCapacity) {
+    read_size_ *= 2;
+  } else if (requested == read_size_ && was_read < read_size_ / 4 &&
+             read_size_ > kMinReadSize) {
+    read_size_ /= 2;
+  }
+}
+
+bool IOFileDescriptor::Flush() {
+  iovec iovecs[kMaxIovecs];
+  while (!IsEmpty()) {
+    size_t count = buffer_.GetIovecs(iovecs, kMaxIovecs);
+    ssize_t was_written = ::writev(GetFD(), iovecs, count);
+    if (was_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (was_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (was_written <= 0) {
+      LOGE << "Writing error for fd: " << GetFD();
+      return false;
+    }
+    buffer_.Consume(was_written);
+  }
+  return true;
 }
 
 bool IOFileDescriptor::Write() {
-  int was_written = ::write(GetFD(), buffer_.c_str(), buffer_.size());
+  iovec iovecs[kMaxIovecs];
+  size_t count = buffer_.GetIovecs(iovecs, kMaxIovecs);
+  ssize_t was_written = ::writev(GetFD(), iovecs, count);
   if (was_written <= 0) {
     LOGE << "Writing error for fd: " << GetFD();
     return false;
   }
-  if (was_written > 0) {
-    for (size_t i = was_written; i < buffer_.size(); ++i) {
-      buffer_[i - was_written] = buffer_[i];
-    }
-    buffer_.resize(buffer_.size() - was_written);
-  }
+  buffer_.Consume(was_written);
   return true;
 }
 
 size_t IOFileDescriptor::GetSize() const {
-  return buffer_.size();
+  return buffer_.GetSize();
+}
+
+size_t IOFileDescriptor::GetFreeSpace() const {
+  return max_buffer_size_ - buffer_.GetSize();
 }
 
 bool IOFileDescriptor::IsEmpty() const {
@@ -1,9 +1,13 @@
 #ifndef BASE_FILE_DESCRIPTOR_FILE_DESCRIPTOR_H_
 #define BASE_FILE_DESCRIPTOR_FILE_DESCRIPTOR_H_
 
+#include <stdint.h>
+
 #include <string>
 
+#include "chain_buffer.h"
 #include "macros.h"
+#include "receive_buffer.h"
 
 namespace base {
 
@@ -30,6 +34,13 @@ class FileDescriptor {
 
 class IOFileDescriptor : public FileDescriptor {
  public:
+  enum ReadResult {
+    WOULD_BLOCK,
+    BUDGET_EXHAUSTED,
+    END_OF_FILE,
+    READ_ERROR
+  };
+
   IOFileDescriptor();
   IOFileDescriptor(int fd, size_t max_buffer_size = kMaxBufferSize);
 
@@ -38,19 +49,36 @@ class IOFileDescriptor : public FileDescriptor {
 
   bool Append(const char* data, size_t size);
   bool Write();
+  // Writes until buffer becomes empty or descriptor would block.
+  bool Flush();
 
-  std::string Read();
+  // Reads once, no more than limit bytes. Returns false if descriptor was
+  // closed or broken.
+  bool Read(ReceiveBuffer* data, size_t limit = SIZE_MAX);
+  // Reads until descriptor would block, but no more than budget bytes and
+  // free space of data. Read data is kept even if error occurs.
+  ReadResult Drain(ReceiveBuffer* data, size_t budget);
 
   size_t GetSize() const;
+  size_t GetFreeSpace() const;
   bool IsEmpty() const;
 
  private:
   static const size_t kMaxBufferSize = 128 * 1024;
-  static const size_t kReadBufferSize = 4 * 1024;
-
-  std::string buffer_;
+  static const size_t kMinReadSize = 4 * 1024;
+  // Iovecs passed to one writev; enough for the whole default buffer.
+  static const size_t kMaxIovecs = 16;
+
+  // Returns size of the next read; it's bounded by limit and by free space
+  // of data.
+  size_t GetReadSize(const ReceiveBuffer& data, size_t limit) const;
+  // Grows read size when reads fill it and shrinks it when they are much
+  // smaller, so bulk transfers use few system calls.
+  void AdaptReadSize(size_t requested, size_t was_read);
+
+  ChainBuffer buffer_;
   size_t max_buffer_size_;
-  char read_buffer_[kReadBufferSize];
+  size_t read_size_;
 
   PROHIBIT_COPY_AND_COPY_ASSIGN(IOFileDescriptor);
 };
@@ -0,0 +1,101 @@
+#include "pipe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+namespace base {
+
+namespace {
+
+const size_t kDefaultPipeCapacity = 64 * 1024;
+
+}  // namespace
+
+// static
+std::unique_ptr<Pipe> Pipe::Create() {
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    LOGE << "Error to create pipe";
+    return nullptr;
+  }
+  return std::unique_ptr<Pipe>(new Pipe(fds[0], fds[1]));
+}
+
+Pipe::Pipe(int read_fd, int write_fd) :
+    read_end_(read_fd), write_end_(write_fd), size_(0),
+    capacity_(kDefaultPipeCapacity) {
+  int capacity = ::fcntl(write_end_.GetFD(), F_GETPIPE_SZ);
+  if (capacity > 0) {
+    capacity_ = capacity;
+  }
+}
+
+ssize_t Pipe::SpliceFrom(int fd, size_t max_size) {
+  if (IsFull()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  size_t to_move = capacity_ - size_;
+  if (to_move > max_size) {
+    to_move = max_size;
+  }
+  ssize_t moved = 0;
+  do {
+    moved = ::splice(fd, nullptr, write_end_.GetFD(), nullptr,
+                     to_move, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  } while (moved < 0 && errno == EINTR);
+  if (moved > 0) {
+    size_ += moved;
+  }
+  return moved;
+}
+
+ssize_t Pipe::SpliceTo(int fd) {
+  if (IsEmpty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  ssize_t moved = 0;
+  do {
+    moved = ::splice(read_end_.GetFD(), nullptr, fd, nullptr, size_,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  } while (moved < 0 && errno == EINTR);
+  if (moved > 0) {
+    size_ -= moved;
+  }
+  return moved;
+}
+
+size_t Pipe::GetSize() const {
+  return size_;
+}
+
+bool Pipe::IsEmpty() const {
+  return size_ == 0;
+}
+
+bool Pipe::IsFull() const {
+  return size_ >= capacity_;
+}
+
+std::unique_ptr<Pipe> PipePool::Acquire() {
+  if (free_pipes_.empty()) {
+    return Pipe::Create();
+  }
+  std::unique_ptr<Pipe> pipe = std::move(free_pipes_.back());
+  free_pipes_.pop_back();
+  return pipe;
+}
+
+void PipePool::Release(std::unique_ptr<Pipe> pipe) {
+  if (pipe == nullptr || !pipe->IsEmpty() ||
+      free_pipes_.size() >= kMaxFreePipes) {
+    return;
+  }
+  free_pipes_.push_back(std::move(pipe));
+}
+
+}  // namespace base
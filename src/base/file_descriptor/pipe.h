@@ -0,0 +1,61 @@
+#ifndef BASE_FILE_DESCRIPTOR_PIPE_H_
+#define BASE_FILE_DESCRIPTOR_PIPE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <vector>
+
+#include "file_descriptor.h"
+#include "macros.h"
+
+namespace base {
+
+// Nonblocking pipe used to move data between sockets with splice(2) without
+// copying it to user space.
+class Pipe {
+ public:
+  // Returns nullptr if pipe can't be created.
+  static std::unique_ptr<Pipe> Create();
+
+  // Both return number of moved bytes, 0 on end of file and -1 on error
+  // (errno is EAGAIN if descriptor would block or pipe is full/empty).
+  ssize_t SpliceFrom(int fd, size_t max_size = SIZE_MAX);
+  ssize_t SpliceTo(int fd);
+
+  size_t GetSize() const;
+  bool IsEmpty() const;
+  bool IsFull() const;
+
+ private:
+  Pipe(int read_fd, int write_fd);
+
+  FileDescriptor read_end_;
+  FileDescriptor write_end_;
+  size_t size_;
+  size_t capacity_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(Pipe);
+};
+
+// Keeps empty pipes of finished relays for reuse; belongs to one thread.
+class PipePool {
+ public:
+  PipePool() {}
+
+  std::unique_ptr<Pipe> Acquire();
+  // Pipes which still contain data are closed.
+  void Release(std::unique_ptr<Pipe> pipe);
+
+ private:
+  static const size_t kMaxFreePipes = 64;
+
+  std::vector<std::unique_ptr<Pipe>> free_pipes_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(PipePool);
+};
+
+}  // namespace base
+
+#endif  // BASE_FILE_DESCRIPTOR_PIPE_H_
@@ -0,0 +1,95 @@
+#include "receive_buffer.h"
+
+#include <utility>
+#include <vector>
+
+namespace base {
+
+namespace {
+
+// Buffers are borrowed only while a handler runs, so a loop needs a couple
+// of them at once.
+const size_t kMaxPooledBuffers = 8;
+
+struct BufferPool {
+  ~BufferPool() {
+    for (char* buffer : buffers) {
+      delete[] buffer;
+    }
+  }
+
+  std::vector<char*> buffers;
+};
+
+thread_local BufferPool buffer_pool;
+
+}  // namespace
+
+ReceiveBuffer::ReceiveBuffer() : data_(nullptr), size_(0) {}
+
+ReceiveBuffer::ReceiveBuffer(ReceiveBuffer&& other) :
+    data_(other.data_), size_(other.size_) {
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+ReceiveBuffer& ReceiveBuffer::operator=(ReceiveBuffer&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  Clear();
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  return *this;
+}
+
+ReceiveBuffer::~ReceiveBuffer() {
+  Clear();
+}
+
+const char* ReceiveBuffer::GetData() const {
+  return data_;
+}
+
+size_t ReceiveBuffer::GetSize() const {
+  return size_;
+}
+
+bool ReceiveBuffer::IsEmpty() const {
+  return size_ == 0;
+}
+
+char* ReceiveBuffer::GetTail() {
+  if (data_ == nullptr) {
+    if (buffer_pool.buffers.empty()) {
+      data_ = new char[kCapacity];
+    } else {
+      data_ = buffer_pool.buffers.back();
+      buffer_pool.buffers.pop_back();
+    }
+  }
+  return data_ + size_;
+}
+
+size_t ReceiveBuffer::GetFreeSpace() const {
+  return kCapacity - size_;
+}
+
+void ReceiveBuffer::Commit(size_t size) {
+  size_ += size;
+}
+
+void ReceiveBuffer::Clear() {
+  size_ = 0;
+  if (data_ == nullptr) {
+    return;
+  }
+  if (buffer_pool.buffers.size() < kMaxPooledBuffers) {
+    buffer_pool.buffers.push_back(data_);
+  } else {
+    delete[] data_;
+  }
+  data_ = nullptr;
+}
+
+}  // namespace base
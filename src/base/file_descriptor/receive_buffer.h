@@ -0,0 +1,44 @@
+#ifndef BASE_FILE_DESCRIPTOR_RECEIVE_BUFFER_H_
+#define BASE_FILE_DESCRIPTOR_RECEIVE_BUFFER_H_
+
+#include <stddef.h>
+
+#include "macros.h"
+
+namespace base {
+
+// Destination of reads which is handed to handlers as a view. Memory is
+// borrowed from a pool of the current thread on the first read and is
+// returned when the buffer is destroyed, so descriptors hold no receive
+// memory between wakeups.
+class ReceiveBuffer {
+ public:
+  static const size_t kCapacity = 64 * 1024;
+
+  ReceiveBuffer();
+  ReceiveBuffer(ReceiveBuffer&& other);
+  ReceiveBuffer& operator=(ReceiveBuffer&& other);
+  ~ReceiveBuffer();
+
+  const char* GetData() const;
+  size_t GetSize() const;
+  bool IsEmpty() const;
+
+  // Free space after received data; memory is borrowed if it isn't yet.
+  char* GetTail();
+  size_t GetFreeSpace() const;
+  // Marks size bytes after received data as filled.
+  void Commit(size_t size);
+  // Drops data and returns memory to the pool.
+  void Clear();
+
+ private:
+  char* data_;
+  size_t size_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(ReceiveBuffer);
+};
+
+}  // namespace base
+
+#endif  // BASE_FILE_DESCRIPTOR_RECEIVE_BUFFER_H_
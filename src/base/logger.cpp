@@ -171,7 +171,7 @@ LogMessage::LogMessage(const char* filename, int line ,
   message_ << ExpandToGivenLength(GetPathInProject(filename), kFileNameLength)
            << "[" << SetLeadZerosToLineNumber(line) << "] ";
   std::stringstream stream;
-  stream << "{" << base::AdvancedTime::Now().GetDate() << "}";
+  stream << "{" << base::AdvancedTime::WallNow().GetDate() << "}";
   message_ << ExpandToGivenLength(stream.str(), kDateLength) << " ";
   std::string severity_string = std::string("(") +
                                 LogSeverityToString(severity) + "): ";
@@ -0,0 +1,413 @@
+#include "disk_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "logger.h"
+#include "terminal_error.h"
+
+namespace net_utils {
+
+namespace {
+
+const char kSegmentPrefix[] = "segment_";
+const char kSegmentNameFormat[] = "segment_%08u";
+const uint32_t kRecordMagic = 0x43445850;
+const uint32_t kStoreRecord = 1;
+const uint32_t kRemoveRecord = 2;
+const uint64_t kMaxSegmentSize = 64 * 1024 * 1024;
+// Store keeps at least this many segments, so dropping one frees only a part
+// of it.
+const uint64_t kMinSegments = 4;
+const uint64_t kMinSegmentSize = 64 * 1024;
+// Key and meta are read while segments are loaded; record with bigger ones
+// is treated as broken.
+const uint32_t kMaxKeySize = 64 * 1024;
+const uint32_t kMaxMetaSize = 1024 * 1024;
+
+// Record is this header followed by key, meta and body.
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint32_t key_size;
+  uint32_t meta_size;
+  uint64_t body_size;
+  int64_t expiration;
+};
+
+bool ReadAll(int fd, char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t was_read = ::pread(fd, data, size, offset);
+    if (was_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (was_read <= 0) {
+      return false;
+    }
+    data += was_read;
+    size -= was_read;
+    offset += was_read;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, std::vector<iovec> iovecs, uint64_t offset) {
+  size_t first = 0;
+  while (first < iovecs.size()) {
+    ssize_t was_written = ::pwritev(fd, iovecs.data() + first,
+                                    iovecs.size() - first, offset);
+    if (was_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (was_written <= 0) {
+      return false;
+    }
+    offset += was_written;
+    size_t rest = was_written;
+    while (first < iovecs.size() && rest >= iovecs[first].iov_len) {
+      rest -= iovecs[first].iov_len;
+      ++first;
+    }
+    if (rest > 0) {
+      iovecs[first].iov_base = static_cast<char*>(iovecs[first].iov_base) +
+                               rest;
+      iovecs[first].iov_len -= rest;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+DiskCache::Stats::Stats() : hits(0), misses(0), stores(0), evictions(0),
+                            size(0) {}
+
+std::string DiskCache::Stats::ToString() const {
+  std::stringstream stream;
+  stream << "hits: " << hits << " misses: " << misses << " stores: "
+         << stores << " evictions: " << evictions << " size: " << size;
+  return stream.str();
+}
+
+// static
+DiskCache* DiskCache::GetInstance() {
+  static DiskCache instance;
+  return &instance;
+}
+
+DiskCache::DiskCache() : capacity_(0), segment_capacity_(0) {}
+
+void DiskCache::Open(const std::string& directory, uint64_t capacity) {
+  if (capacity / kMinSegments < kMinSegmentSize) {
+    LOGE << "Disk cache is too small: " << capacity << " bytes";
+    throw TerminalError();
+  }
+  directory_ = directory;
+  if (::mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOGE << "Error to create disk cache directory: " << directory_;
+    throw TerminalError();
+  }
+  DIR* dir = ::opendir(directory_.c_str());
+  if (dir == nullptr) {
+    LOGE << "Error to open disk cache directory: " << directory_;
+    throw TerminalError();
+  }
+  std::vector<uint32_t> ids;
+  while (dirent* entry = ::readdir(dir)) {
+    unsigned int id = 0;
+    char name[sizeof(kSegmentPrefix) + 16];
+    if (::sscanf(entry->d_name, kSegmentNameFormat, &id) == 1 &&
+        ::snprintf(name, sizeof(name), kSegmentNameFormat, id) > 0 &&
+        strcmp(name, entry->d_name) == 0) {
+      ids.push_back(id);
+    }
+  }
+  ::closedir(dir);
+  std::sort(ids.begin(), ids.end());
+
+  std::unique_lock<std::mutex> lock(locker_);
+  for (uint32_t id : ids) {
+    int fd = ::open(GetSegmentPath(id).c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+      LOGE << "Error to open disk cache segment: " << GetSegmentPath(id);
+      continue;
+    }
+    Segment segment;
+    segment.id = id;
+    segment.file = std::make_shared<base::FileDescriptor>(fd);
+    segment.size = 0;
+    LoadSegment(&segment);
+    stats_.size += segment.size;
+    segments_.push_back(std::move(segment));
+  }
+  capacity_ = capacity;
+  segment_capacity_ = std::min(kMaxSegmentSize, capacity_ / kMinSegments);
+  std::vector<Segment> dropped;
+  while (segments_.size() > 1 && stats_.size > capacity_) {
+    dropped.push_back(DropOldestSegment());
+  }
+  if ((segments_.empty() || segments_.back().size >= segment_capacity_) &&
+      !AddSegment()) {
+    throw TerminalError();
+  }
+  LOGI << "Disk cache was opened; directory: " << directory_
+       << "; segments: " << segments_.size() << "; objects: "
+       << index_.size() << "; size: " << stats_.size;
+  lock.unlock();
+  RemoveSegments(&dropped);
+  writer_ptr_.reset(new base::ThreadPool(1));
+}
+
+void DiskCache::Close() {
+  writer_ptr_ = nullptr;
+}
+
+bool DiskCache::IsEnabled() const {
+  return segment_capacity_ > 0;
+}
+
+size_t DiskCache::GetMaxObjectSize() const {
+  return segment_capacity_ / 2;
+}
+
+std::string DiskCache::GetSegmentPath(uint32_t id) const {
+  char name[sizeof(kSegmentPrefix) + 16];
+  ::snprintf(name, sizeof(name), kSegmentNameFormat, id);
+  return directory_ + "/" + name;
+}
+
+void DiskCache::LoadSegment(Segment* segment) {
+  int fd = segment->file->GetFD();
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) < 0) {
+    return;
+  }
+  uint64_t file_size = file_stat.st_size;
+  time_t now = ::time(nullptr);
+  uint64_t offset = 0;
+  while (offset < file_size) {
+    RecordHeader header;
+    if (file_size - offset < sizeof(header) ||
+        !ReadAll(fd, reinterpret_cast<char*>(&header), sizeof(header),
+                 offset) ||
+        header.magic != kRecordMagic ||
+        (header.type != kStoreRecord && header.type != kRemoveRecord) ||
+        header.key_size > kMaxKeySize || header.meta_size > kMaxMetaSize ||
+        header.body_size > file_size) {
+      break;
+    }
+    uint64_t body_offset = offset + sizeof(header) + header.key_size +
+                           header.meta_size;
+    if (body_offset + header.body_size > file_size) {
+      break;
+    }
+    std::string data(header.key_size + header.meta_size, '\0');
+    if (!ReadAll(fd, &data[0], data.size(), offset + sizeof(header))) {
+      break;
+    }
+    std::string key = data.substr(0, header.key_size);
+    if (header.type == kStoreRecord && header.expiration > now) {
+      Location& location = index_[key];
+      location.meta = data.substr(header.key_size);
+      location.file = segment->file;
+      location.segment_id = segment->id;
+      location.offset = body_offset;
+      location.size = header.body_size;
+      location.expiration = header.expiration;
+      segment->keys.push_back(key);
+    } else {
+      // Expired record replaced the older ones as well.
+      index_.erase(key);
+    }
+    offset = body_offset + header.body_size;
+  }
+  if (offset < file_size) {
+    LOGW << "Disk cache segment is cut at broken record: "
+         << GetSegmentPath(segment->id) << "; offset: " << offset;
+    if (::ftruncate(fd, offset) < 0) {
+      LOGE << "Error to truncate disk cache segment: "
+           << GetSegmentPath(segment->id);
+    }
+  }
+  segment->size = offset;
+}
+
+bool DiskCache::Lookup(const std::string& key, Record* record) {
+  if (!IsEnabled()) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(locker_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return false;
+  }
+  if (it->second.expiration <= ::time(nullptr)) {
+    index_.erase(it);
+    ++stats_.misses;
+    return false;
+  }
+  record->meta = it->second.meta;
+  record->file = it->second.file;
+  record->offset = it->second.offset;
+  record->size = it->second.size;
+  ++stats_.hits;
+  return true;
+}
+
+void DiskCache::Store(const std::string& key, const std::string& meta,
+                      std::shared_ptr<const std::string> body,
+                      time_t expiration) {
+  if (!IsEnabled() || body->size() > GetMaxObjectSize()) {
+    return;
+  }
+  writer_ptr_->PostTask([this, key, meta, body, expiration]() {
+    WriteRecord(kStoreRecord, key, meta, body, expiration);
+  });
+}
+
+void DiskCache::Remove(const std::string& key) {
+  if (!IsEnabled()) {
+    return;
+  }
+  bool was_stored = false;
+  {
+    std::unique_lock<std::mutex> lock(locker_);
+    was_stored = (index_.erase(key) > 0);
+  }
+  // Record which is being written is removed after it; tombstone keeps the
+  // object from being loaded again.
+  writer_ptr_->PostTask([this, key, was_stored]() {
+    std::unique_lock<std::mutex> lock(locker_);
+    if (index_.erase(key) == 0 && !was_stored) {
+      return;
+    }
+    lock.unlock();
+    WriteRecord(kRemoveRecord, key, std::string(), nullptr, 0);
+  });
+}
+
+void DiskCache::WriteRecord(uint32_t type, const std::string& key,
+                            const std::string& meta,
+                            const std::shared_ptr<const std::string>& body,
+                            time_t expiration) {
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.type = type;
+  header.key_size = key.size();
+  header.meta_size = meta.size();
+  header.body_size = (body == nullptr) ? (0) : (body->size());
+  header.expiration = expiration;
+  uint64_t record_size = sizeof(header) + header.key_size +
+                         header.meta_size + header.body_size;
+  if (header.key_size > kMaxKeySize || header.meta_size > kMaxMetaSize) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(locker_);
+  if (segments_.back().size > 0 &&
+      segments_.back().size + record_size > segment_capacity_) {
+    if (!AddSegment()) {
+      return;
+    }
+  }
+  std::vector<Segment> dropped;
+  while (segments_.size() > 1 && stats_.size + record_size > capacity_) {
+    dropped.push_back(DropOldestSegment());
+  }
+  // Only this thread appends, so the segment is written without the lock.
+  std::shared_ptr<base::FileDescriptor> file = segments_.back().file;
+  uint32_t segment_id = segments_.back().id;
+  uint64_t offset = segments_.back().size;
+  lock.unlock();
+  RemoveSegments(&dropped);
+
+  std::vector<iovec> iovecs;
+  iovecs.push_back({&header, sizeof(header)});
+  iovecs.push_back({const_cast<char*>(key.data()), key.size()});
+  iovecs.push_back({const_cast<char*>(meta.data()), meta.size()});
+  if (body != nullptr) {
+    iovecs.push_back({const_cast<char*>(body->data()), body->size()});
+  }
+  if (!WriteAll(file->GetFD(), iovecs, offset)) {
+    FLOGE << "Error to write disk cache record: " << key;
+    if (::ftruncate(file->GetFD(), offset) < 0) {
+      FLOGE << "Error to truncate disk cache segment after failed write";
+    }
+    return;
+  }
+
+  lock.lock();
+  segments_.back().size += record_size;
+  stats_.size += record_size;
+  if (type == kStoreRecord) {
+    Location& location = index_[key];
+    location.meta = meta;
+    location.file = file;
+    location.segment_id = segment_id;
+    location.offset = offset + record_size - header.body_size;
+    location.size = header.body_size;
+    location.expiration = expiration;
+    segments_.back().keys.push_back(key);
+    ++stats_.stores;
+    FLOGI << "Object was written to disk cache: " << key;
+  }
+}
+
+bool DiskCache::AddSegment() {
+  uint32_t id = (segments_.empty()) ? (1) : (segments_.back().id + 1);
+  int fd = ::open(GetSegmentPath(id).c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOGE << "Error to create disk cache segment: " << GetSegmentPath(id);
+    return false;
+  }
+  Segment segment;
+  segment.id = id;
+  segment.file = std::make_shared<base::FileDescriptor>(fd);
+  segment.size = 0;
+  segments_.push_back(std::move(segment));
+  return true;
+}
+
+DiskCache::Segment DiskCache::DropOldestSegment() {
+  Segment segment = std::move(segments_.front());
+  segments_.pop_front();
+  for (const std::string& key : segment.keys) {
+    auto it = index_.find(key);
+    if (it != index_.end() && it->second.segment_id == segment.id) {
+      index_.erase(it);
+      ++stats_.evictions;
+    }
+  }
+  stats_.size -= segment.size;
+  return segment;
+}
+
+void DiskCache::RemoveSegments(std::vector<Segment>* segments) {
+  for (const Segment& segment : *segments) {
+    if (::unlink(GetSegmentPath(segment.id).c_str()) < 0) {
+      LOGE << "Error to remove disk cache segment: "
+           << GetSegmentPath(segment.id);
+    }
+  }
+  segments->clear();
+}
+
+DiskCache::Stats DiskCache::GetStats() {
+  std::unique_lock<std::mutex> lock(locker_);
+  return stats_;
+}
+
+}  // namespace net_utils
@@ -0,0 +1,126 @@
+#ifndef BASE_NET_UTILS_DISK_CACHE_H_
+#define BASE_NET_UTILS_DISK_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file_descriptor.h"
+#include "macros.h"
+#include "thread_pool.h"
+
+namespace net_utils {
+
+// Process-wide store of objects in segment files of a local directory; it's
+// the second tier of the response cache. Records are appended to the newest
+// segment by a single writer thread and the oldest segment is dropped as a
+// whole when the store outgrows its capacity. Location of every live object
+// is kept in memory; it's rebuilt at startup by reading headers of records
+// without their bodies.
+class DiskCache {
+ public:
+  struct Stats {
+    Stats();
+
+    std::string ToString() const;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint64_t size;
+  };
+
+  // Body is read from the segment file, e.g. with sendfile. Descriptor is
+  // shared with the store, so the file stays readable after it's dropped.
+  struct Record {
+    std::string meta;
+    std::shared_ptr<base::FileDescriptor> file;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  static DiskCache* GetInstance();
+
+  // Creates directory if it's missing and loads segments which are in it.
+  // Writer thread is started here, so it has to be called after signals are
+  // blocked and before loops start. Capacity has to fit kMinSegments
+  // segments of at least kMinSegmentSize.
+  void Open(const std::string& directory, uint64_t capacity);
+  // Stops the writer; records which aren't written yet are lost.
+  void Close();
+  bool IsEnabled() const;
+  // Body which is bigger isn't stored.
+  size_t GetMaxObjectSize() const;
+
+  bool Lookup(const std::string& key, Record* record);
+  // Object becomes visible once it's written; expiration is wall-clock time
+  // after which it isn't loaded.
+  void Store(const std::string& key, const std::string& meta,
+             std::shared_ptr<const std::string> body, time_t expiration);
+  void Remove(const std::string& key);
+
+  Stats GetStats();
+
+ private:
+  struct Location {
+    std::string meta;
+    std::shared_ptr<base::FileDescriptor> file;
+    uint32_t segment_id;
+    uint64_t offset;
+    uint64_t size;
+    time_t expiration;
+  };
+
+  struct Segment {
+    uint32_t id;
+    std::shared_ptr<base::FileDescriptor> file;
+    uint64_t size;
+    // Keys of objects written to the segment; ones which were replaced
+    // since then point to other segments in the index.
+    std::vector<std::string> keys;
+  };
+
+  DiskCache();
+
+  std::string GetSegmentPath(uint32_t id) const;
+  // Reads records of the segment into the index; torn record at the end is
+  // cut off.
+  void LoadSegment(Segment* segment);
+  // Runs on the writer thread.
+  void WriteRecord(uint32_t type, const std::string& key,
+                   const std::string& meta,
+                   const std::shared_ptr<const std::string>& body,
+                   time_t expiration);
+  // Called under the lock. Returns false if new segment can't be created.
+  bool AddSegment();
+  // Called under the lock; drops objects of the oldest segment from the
+  // index. Segment is returned to be removed without the lock.
+  Segment DropOldestSegment();
+  // Removes files of dropped segments; objects which are being sent are
+  // still read through open descriptors.
+  void RemoveSegments(std::vector<Segment>* segments);
+
+  std::string directory_;
+  uint64_t capacity_;
+  uint64_t segment_capacity_;
+  std::unique_ptr<base::ThreadPool> writer_ptr_;
+
+  std::mutex locker_;
+  // Oldest segment is at the front; records are appended to the back one.
+  std::deque<Segment> segments_;
+  std::unordered_map<std::string, Location> index_;
+  Stats stats_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(DiskCache);
+};
+
+}  // namespace net_utils
+
+#endif  // BASE_NET_UTILS_DISK_CACHE_H_
@@ -0,0 +1,191 @@
+#include "dns_cache.h"
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "advanced_time.h"
+
+namespace net_utils {
+
+using base::AdvancedTime;
+
+namespace {
+
+// Bounds of TTL of records; zero TTL would make every request a miss.
+const uint32_t kMinTtlSeconds = 5;
+const uint32_t kMaxTtlSeconds = 3600;
+// Time after TTL while addresses are served during refresh.
+const uint64_t kStaleTtlMs = 300000;
+const uint64_t kNegativeTtlMs = 5000;
+const size_t kMaxEntries = 4096;
+
+}  // namespace
+
+DnsCache::Stats::Stats() : hits(0), stale_hits(0), negative_hits(0),
+                           misses(0), coalesced(0), resolutions(0),
+                           failures(0) {}
+
+std::string DnsCache::Stats::ToString() const {
+  std::stringstream stream;
+  stream << "hits: " << hits << " stale_hits: " << stale_hits
+         << " negative_hits: " << negative_hits << " misses: " << misses
+         << " coalesced: " << coalesced << " resolutions: " << resolutions
+         << " failures: " << failures;
+  return stream.str();
+}
+
+// static
+DnsCache* DnsCache::GetInstance() {
+  static DnsCache instance;
+  return &instance;
+}
+
+DnsCache::DnsCache() {}
+
+// static
+std::string DnsCache::MakeKey(const std::string& host,
+                              const std::string& port) {
+  return host + ":" + port;
+}
+
+DnsCache::LookupResult DnsCache::Lookup(const std::string& host,
+                                        const std::string& port,
+                                        std::vector<sockaddr_storage>* addresses,
+                                        const Callback& callback) {
+  std::unique_lock<std::mutex> lock(locker_);
+  std::string key = MakeKey(host, port);
+  auto index_it = index_.find(key);
+  if (index_it == index_.end()) {
+    GetEntry(key)->is_pending = true;
+    ++stats_.misses;
+    return MISS;
+  }
+  auto it = index_it->second;
+  Entry& entry = *it;
+  entries_.splice(entries_.begin(), entries_, it);
+  AdvancedTime now = AdvancedTime::Now();
+  if (now < entry.fresh_end) {
+    if (entry.is_negative) {
+      ++stats_.negative_hits;
+      return NEGATIVE;
+    }
+    ++stats_.hits;
+    *addresses = entry.addresses;
+    return HIT;
+  }
+  if (now < entry.stale_end) {
+    ++stats_.stale_hits;
+    *addresses = entry.addresses;
+    if (entry.is_pending) {
+      return HIT;
+    }
+    entry.is_pending = true;
+    return STALE;
+  }
+  if (entry.is_pending) {
+    entry.waiters.push_back(callback);
+    ++stats_.coalesced;
+    return PENDING;
+  }
+  // Expired entry is kept as the marker of the resolution.
+  entry.is_pending = true;
+  ++stats_.misses;
+  return MISS;
+}
+
+void DnsCache::Store(const std::string& host, const std::string& port,
+                     const std::vector<sockaddr_storage>& addresses,
+                     uint32_t ttl_seconds) {
+  if (addresses.empty()) {
+    StoreFailure(host, port);
+    return;
+  }
+  ttl_seconds = std::max(kMinTtlSeconds,
+                         std::min(kMaxTtlSeconds, ttl_seconds));
+  std::unique_lock<std::mutex> lock(locker_);
+  ++stats_.resolutions;
+  AdvancedTime now = AdvancedTime::Now();
+  Entry* entry = GetEntry(MakeKey(host, port));
+  entry->addresses = addresses;
+  entry->fresh_end = now + AdvancedTime::FromSeconds(ttl_seconds);
+  entry->stale_end =
+      entry->fresh_end + AdvancedTime::FromMilliseconds(kStaleTtlMs);
+  entry->is_negative = false;
+  std::vector<Callback> waiters = Finish(entry);
+  lock.unlock();
+  for (const Callback& waiter : waiters) {
+    waiter(addresses);
+  }
+}
+
+void DnsCache::StoreFailure(const std::string& host,
+                            const std::string& port) {
+  std::unique_lock<std::mutex> lock(locker_);
+  ++stats_.resolutions;
+  ++stats_.failures;
+  AdvancedTime now = AdvancedTime::Now();
+  Entry* entry = GetEntry(MakeKey(host, port));
+  if (entry->is_negative || entry->addresses.empty() ||
+      now >= entry->stale_end) {
+    entry->addresses.clear();
+    entry->fresh_end = now + AdvancedTime::FromMilliseconds(kNegativeTtlMs);
+    entry->stale_end = entry->fresh_end;
+    entry->is_negative = true;
+  }
+  std::vector<sockaddr_storage> addresses = entry->addresses;
+  std::vector<Callback> waiters = Finish(entry);
+  lock.unlock();
+  for (const Callback& waiter : waiters) {
+    waiter(addresses);
+  }
+}
+
+DnsCache::Entry* DnsCache::GetEntry(const std::string& key) {
+  auto index_it = index_.find(key);
+  if (index_it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, index_it->second);
+    return &*index_it->second;
+  }
+  Evict();
+  entries_.emplace_front(key);
+  index_.emplace(key, entries_.begin());
+  return &entries_.front();
+}
+
+std::vector<DnsCache::Callback> DnsCache::Finish(Entry* entry) {
+  entry->is_pending = false;
+  std::vector<Callback> waiters;
+  waiters.swap(entry->waiters);
+  return waiters;
+}
+
+void DnsCache::Evict() {
+  // Expired entries aren't looked up, so they sink to the back first.
+  // Entry which is being resolved would lose its waiters, so it's moved to
+  // the front instead; there are few of them, since every loop limits its
+  // pending queries.
+  for (size_t i = 0; i < entries_.size() && entries_.size() >= kMaxEntries;
+       ++i) {
+    auto it = std::prev(entries_.end());
+    if (!it->is_pending) {
+      Erase(it);
+      return;
+    }
+    entries_.splice(entries_.begin(), entries_, it);
+  }
+}
+
+void DnsCache::Erase(std::list<Entry>::iterator it) {
+  index_.erase(it->key);
+  entries_.erase(it);
+}
+
+DnsCache::Stats DnsCache::GetStats() {
+  std::unique_lock<std::mutex> lock(locker_);
+  return stats_;
+}
+
+}  // namespace net_utils
@@ -0,0 +1,121 @@
+#ifndef BASE_NET_UTILS_DNS_CACHE_H_
+#define BASE_NET_UTILS_DNS_CACHE_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "advanced_time.h"
+#include "macros.h"
+
+namespace net_utils {
+
+// Process-wide cache of resolved hosts, shared by all loops. Addresses are
+// fresh for TTL of their records; after that they are still served for a
+// while (stale-while-revalidate) and the caller refreshes them in the
+// background. Failures are cached too, so unknown host isn't resolved again
+// on every request. Host is resolved by one loop at a time: the loop which
+// missed it first claims the entry, and misses of other loops wait for its
+// result.
+class DnsCache {
+ public:
+  enum LookupResult {
+    // Also given for stale addresses which another loop already refreshes.
+    HIT,
+    // Addresses are given, but the caller has to resolve the host again.
+    STALE,
+    // Host recently failed to resolve.
+    NEGATIVE,
+    // Caller has to resolve the host and store the result or the failure.
+    MISS,
+    // Another loop resolves the host; callback is called with the result.
+    PENDING
+  };
+
+  // Gets empty addresses if the host can't be resolved.
+  typedef std::function<void(const std::vector<sockaddr_storage>&)> Callback;
+
+  struct Stats {
+    Stats();
+
+    std::string ToString() const;
+
+    uint64_t hits;
+    uint64_t stale_hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    // Misses which waited for the resolution of another loop.
+    uint64_t coalesced;
+    // Results of resolutions which were stored.
+    uint64_t resolutions;
+    uint64_t failures;
+  };
+
+  static DnsCache* GetInstance();
+
+  // Doesn't block; addresses are filled for HIT and STALE. Callback is kept
+  // for PENDING only and is called on the thread which stores the result.
+  LookupResult Lookup(const std::string& host, const std::string& port,
+                      std::vector<sockaddr_storage>* addresses,
+                      const Callback& callback);
+  // Both complete the resolution claimed by MISS or STALE.
+  // TTL is clamped to the range the cache supports.
+  void Store(const std::string& host, const std::string& port,
+             const std::vector<sockaddr_storage>& addresses, uint32_t ttl_seconds);
+  // Addresses which may still be served stale outlive failed refresh.
+  void StoreFailure(const std::string& host, const std::string& port);
+
+  Stats GetStats();
+
+ private:
+  struct Entry {
+    explicit Entry(const std::string& entry_key) :
+        key(entry_key),
+        fresh_end(base::AdvancedTime::FromMilliseconds(0)),
+        stale_end(base::AdvancedTime::FromMilliseconds(0)),
+        is_negative(false),
+        is_pending(false) {}
+
+    std::string key;
+    std::vector<sockaddr_storage> addresses;
+    // Entry is fresh till this time and may be served stale till stale_end.
+    base::AdvancedTime fresh_end;
+    base::AdvancedTime stale_end;
+    bool is_negative;
+    // Some loop resolves the host; waiters are misses of other loops.
+    bool is_pending;
+    std::vector<Callback> waiters;
+  };
+
+  DnsCache();
+
+  static std::string MakeKey(const std::string& host, const std::string& port);
+  // Finds or creates the entry. Called under the lock.
+  Entry* GetEntry(const std::string& key);
+  // Ends the resolution; waiters are taken to be called after the lock is
+  // released. Called under the lock.
+  std::vector<Callback> Finish(Entry* entry);
+  // Makes room for a new entry by dropping the least recently used one
+  // which isn't being resolved. Called under the lock.
+  void Evict();
+  // Called under the lock.
+  void Erase(std::list<Entry>::iterator it);
+
+  std::mutex locker_;
+  // Most recently used entries are at the front.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  Stats stats_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(DnsCache);
+};
+
+}  // namespace net_utils
+
+#endif  // BASE_NET_UTILS_DNS_CACHE_H_
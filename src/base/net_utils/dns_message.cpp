@@ -0,0 +1,313 @@
+#include "dns_message.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.h"
+
+namespace net_utils {
+
+namespace {
+
+const size_t kHeaderSize = 12;
+const uint16_t kFlagResponse = 0x8000;
+const uint16_t kFlagTruncated = 0x0200;
+const uint16_t kFlagRecursionDesired = 0x0100;
+const uint16_t kRcodeMask = 0x000f;
+const uint16_t kClassIn = 1;
+const size_t kMaxLabelSize = 63;
+const size_t kMaxNameSize = 253;
+const uint8_t kPointerMask = 0xc0;
+// Protects from loops of compression pointers.
+const size_t kMaxPointers = 32;
+
+const uint16_t kDnsPort = 53;
+const uint64_t kDefaultTimeoutMs = 5000;
+const size_t kDefaultAttempts = 2;
+// Same limits as libc has.
+const size_t kMaxNameservers = 3;
+const uint64_t kMaxTimeoutMs = 30000;
+const size_t kMaxAttempts = 5;
+
+void AppendUint16(uint16_t value, std::string* data) {
+  data->push_back(static_cast<char>(value >> 8));
+  data->push_back(static_cast<char>(value & 0xff));
+}
+
+class Reader {
+ public:
+  Reader(const char* data, size_t size) :
+      data_(reinterpret_cast<const uint8_t*>(data)), size_(size), pos_(0) {}
+
+  bool ReadUint16(uint16_t* value) {
+    if (size_ - pos_ < 2) {
+      return false;
+    }
+    *value = (data_[pos_] << 8) | data_[pos_ + 1];
+    pos_ += 2;
+    return true;
+  }
+
+  bool ReadUint32(uint32_t* value) {
+    uint16_t high = 0;
+    uint16_t low = 0;
+    if (!ReadUint16(&high) || !ReadUint16(&low)) {
+      return false;
+    }
+    *value = (static_cast<uint32_t>(high) << 16) | low;
+    return true;
+  }
+
+  // Decodes possibly compressed name; name can be nullptr to skip it.
+  bool ReadName(std::string* name) {
+    size_t pos = pos_;
+    bool is_jumped = false;
+    size_t pointers = 0;
+    for (;;) {
+      if (pos >= size_) {
+        return false;
+      }
+      uint8_t length = data_[pos];
+      if ((length & kPointerMask) == kPointerMask) {
+        if (pos + 1 >= size_ || ++pointers > kMaxPointers) {
+          return false;
+        }
+        if (!is_jumped) {
+          pos_ = pos + 2;
+          is_jumped = true;
+        }
+        pos = ((length & ~kPointerMask) << 8) | data_[pos + 1];
+        continue;
+      }
+      if (length > kMaxLabelSize) {
+        return false;
+      }
+      ++pos;
+      if (length == 0) {
+        break;
+      }
+      if (size_ - pos < length) {
+        return false;
+      }
+      if (name != nullptr) {
+        if (!name->empty()) {
+          name->push_back('.');
+        }
+        for (size_t i = 0; i < length; ++i) {
+          name->push_back(tolower(data_[pos + i]));
+        }
+      }
+      pos += length;
+    }
+    if (!is_jumped) {
+      pos_ = pos;
+    }
+    return true;
+  }
+
+  bool Skip(size_t size) {
+    if (size_ - pos_ < size) {
+      return false;
+    }
+    pos_ += size;
+    return true;
+  }
+
+  const uint8_t* GetCurrent() const {
+    return data_ + pos_;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+};
+
+std::string ToLower(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+}  // namespace
+
+ResolverConfig::ResolverConfig() : timeout_ms(kDefaultTimeoutMs),
+                                   attempts(kDefaultAttempts) {}
+
+bool BuildDnsQuery(uint16_t id, const std::string& name, uint16_t type,
+                   std::string* query) {
+  std::string host = name;
+  if (!host.empty() && host.back() == '.') {
+    host.pop_back();
+  }
+  if (host.empty() || host.size() > kMaxNameSize) {
+    return false;
+  }
+  query->clear();
+  AppendUint16(id, query);
+  AppendUint16(kFlagRecursionDesired, query);
+  AppendUint16(1, query);  // questions
+  AppendUint16(0, query);  // answers
+  AppendUint16(0, query);  // authority records
+  AppendUint16(0, query);  // additional records
+  size_t begin = 0;
+  while (begin <= host.size()) {
+    size_t end = host.find('.', begin);
+    if (end == std::string::npos) {
+      end = host.size();
+    }
+    size_t length = end - begin;
+    if (length == 0 || length > kMaxLabelSize) {
+      return false;
+    }
+    query->push_back(static_cast<char>(length));
+    query->append(host, begin, length);
+    begin = end + 1;
+  }
+  query->push_back(0);
+  AppendUint16(type, query);
+  AppendUint16(kClassIn, query);
+  return true;
+}
+
+bool ParseDnsResponse(const char* data, size_t size, DnsResponse* response) {
+  Reader reader(data, size);
+  uint16_t flags = 0;
+  uint16_t questions = 0;
+  uint16_t answers = 0;
+  if (!reader.ReadUint16(&response->id) || !reader.ReadUint16(&flags) ||
+      !reader.ReadUint16(&questions) || !reader.ReadUint16(&answers) ||
+      !reader.Skip(kHeaderSize - 8)) {
+    return false;
+  }
+  if (!(flags & kFlagResponse) || questions != 1) {
+    return false;
+  }
+  response->rcode = flags & kRcodeMask;
+  response->is_truncated = (flags & kFlagTruncated) != 0;
+  response->name.clear();
+  if (!reader.ReadName(&response->name) ||
+      !reader.ReadUint16(&response->type) || !reader.Skip(2)) {
+    return false;
+  }
+  response->ipv4_addresses.clear();
+  response->ipv6_addresses.clear();
+  response->ttl = UINT32_MAX;
+  for (uint16_t i = 0; i < answers; ++i) {
+    uint16_t type = 0;
+    uint16_t record_class = 0;
+    uint32_t ttl = 0;
+    uint16_t data_size = 0;
+    if (!reader.ReadName(nullptr) || !reader.ReadUint16(&type) ||
+        !reader.ReadUint16(&record_class) || !reader.ReadUint32(&ttl) ||
+        !reader.ReadUint16(&data_size)) {
+      // Truncated message still may carry some addresses.
+      break;
+    }
+    const uint8_t* record_data = reader.GetCurrent();
+    if (!reader.Skip(data_size)) {
+      break;
+    }
+    if (record_class != kClassIn) {
+      continue;
+    }
+    if (type == kDnsTypeA && data_size == sizeof(in_addr)) {
+      in_addr address;
+      std::copy(record_data, record_data + sizeof(in_addr),
+                reinterpret_cast<uint8_t*>(&address));
+      response->ipv4_addresses.push_back(address);
+    } else if (type == kDnsTypeAAAA && data_size == sizeof(in6_addr)) {
+      in6_addr address;
+      std::copy(record_data, record_data + sizeof(in6_addr),
+                reinterpret_cast<uint8_t*>(&address));
+      response->ipv6_addresses.push_back(address);
+    } else {
+      continue;
+    }
+    response->ttl = std::min(response->ttl, ttl);
+  }
+  if (response->ipv4_addresses.empty() && response->ipv6_addresses.empty()) {
+    response->ttl = 0;
+  }
+  return true;
+}
+
+void ParseResolvConf(const std::string& path, ResolverConfig* config) {
+  std::ifstream file(path);
+  if (!file) {
+    LOGW << "Can't read " << path << "; use defaults";
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::stringstream stream(line);
+    std::string keyword;
+    stream >> keyword;
+    if (keyword == "nameserver") {
+      std::string address;
+      stream >> address;
+      sockaddr_in nameserver = {};
+      nameserver.sin_family = AF_INET;
+      nameserver.sin_port = htons(kDnsPort);
+      if (config->nameservers.size() < kMaxNameservers &&
+          ::inet_pton(AF_INET, address.c_str(), &nameserver.sin_addr) == 1) {
+        config->nameservers.push_back(nameserver);
+      }
+    } else if (keyword == "options") {
+      std::string option;
+      while (stream >> option) {
+        if (option.compare(0, 8, "timeout:") == 0) {
+          config->timeout_ms = std::min<uint64_t>(
+              strtoull(option.c_str() + 8, nullptr, 10) * 1000,
+              kMaxTimeoutMs);
+        } else if (option.compare(0, 9, "attempts:") == 0) {
+          config->attempts = std::min<size_t>(
+              strtoull(option.c_str() + 9, nullptr, 10), kMaxAttempts);
+        }
+      }
+    }
+  }
+  if (config->timeout_ms == 0) {
+    config->timeout_ms = kDefaultTimeoutMs;
+  }
+  if (config->attempts == 0) {
+    config->attempts = 1;
+  }
+  if (config->nameservers.empty()) {
+    sockaddr_in nameserver = {};
+    nameserver.sin_family = AF_INET;
+    nameserver.sin_port = htons(kDnsPort);
+    nameserver.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config->nameservers.push_back(nameserver);
+  }
+}
+
+void ParseHostsFile(
+    const std::string& path,
+    std::unordered_map<std::string, std::vector<std::string>>* hosts) {
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::stringstream stream(line);
+    std::string ip;
+    in6_addr address;
+    if (!(stream >> ip) ||
+        (::inet_pton(AF_INET, ip.c_str(), &address) != 1 &&
+         ::inet_pton(AF_INET6, ip.c_str(), &address) != 1)) {
+      continue;
+    }
+    std::string name;
+    while (stream >> name) {
+      (*hosts)[ToLower(name)].push_back(ip);
+    }
+  }
+}
+
+}  // namespace net_utils
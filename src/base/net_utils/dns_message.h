@@ -0,0 +1,67 @@
+#ifndef BASE_NET_UTILS_DNS_MESSAGE_H_
+#define BASE_NET_UTILS_DNS_MESSAGE_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace net_utils {
+
+// Encoding and decoding of DNS messages (RFC 1035) and the configuration of
+// the stub resolver.
+
+const uint16_t kDnsTypeA = 1;
+const uint16_t kDnsTypeAAAA = 28;
+
+const uint8_t kDnsRcodeSuccess = 0;
+const uint8_t kDnsRcodeNameError = 3;
+
+struct DnsResponse {
+  DnsResponse() : id(0), type(0), rcode(0), ttl(0), is_truncated(false) {}
+
+  uint16_t id;
+  // Type of the question.
+  uint16_t type;
+  uint8_t rcode;
+  // Name of the question, lowercase and without the trailing dot.
+  std::string name;
+  // A and AAAA records of the answer section; CNAMEs which lead to them are
+  // skipped.
+  std::vector<in_addr> ipv4_addresses;
+  std::vector<in6_addr> ipv6_addresses;
+  // Minimal TTL of the addresses, in seconds.
+  uint32_t ttl;
+  bool is_truncated;
+};
+
+struct ResolverConfig {
+  ResolverConfig();
+
+  std::vector<sockaddr_in> nameservers;
+  // Time to wait for an answer of one server.
+  uint64_t timeout_ms;
+  // Number of rounds over all servers.
+  size_t attempts;
+};
+
+// Recursive query for records of the given type. Returns false if name
+// can't be encoded.
+bool BuildDnsQuery(uint16_t id, const std::string& name, uint16_t type,
+                   std::string* query);
+// Returns false if message is malformed or isn't a response.
+bool ParseDnsResponse(const char* data, size_t size, DnsResponse* response);
+
+// Reads nameserver and options (timeout, attempts) lines. IPv6 servers are
+// skipped; if there is no server, local one is used as libc does.
+void ParseResolvConf(const std::string& path, ResolverConfig* config);
+// Reads addresses of /etc/hosts-like file; names are lowercase.
+void ParseHostsFile(
+    const std::string& path,
+    std::unordered_map<std::string, std::vector<std::string>>* hosts);
+
+}  // namespace net_utils
+
+#endif  // BASE_NET_UTILS_DNS_MESSAGE_H_
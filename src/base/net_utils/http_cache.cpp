@@ -0,0 +1,504 @@
+#include "http_cache.h"
+
+#include <ctype.h>
+#include <strings.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "advanced_time.h"
+#include "disk_cache.h"
+#include "http_parser.h"
+#include "logger.h"
+
+namespace net_utils {
+
+using base::AdvancedTime;
+
+namespace {
+
+const char kRequestEnd[] = "\r\n\r\n";
+const char kAgeTag[] = "Age:";
+// "HTTP/1.1 200"
+const size_t kStatusCodePos = 9;
+const size_t kStatusCodeLength = 3;
+const char kHttpDateFormat[] = "%a, %d %b %Y %H:%M:%S GMT";
+// Bookkeeping of an entry besides its data.
+const size_t kEntryOverhead = 256;
+const size_t kMaxObjectSize = 8 * 1024 * 1024;
+// Objects are small enough to let a shard keep at least this many.
+const size_t kMinObjectsPerShard = 4;
+
+std::string ToLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+  return value;
+}
+
+// Lowercase items of comma-separated list without surrounding spaces.
+std::vector<std::string> SplitList(const std::string& value) {
+  std::vector<std::string> items;
+  size_t pos = 0;
+  while (pos < value.size()) {
+    size_t end_pos = value.find(',', pos);
+    if (end_pos == std::string::npos) {
+      end_pos = value.size();
+    }
+    size_t begin = value.find_first_not_of(" \t", pos);
+    if (begin < end_pos) {
+      size_t end = value.find_last_not_of(" \t", end_pos - 1);
+      items.push_back(ToLower(value.substr(begin, end + 1 - begin)));
+    }
+    pos = end_pos + 1;
+  }
+  return items;
+}
+
+bool HasItem(const std::vector<std::string>& items, const std::string& name) {
+  return std::find(items.begin(), items.end(), name) != items.end();
+}
+
+bool ParseSeconds(const std::string& value, uint64_t* seconds) {
+  std::string digits = value;
+  if (digits.size() >= 2 && digits.front() == '"' && digits.back() == '"') {
+    digits = digits.substr(1, digits.size() - 2);
+  }
+  if (digits.empty() ||
+      digits.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  try {
+    *seconds = std::stoull(digits);
+  } catch(...) {
+    return false;
+  }
+  return true;
+}
+
+// Finds "name=value" directive.
+bool GetDirectiveSeconds(const std::vector<std::string>& directives,
+                         const std::string& name, uint64_t* seconds) {
+  std::string prefix = name + "=";
+  for (const std::string& directive : directives) {
+    if (directive.compare(0, prefix.size(), prefix) == 0) {
+      return ParseSeconds(directive.substr(prefix.size()), seconds);
+    }
+  }
+  return false;
+}
+
+bool ParseHttpDate(const std::string& value, time_t* time) {
+  tm parsed = {};
+  const char* end = ::strptime(value.c_str(), kHttpDateFormat, &parsed);
+  if (end == nullptr || *end != '\0') {
+    return false;
+  }
+  *time = ::timegm(&parsed);
+  return true;
+}
+
+// Seconds the response is fresh for since it was generated; false if it has
+// no explicit lifetime.
+bool GetFreshnessLifetime(const HttpParser& response, uint64_t* lifetime) {
+  std::vector<std::string> directives =
+      SplitList(response.GetHeaderValue("Cache-Control"));
+  if (GetDirectiveSeconds(directives, "s-maxage", lifetime) ||
+      GetDirectiveSeconds(directives, "max-age", lifetime)) {
+    return true;
+  }
+  std::string expires = response.GetHeaderValue("Expires");
+  if (expires.empty()) {
+    return false;
+  }
+  time_t expires_time = 0;
+  time_t date_time = 0;
+  // Invalid date means the response is already expired.
+  if (!ParseHttpDate(expires, &expires_time)) {
+    *lifetime = 0;
+    return true;
+  }
+  if (!ParseHttpDate(response.GetHeaderValue("Date"), &date_time)) {
+    date_time = ::time(nullptr);
+  }
+  *lifetime = (expires_time > date_time) ? (expires_time - date_time) : (0);
+  return true;
+}
+
+bool IsCacheableStatus(int status) {
+  switch (status) {
+    case (200):
+    case (203):
+    case (204):
+    case (300):
+    case (301):
+    case (404):
+    case (405):
+    case (410):
+    case (414):
+    case (501):
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void RemoveHeaderLine(std::string* header, const std::string& tag) {
+  size_t pos = header->find("\r\n");
+  while (pos != std::string::npos) {
+    pos += 2;
+    size_t end_pos = header->find("\r\n", pos);
+    if (end_pos == std::string::npos) {
+      return;
+    }
+    if (::strncasecmp(header->c_str() + pos, tag.c_str(), tag.size()) == 0) {
+      header->erase(pos, end_pos + 2 - pos);
+      return;
+    }
+    pos = end_pos;
+  }
+}
+
+std::string AddAge(const std::string& header, uint64_t age) {
+  return header.substr(0, header.size() - 2) + kAgeTag + " " +
+         std::to_string(age) + kRequestEnd;
+}
+
+}  // namespace
+
+HttpCache::Stats::Stats() : hits(0), misses(0), stores(0), evictions(0),
+                            bytes_saved(0) {}
+
+HttpCache::Stats& HttpCache::Stats::operator+=(const Stats& other) {
+  hits += other.hits;
+  misses += other.misses;
+  stores += other.stores;
+  evictions += other.evictions;
+  bytes_saved += other.bytes_saved;
+  return *this;
+}
+
+std::string HttpCache::Stats::ToString() const {
+  uint64_t lookups = hits + misses;
+  std::stringstream stream;
+  stream << "hits: " << hits << " misses: " << misses << " hit_ratio: "
+         << ((lookups == 0) ? (0.0) : (static_cast<double>(hits) / lookups))
+         << " stores: " << stores << " evictions: " << evictions
+         << " bytes_saved: " << bytes_saved;
+  return stream.str();
+}
+
+HttpCache::Response::Response() : file_offset(0), file_size(0) {}
+
+HttpCache::Shard::Shard() : size(0) {}
+
+// static
+HttpCache* HttpCache::GetInstance() {
+  static HttpCache instance;
+  return &instance;
+}
+
+HttpCache::HttpCache() : capacity_(0) {}
+
+void HttpCache::SetCapacity(size_t bytes) {
+  capacity_ = bytes;
+}
+
+bool HttpCache::IsEnabled() const {
+  return capacity_ > 0 || DiskCache::GetInstance()->IsEnabled();
+}
+
+size_t HttpCache::GetMaxObjectSize() const {
+  DiskCache* disk_ptr = DiskCache::GetInstance();
+  if (!disk_ptr->IsEnabled()) {
+    return GetMemoryMaxObjectSize();
+  }
+  return std::max(GetMemoryMaxObjectSize(), disk_ptr->GetMaxObjectSize());
+}
+
+size_t HttpCache::GetMemoryMaxObjectSize() const {
+  return std::min(kMaxObjectSize,
+                  capacity_ / kShardCount / kMinObjectsPerShard);
+}
+
+// static
+std::string HttpCache::MakeKey(const std::string& host,
+                               const std::string& port,
+                               const std::string& target) {
+  return ToLower(host) + ":" + port + " " + target;
+}
+
+// static
+bool HttpCache::IsCacheable(const HttpParser& response) {
+  if (!IsCacheableStatus(response.GetStatusCode()) ||
+      response.IsBodyUntilClose()) {
+    return false;
+  }
+  std::vector<std::string> directives =
+      SplitList(response.GetHeaderValue("Cache-Control"));
+  // Response without revalidation can't be served, and cookies are private.
+  if (HasItem(directives, "no-store") || HasItem(directives, "private") ||
+      HasItem(directives, "no-cache") ||
+      !response.GetHeaderValue("Set-Cookie").empty() ||
+      HasItem(SplitList(response.GetHeaderValue("Vary")), "*")) {
+    return false;
+  }
+  uint64_t lifetime = 0;
+  return GetFreshnessLifetime(response, &lifetime) && lifetime > 0;
+}
+
+HttpCache::Shard* HttpCache::GetShard(const std::string& key) {
+  return &shards_[std::hash<std::string>()(key) % kShardCount];
+}
+
+bool HttpCache::Lookup(const std::string& key, const HttpParser& request,
+                       Response* response) {
+  if (!IsEnabled()) {
+    return false;
+  }
+  Shard* shard = GetShard(key);
+  // Client asks for the response of the origin.
+  std::vector<std::string> directives =
+      SplitList(request.GetHeaderValue("Cache-Control"));
+  uint64_t max_age = 0;
+  if (HasItem(directives, "no-cache") ||
+      (GetDirectiveSeconds(directives, "max-age", &max_age) &&
+       max_age == 0) ||
+      HasItem(SplitList(request.GetHeaderValue("Pragma")), "no-cache")) {
+    std::unique_lock<std::mutex> lock(shard->locker);
+    ++shard->stats.misses;
+    return false;
+  }
+
+  if (!LookupMemory(shard, key, request, response) &&
+      !LookupDisk(key, request, response)) {
+    std::unique_lock<std::mutex> lock(shard->locker);
+    ++shard->stats.misses;
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(shard->locker);
+  ++shard->stats.hits;
+  shard->stats.bytes_saved += response->header.size() +
+      ((response->body != nullptr) ? (response->body->size())
+                                   : (response->file_size));
+  return true;
+}
+
+bool HttpCache::LookupMemory(Shard* shard, const std::string& key,
+                             const HttpParser& request, Response* response) {
+  std::unique_lock<std::mutex> lock(shard->locker);
+  auto index_it = shard->index.find(key);
+  if (index_it == shard->index.end()) {
+    return false;
+  }
+  auto it = index_it->second;
+  AdvancedTime now = AdvancedTime::Now();
+  if (it->expiration_time <= now) {
+    Erase(shard, it);
+    return false;
+  }
+  for (const auto& field : it->vary) {
+    if (request.GetHeaderValue(field.first) != field.second) {
+      return false;
+    }
+  }
+  shard->entries.splice(shard->entries.begin(), shard->entries, it);
+
+  uint64_t age = it->initial_age + (now - it->stored_time).GetSeconds();
+  response->header = AddAge(it->header, age);
+  response->body = it->body;
+  return true;
+}
+
+bool HttpCache::LookupDisk(const std::string& key, const HttpParser& request,
+                           Response* response) {
+  DiskCache::Record record;
+  if (!DiskCache::GetInstance()->Lookup(key, &record)) {
+    return false;
+  }
+  Entry entry;
+  time_t stored_time = 0;
+  if (!ParseEntry(record.meta, &entry, &stored_time)) {
+    return false;
+  }
+  for (const auto& field : entry.vary) {
+    if (request.GetHeaderValue(field.first) != field.second) {
+      return false;
+    }
+  }
+  time_t now = ::time(nullptr);
+  uint64_t age = entry.initial_age +
+                 ((now > stored_time) ? (now - stored_time) : (0));
+  response->header = AddAge(entry.header, age);
+  response->file = record.file;
+  response->file_offset = record.offset;
+  response->file_size = record.size;
+  return true;
+}
+
+void HttpCache::Store(const std::string& key,
+                      const std::string& request_header,
+                      const HttpParser& response_parser,
+                      std::string response) {
+  if (!IsEnabled() || !IsCacheable(response_parser) ||
+      response.size() != response_parser.GetAppendedSize()) {
+    return;
+  }
+  HttpParser request;
+  if (request.Append(request_header.data(), request_header.size()) !=
+      HttpParser::AppendResult::READY_REQUEST) {
+    return;
+  }
+  // Shared cache doesn't keep responses to authorized requests.
+  if (HasItem(SplitList(request.GetHeaderValue("Cache-Control")),
+              "no-store") ||
+      !request.GetHeaderValue("Authorization").empty()) {
+    return;
+  }
+
+  Entry entry;
+  uint64_t lifetime = 0;
+  GetFreshnessLifetime(response_parser, &lifetime);
+  if (!ParseSeconds(response_parser.GetHeaderValue("Age"),
+                    &entry.initial_age)) {
+    entry.initial_age = 0;
+  }
+  if (entry.initial_age >= lifetime) {
+    return;
+  }
+  size_t header_size = response.find(kRequestEnd);
+  // Status line has to be the one of the final response, not of an interim
+  // one which preceded it.
+  if (header_size == std::string::npos ||
+      response.compare(kStatusCodePos, kStatusCodeLength,
+                       std::to_string(response_parser.GetStatusCode())) != 0) {
+    return;
+  }
+  header_size += sizeof(kRequestEnd) - 1;
+  for (const std::string& name :
+       SplitList(response_parser.GetHeaderValue("Vary"))) {
+    entry.vary.emplace_back(name, request.GetHeaderValue(name));
+  }
+  entry.key = key;
+  entry.header = response.substr(0, header_size);
+  RemoveHeaderLine(&entry.header, kAgeTag);
+  response.erase(0, header_size);
+  entry.body = std::make_shared<const std::string>(std::move(response));
+  entry.stored_time = AdvancedTime::Now();
+  entry.expiration_time = entry.stored_time +
+      AdvancedTime::FromSeconds(lifetime - entry.initial_age);
+  entry.size = kEntryOverhead + key.size() + entry.header.size() +
+               entry.body->size();
+  for (const auto& field : entry.vary) {
+    entry.size += field.first.size() + field.second.size();
+  }
+  DiskCache* disk_ptr = DiskCache::GetInstance();
+  if (disk_ptr->IsEnabled()) {
+    time_t now = ::time(nullptr);
+    disk_ptr->Store(key, SerializeEntry(entry, now), entry.body,
+                    now + static_cast<time_t>(lifetime - entry.initial_age));
+  }
+  if (entry.size > GetMemoryMaxObjectSize()) {
+    return;
+  }
+
+  Shard* shard = GetShard(key);
+  size_t shard_capacity = capacity_ / kShardCount;
+  std::unique_lock<std::mutex> lock(shard->locker);
+  auto index_it = shard->index.find(key);
+  if (index_it != shard->index.end()) {
+    Erase(shard, index_it->second);
+  }
+  while (!shard->entries.empty() &&
+         shard->size + entry.size > shard_capacity) {
+    Erase(shard, std::prev(shard->entries.end()));
+    ++shard->stats.evictions;
+  }
+  shard->size += entry.size;
+  shard->entries.push_front(std::move(entry));
+  shard->index[key] = shard->entries.begin();
+  ++shard->stats.stores;
+  FLOGI << "Response was cached: " << key;
+}
+
+void HttpCache::Invalidate(const std::string& key) {
+  if (!IsEnabled()) {
+    return;
+  }
+  Shard* shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard->locker);
+  auto index_it = shard->index.find(key);
+  if (index_it != shard->index.end()) {
+    Erase(shard, index_it->second);
+  }
+  lock.unlock();
+  DiskCache::GetInstance()->Remove(key);
+}
+
+// static
+std::string HttpCache::SerializeEntry(const Entry& entry,
+                                      time_t stored_time) {
+  // "initial_age stored_time fields name_size value_size ...\n", then names
+  // and values, then the header.
+  std::stringstream stream;
+  stream << entry.initial_age << " " << stored_time << " "
+         << entry.vary.size();
+  for (const auto& field : entry.vary) {
+    stream << " " << field.first.size() << " " << field.second.size();
+  }
+  stream << "\n";
+  for (const auto& field : entry.vary) {
+    stream << field.first << field.second;
+  }
+  stream << entry.header;
+  return stream.str();
+}
+
+// static
+bool HttpCache::ParseEntry(const std::string& meta, Entry* entry,
+                           time_t* stored_time) {
+  size_t pos = meta.find('\n');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  std::stringstream stream(meta.substr(0, pos));
+  size_t fields = 0;
+  if (!(stream >> entry->initial_age >> *stored_time >> fields)) {
+    return false;
+  }
+  ++pos;
+  for (size_t i = 0; i < fields; ++i) {
+    size_t name_size = 0;
+    size_t value_size = 0;
+    if (!(stream >> name_size >> value_size) ||
+        name_size + value_size > meta.size() - pos) {
+      return false;
+    }
+    entry->vary.emplace_back(meta.substr(pos, name_size),
+                             meta.substr(pos + name_size, value_size));
+    pos += name_size + value_size;
+  }
+  entry->header = meta.substr(pos);
+  return entry->header.size() >= sizeof(kRequestEnd) - 1;
+}
+
+void HttpCache::Erase(Shard* shard, std::list<Entry>::iterator it) {
+  shard->size -= it->size;
+  shard->index.erase(it->key);
+  shard->entries.erase(it);
+}
+
+HttpCache::Stats HttpCache::GetStats() {
+  Stats stats;
+  for (Shard& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard.locker);
+    stats += shard.stats;
+  }
+  return stats;
+}
+
+}  // namespace net_utils
@@ -0,0 +1,145 @@
+#ifndef BASE_NET_UTILS_HTTP_CACHE_H_
+#define BASE_NET_UTILS_HTTP_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "advanced_time.h"
+#include "file_descriptor.h"
+#include "http_parser.h"
+#include "macros.h"
+
+namespace net_utils {
+
+// Process-wide cache of responses to GET requests, shared by all loops. Only
+// responses with explicit freshness (Cache-Control max-age or s-maxage,
+// Expires) are stored and they are served only while fresh: stale ones
+// aren't revalidated. Responses which vary are served to requests which have
+// the same values of the listed headers.
+// Entries are spread over shards by key; each shard has its own lock and
+// evicts the least recently used entries to stay within its share of the
+// memory budget.
+// If disk cache is opened, stored responses are also written to it and the
+// ones which aren't in memory are served from there.
+class HttpCache {
+ public:
+  struct Stats {
+    Stats();
+
+    Stats& operator+=(const Stats& other);
+    std::string ToString() const;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    // Bytes of responses which were served without the origin.
+    uint64_t bytes_saved;
+  };
+
+  // Body is shared with the entry, so a hit doesn't copy it. Body which is
+  // served from disk is a range of the file instead.
+  struct Response {
+    Response();
+
+    // Stored header with Age of the response.
+    std::string header;
+    std::shared_ptr<const std::string> body;
+    std::shared_ptr<base::FileDescriptor> file;
+    uint64_t file_offset;
+    uint64_t file_size;
+  };
+
+  static HttpCache* GetInstance();
+
+  // Budget is split between shards; zero disables the memory tier. Has to be
+  // set before loops start.
+  void SetCapacity(size_t bytes);
+  // Whether either tier is enabled.
+  bool IsEnabled() const;
+  // Response which is bigger isn't captured.
+  size_t GetMaxObjectSize() const;
+
+  static std::string MakeKey(const std::string& host, const std::string& port,
+                             const std::string& target);
+  // Whether the response may be stored; checked as soon as its header is
+  // parsed.
+  static bool IsCacheable(const HttpParser& response);
+
+  // Fills response if a fresh one matches the request and the request lets
+  // it be served from the cache.
+  bool Lookup(const std::string& key, const HttpParser& request,
+              Response* response);
+  // Stores complete response (header and body as they were received) to the
+  // request if both allow it.
+  void Store(const std::string& key, const std::string& request_header,
+             const HttpParser& response_parser, std::string response);
+  // Request which may change the resource drops its response.
+  void Invalidate(const std::string& key);
+
+  Stats GetStats();
+
+ private:
+  struct Entry {
+    std::string key;
+    // Header without Age; it's added when the response is served.
+    std::string header;
+    std::shared_ptr<const std::string> body;
+    // Lowercase names of headers the response varies by and their values
+    // in the request it was stored for.
+    std::vector<std::pair<std::string, std::string>> vary;
+    base::AdvancedTime stored_time;
+    base::AdvancedTime expiration_time;
+    // Age of the response when it was stored.
+    uint64_t initial_age;
+    size_t size;
+  };
+
+  struct Shard {
+    Shard();
+
+    std::mutex locker;
+    // Most recently used entries are at the front.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t size;
+    Stats stats;
+  };
+
+  static const size_t kShardCount = 16;
+
+  HttpCache();
+
+  // Meta of the disk record: everything but the body, with wall-clock time
+  // the response was stored at.
+  static std::string SerializeEntry(const Entry& entry, time_t stored_time);
+  static bool ParseEntry(const std::string& meta, Entry* entry,
+                         time_t* stored_time);
+
+  size_t GetMemoryMaxObjectSize() const;
+  Shard* GetShard(const std::string& key);
+  // Don't count the lookup.
+  bool LookupMemory(Shard* shard, const std::string& key,
+                    const HttpParser& request, Response* response);
+  bool LookupDisk(const std::string& key, const HttpParser& request,
+                  Response* response);
+  // Called under the lock of the shard.
+  void Erase(Shard* shard, std::list<Entry>::iterator it);
+
+  size_t capacity_;
+  Shard shards_[kShardCount];
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(HttpCache);
+};
+
+}  // namespace net_utils
+
+#endif  // BASE_NET_UTILS_HTTP_CACHE_H_
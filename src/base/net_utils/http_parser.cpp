@@ -1,5 +1,9 @@
 #include "http_parser.h"
 
+#include <ctype.h>
+#include <strings.h>
+
+#include <algorithm>
 #include <string>
 
 #include "logger.h"
@@ -15,22 +19,95 @@ const std::string kLengthTag = "Content-Length:";
 const std::string kHostTag = "Host:";
 
 const std::string kConnectionTypeTag = "Connection:";
+const std::string kProxyConnectionTag = "Proxy-Connection:";
 const std::string kConnectionValueClose = "close";
+const std::string kConnectionValueKeepAlive = "keep-alive";
+
+const std::string kTransferEncodingTag = "Transfer-Encoding:";
+const std::string kTransferEncodingChunked = "chunked";
+
+const std::string kConnectMethod = "CONNECT";
+const std::string kHttpScheme = "http://";
+const std::string kStatusLinePrefix = "HTTP/1.";
+const std::string kHttp11 = "HTTP/1.1";
+// Longer length can't be stored in size_t.
+const size_t kMaxLengthDigits = 18;
+// "HTTP/1.1 200"
+const size_t kStatusCodePos = 9;
+const size_t kStatusCodeLength = 3;
+
+namespace {
+
+std::string ToLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+  return value;
+}
 
-HttpParser::HttpParser(bool is_request) : header_(), host_(), port_(), request_(),
+int GetHexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+}  // namespace
+
+HttpParser::HttpParser(bool is_request, bool is_head_request) :
+                           header_(), host_(), port_(), request_(),
                            length_(std::string::npos),
                            end_header_pos_(std::string::npos),
-                           is_request_(is_request) {}
+                           is_request_(is_request),
+                           is_head_request_(is_head_request),
+                           is_keep_alive_(false),
+                           is_complete_(false),
+                           body_type_(BODY_NONE),
+                           chunk_state_(CHUNK_SIZE),
+                           body_left_(0),
+                           status_code_(0),
+                           appended_size_(0),
+                           chunked_size_(0) {}
 
 HttpParser::~HttpParser() {}
 
-HttpParser::AppendResult HttpParser::Append(const std::string& message) {
-  if (header_.size() + request_.size() + message.size() > kMaxHttpRequsetSize) {
+HttpParser::AppendResult HttpParser::Append(const char* data, size_t size,
+                                            size_t* consumed) {
+  if (consumed != nullptr) {
+    *consumed = size;
+  }
+  if (!is_request_) {
+    size_t response_size = 0;
+    while (response_size < size && !is_complete_) {
+      if (end_header_pos_ == std::string::npos) {
+        response_size += AppendResponseHeader(data + response_size,
+                                              size - response_size);
+      } else {
+        response_size += AppendResponseBody(data + response_size,
+                                            size - response_size);
+      }
+    }
+    appended_size_ += response_size;
+    if (response_size < size) {
+      FLOGE << "Data after the end of http response";
+      is_keep_alive_ = false;
+    }
+    if (consumed != nullptr) {
+      *consumed = response_size;
+    }
+    return (is_complete_) ? (READY_RESPONSE) : (SUCCESS);
+  }
+
+  if (header_.size() + request_.size() + size > kMaxHttpRequsetSize) {
     FLOGE << "Http request is overflowed";
     return HttpParser::AppendResult::ERROR;
   }
 
-  request_ += message;
+  request_.append(data, size);
 
   if (end_header_pos_ == std::string::npos) {
     end_header_pos_ = request_.find(kRequestEnd);
@@ -46,18 +123,64 @@ HttpParser::AppendResult HttpParser::Append(const std::string& message) {
       }
     }
 
-    if (is_request_ && length_ == std::string::npos) {  // Only header
+    if (is_request_ && length_ == std::string::npos &&
+        body_type_ != BODY_CHUNKED) {  // Only header
+      is_complete_ = true;
       return HttpParser::AppendResult::READY_REQUEST;
     }
   }
 
+  if (body_type_ == BODY_CHUNKED) {
+    return AppendRequestChunks();
+  }
 
   if (length_ != std::string::npos && request_.size() >= length_) {  // Header with body
+    is_complete_ = true;
     return HttpParser::AppendResult::READY_REQUEST;
   }
   return HttpParser::AppendResult::SUCCESS;
 }
 
+HttpParser::AppendResult HttpParser::Reset() {
+  std::string rest;
+  if (length_ == std::string::npos) {
+    rest = std::move(request_);
+  } else if (request_.size() > length_) {
+    rest = request_.substr(length_);
+  }
+  *this = HttpParser(is_request_);
+  if (rest.empty()) {
+    return HttpParser::AppendResult::SUCCESS;
+  }
+  return Append(rest.data(), rest.size());
+}
+
+std::string HttpParser::TakeRest() {
+  std::string rest;
+  if (length_ == std::string::npos) {
+    rest = std::move(request_);
+    request_.clear();
+  } else if (request_.size() > length_) {
+    rest = request_.substr(length_);
+    request_.erase(length_);
+  }
+  return rest;
+}
+
+HttpParser::AppendResult HttpParser::AppendRequestChunks() {
+  chunked_size_ += AppendChunks(request_.data() + chunked_size_,
+                                request_.size() - chunked_size_);
+  if (body_type_ == BODY_UNTIL_CLOSE) {
+    return HttpParser::AppendResult::ERROR;
+  }
+  if (!is_complete_) {
+    return HttpParser::AppendResult::SUCCESS;
+  }
+  // Body is relayed as it was received; the rest is the next request.
+  length_ = chunked_size_;
+  return HttpParser::AppendResult::READY_REQUEST;
+}
+
 void HttpParser::InsertTag(const std::string& tag_name, const std::string& value) {
   size_t first_endl_pos = header_.find(kLineEnd, 0);
   std::string to_insert = tag_name + " " + value + kLineEnd;
@@ -76,7 +199,7 @@ void HttpParser::SetTag(const std::string& tag_name, const std::string& value) {
     return;
   }
 
-  size_t pos = header_.find(tag_name, 0);
+  size_t pos = FindTag(tag_name);
   if (pos == std::string::npos) {
     InsertTag(tag_name, value);
   } else {
@@ -84,44 +207,130 @@ void HttpParser::SetTag(const std::string& tag_name, const std::string& value) {
   }
 }
 
+void HttpParser::RemoveTag(const std::string& tag_name) {
+  size_t pos = FindTag(tag_name);
+  if (pos == std::string::npos) {
+    return;
+  }
+  size_t next_endl = header_.find(kLineEnd, pos);
+  header_.erase(pos, next_endl + kLineEnd.size() - pos);
+}
+
 void HttpParser::ModifyHeader() {
   if (end_header_pos_ == std::string::npos) {
     return;
   }
 
-  std::string to_remove = "http://" + host_;
-
-  size_t del_pos = header_.find(to_remove, 0);
-  if (del_pos != std::string::npos) {
-    header_.erase(del_pos, to_remove.size());
+  // Absolute target "http://host[:port]/path" becomes "/path".
+  size_t line_end = header_.find(kLineEnd);
+  size_t target_pos = header_.find(' ') + 1;
+  if (target_pos < line_end &&
+      header_.compare(target_pos, kHttpScheme.size(), kHttpScheme) == 0) {
+    size_t path_pos = header_.find_first_of("/ ",
+                                            target_pos + kHttpScheme.size());
+    if (path_pos < line_end && header_[path_pos] == '/') {
+      header_.erase(target_pos, path_pos - target_pos);
+    } else if (path_pos < line_end) {
+      header_.replace(target_pos, path_pos - target_pos, "/");
+    }
   }
 
-  SetTag(kConnectionTypeTag, kConnectionValueClose);
+  RemoveTag(kProxyConnectionTag);
+  SetTag(kConnectionTypeTag, kConnectionValueKeepAlive);
 }
 
 bool HttpParser::ParseHeader() {
-  ParseLength();
-  ParseHostAndPort();
+  if (IsConnect()) {
+    // Target is "host:port"; request has no body and nothing follows it but
+    // the tunneled bytes.
+    ParseHostAndPort(GetTarget());
+    length_ = std::string::npos;
+    is_keep_alive_ = false;
+    return host_ != "" && port_ != "";
+  }
+  // Request is framed the way the server will frame it or rejected, so the
+  // server can't see a different next request than the proxy does.
+  std::string encoding = GetTagValue(kTransferEncodingTag);
+  if (FindTag(kTransferEncodingTag) != std::string::npos) {
+    if (ToLower(encoding) != kTransferEncodingChunked ||
+        IsTagRepeated(kTransferEncodingTag) ||
+        FindTag(kLengthTag) != std::string::npos) {
+      FLOGE << "Unsupported request framing: " << encoding;
+      return false;
+    }
+    body_type_ = BODY_CHUNKED;
+    chunk_state_ = CHUNK_SIZE;
+    body_left_ = 0;
+  } else if (!ParseLength() || IsTagRepeated(kLengthTag)) {
+    FLOGE << "Malformed request length";
+    return false;
+  }
+  ParseHostAndPort(GetTagValue(kHostTag));
+
+  // Client may ask for persistent connection in either header.
+  size_t line_end = header_.find(kLineEnd);
+  bool is_http11 = line_end >= kHttp11.size() &&
+      header_.compare(line_end - kHttp11.size(), kHttp11.size(), kHttp11) == 0;
+  std::string connection = ToLower(GetTagValue(kConnectionTypeTag) + " " +
+                                   GetTagValue(kProxyConnectionTag));
+  if (is_http11) {
+    is_keep_alive_ = connection.find(kConnectionValueClose) ==
+                     std::string::npos;
+  } else {
+    is_keep_alive_ = connection.find(kConnectionValueKeepAlive) !=
+                     std::string::npos;
+  }
   return host_ != "";
 }
 
+size_t HttpParser::FindTag(const std::string& tag, size_t from) const {
+  // Names are case-insensitive; the first line is request or status line.
+  size_t pos = header_.find(kLineEnd, from);
+  while (pos != std::string::npos) {
+    pos += kLineEnd.size();
+    if (::strncasecmp(header_.c_str() + pos, tag.c_str(), tag.size()) == 0) {
+      return pos;
+    }
+    pos = header_.find(kLineEnd, pos);
+  }
+  return std::string::npos;
+}
+
+bool HttpParser::IsTagRepeated(const std::string& tag) const {
+  size_t pos = FindTag(tag);
+  return pos != std::string::npos &&
+         FindTag(tag, pos) != std::string::npos;
+}
+
 std::string HttpParser::GetTagValue(const std::string& tag) const {
   if (end_header_pos_ == std::string::npos) {
     return "";
   }
 
-  size_t tag_pos = header_.find(tag);
+  size_t tag_pos = FindTag(tag);
   if (tag_pos == std::string::npos) {
     return "";
   }
   size_t next_endline_pos = header_.find(kLineEnd, tag_pos);
-  size_t pos = tag_pos + tag.size() + 1;
-  return header_.substr(pos, next_endline_pos - pos);
+  size_t pos = header_.find_first_not_of(" \t", tag_pos + tag.size());
+  if (pos >= next_endline_pos) {
+    return "";
+  }
+  size_t end_pos = header_.find_last_not_of(" \t", next_endline_pos - 1);
+  return header_.substr(pos, end_pos + 1 - pos);
 }
 
-void HttpParser::ParseHostAndPort() {
-  std::string host_and_port = GetTagValue(kHostTag);
-
+void HttpParser::ParseHostAndPort(const std::string& host_and_port) {
+  // IPv6 literal is enclosed in brackets: "[::1]:8080".
+  if (!host_and_port.empty() && host_and_port[0] == '[') {
+    size_t end_pos = host_and_port.find(']');
+    if (end_pos != std::string::npos) {
+      host_ = host_and_port.substr(1, end_pos - 1);
+      port_ = (host_and_port.compare(end_pos, 2, "]:") == 0)
+              ? host_and_port.substr(end_pos + 2) : "";
+      return;
+    }
+  }
   size_t del_pos = host_and_port.find(":");
   if (del_pos == std::string::npos) {
     host_ = host_and_port;
@@ -133,14 +342,26 @@ void HttpParser::ParseHostAndPort() {
                                host_and_port.size() - 1 - host_.size());
 }
 
-void HttpParser::ParseLength() {
+bool HttpParser::ParseLength() {
+  length_ = std::string::npos;
+  if (FindTag(kLengthTag) == std::string::npos) {
+    return true;
+  }
+  // Sign, spaces or list of values aren't allowed.
   std::string length = GetTagValue(kLengthTag);
-  try {
-    size_t len = std::stoul(length);
-    length_ = len;
-  } catch(...) {
-    length_ = std::string::npos;
+  if (length.empty() || length.size() > kMaxLengthDigits ||
+      length.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
   }
+  length_ = std::stoull(length);
+  return true;
+}
+
+std::string HttpParser::GetMethod() const {
+  if (end_header_pos_ == std::string::npos) {
+    return "";
+  }
+  return header_.substr(0, header_.find(' '));
 }
 
 std::string HttpParser::GetHost() const {
@@ -151,6 +372,35 @@ std::string HttpParser::GetPort() const {
   return port_;
 }
 
+bool HttpParser::IsConnect() const {
+  return GetMethod() == kConnectMethod;
+}
+
+std::string HttpParser::GetTarget() const {
+  if (end_header_pos_ == std::string::npos) {
+    return "";
+  }
+  size_t target_pos = header_.find(' ') + 1;
+  size_t target_end = header_.find_first_of(" \r", target_pos);
+  return header_.substr(target_pos, target_end - target_pos);
+}
+
+std::string HttpParser::GetHeaderValue(const std::string& name) const {
+  return GetTagValue(name + ":");
+}
+
+int HttpParser::GetStatusCode() const {
+  return status_code_;
+}
+
+bool HttpParser::IsBodyUntilClose() const {
+  return body_type_ == BODY_UNTIL_CLOSE;
+}
+
+uint64_t HttpParser::GetAppendedSize() const {
+  return appended_size_;
+}
+
 std::string HttpParser::GetRequest() const {
   std::string req = "";
   if (length_ == std::string::npos) {
@@ -162,4 +412,215 @@ std::string HttpParser::GetRequest() const {
   return req;
 }
 
+bool HttpParser::IsKeepAlive() const {
+  return is_keep_alive_ && is_complete_;
+}
+
+size_t HttpParser::GetOpaqueBodyLength() const {
+  if (is_request_ || end_header_pos_ == std::string::npos || is_complete_) {
+    return 0;
+  }
+  if (body_type_ == BODY_UNTIL_CLOSE) {
+    return SIZE_MAX;
+  }
+  if (body_type_ == BODY_LENGTH) {
+    return (body_left_ < SIZE_MAX) ? (body_left_) : (SIZE_MAX);
+  }
+  return 0;
+}
+
+HttpParser::AppendResult HttpParser::SkipBody(size_t size) {
+  if (body_type_ == BODY_LENGTH) {
+    body_left_ -= std::min<uint64_t>(body_left_, size);
+    is_complete_ = (body_left_ == 0);
+  }
+  return (is_complete_) ? (READY_RESPONSE) : (SUCCESS);
+}
+
+size_t HttpParser::AppendResponseHeader(const char* data, size_t size) {
+  size_t old_size = request_.size();
+  request_.append(data, size);
+  size_t search_pos = (old_size > kRequestEnd.size()) ?
+                      (old_size - kRequestEnd.size()) : (0);
+  size_t end_pos = request_.find(kRequestEnd, search_pos);
+  if (end_pos == std::string::npos) {
+    if (request_.size() > kMaxHttpRequsetSize) {
+      FLOGE << "Http response header is overflowed";
+      request_.clear();
+      SetUntilClose();
+    }
+    return size;
+  }
+
+  end_header_pos_ = end_pos;
+  header_ = request_.substr(0, end_pos + kRequestEnd.size());
+  request_.clear();
+  size_t consumed = header_.size() - old_size;
+  ParseResponseHeader();
+  return consumed;
+}
+
+void HttpParser::ParseResponseHeader() {
+  if (header_.compare(0, kStatusLinePrefix.size(), kStatusLinePrefix) != 0) {
+    FLOGE << "Malformed http status line";
+    SetUntilClose();
+    return;
+  }
+  bool is_http11 = header_[kStatusLinePrefix.size()] == '1';
+  int status = 0;
+  try {
+    status = std::stoi(header_.substr(kStatusCodePos, kStatusCodeLength));
+  } catch(...) {
+    FLOGE << "Malformed http status code";
+    SetUntilClose();
+    return;
+  }
+  status_code_ = status;
+
+  if (status >= 100 && status < 200 && status != 101) {
+    // Interim response is followed by the final one.
+    header_.clear();
+    end_header_pos_ = std::string::npos;
+    return;
+  }
+
+  std::string connection = ToLower(GetTagValue(kConnectionTypeTag));
+  if (is_http11) {
+    is_keep_alive_ = connection.find(kConnectionValueClose) ==
+                     std::string::npos;
+  } else {
+    is_keep_alive_ = connection.find(kConnectionValueKeepAlive) !=
+                     std::string::npos;
+  }
+
+  if (is_head_request_ || status == 204 || status == 304) {
+    body_type_ = BODY_NONE;
+    is_complete_ = true;
+    return;
+  }
+  if (status == 101) {
+    SetUntilClose();
+    return;
+  }
+  if (ToLower(GetTagValue(kTransferEncodingTag)).find(
+          kTransferEncodingChunked) != std::string::npos) {
+    body_type_ = BODY_CHUNKED;
+    chunk_state_ = CHUNK_SIZE;
+    body_left_ = 0;
+    return;
+  }
+  if (!ParseLength() || length_ == std::string::npos) {
+    SetUntilClose();
+    return;
+  }
+  body_type_ = BODY_LENGTH;
+  body_left_ = length_;
+  is_complete_ = (body_left_ == 0);
+}
+
+size_t HttpParser::AppendResponseBody(const char* data, size_t size) {
+  switch (body_type_) {
+    case (BODY_LENGTH): {
+      size_t consumed = std::min<uint64_t>(body_left_, size);
+      SkipBody(consumed);
+      return consumed;
+    }
+
+    case (BODY_CHUNKED):
+      return AppendChunks(data, size);
+
+    default:
+      return size;
+  }
+}
+
+size_t HttpParser::AppendChunks(const char* data, size_t size) {
+  size_t i = 0;
+  while (i < size && !is_complete_) {
+    char c = data[i];
+    switch (chunk_state_) {
+      case (CHUNK_SIZE): {
+        int digit = GetHexDigit(c);
+        if (digit >= 0 && body_left_ <= (UINT64_MAX >> 4)) {
+          body_left_ = body_left_ * 16 + digit;
+        } else if (c == '\r') {
+          chunk_state_ = CHUNK_SIZE_LF;
+        } else if (c == ';' || c == ' ' || c == '\t') {
+          chunk_state_ = CHUNK_EXTENSION;
+        } else {
+          FLOGE << "Malformed chunk size";
+          SetUntilClose();
+          return size;
+        }
+        break;
+      }
+
+      case (CHUNK_EXTENSION):
+        if (c == '\r') {
+          chunk_state_ = CHUNK_SIZE_LF;
+        }
+        break;
+
+      case (CHUNK_SIZE_LF):
+        if (c != '\n') {
+          FLOGE << "Malformed chunk size line";
+          SetUntilClose();
+          return size;
+        }
+        chunk_state_ = (body_left_ == 0) ? (CHUNK_TRAILER_START) : (CHUNK_DATA);
+        break;
+
+      case (CHUNK_DATA): {
+        size_t chunk = std::min<uint64_t>(body_left_, size - i);
+        body_left_ -= chunk;
+        i += chunk;
+        if (body_left_ == 0) {
+          chunk_state_ = CHUNK_DATA_CR;
+        }
+        continue;
+      }
+
+      case (CHUNK_DATA_CR):
+      case (CHUNK_DATA_LF):
+        if (c != ((chunk_state_ == CHUNK_DATA_CR) ? ('\r') : ('\n'))) {
+          FLOGE << "Malformed chunk end";
+          SetUntilClose();
+          return size;
+        }
+        chunk_state_ = (chunk_state_ == CHUNK_DATA_CR) ?
+                       (CHUNK_DATA_LF) : (CHUNK_SIZE);
+        break;
+
+      case (CHUNK_TRAILER_START):
+        chunk_state_ = (c == '\r') ? (CHUNK_LAST_LF) : (CHUNK_TRAILER);
+        break;
+
+      case (CHUNK_TRAILER):
+        if (c == '\n') {
+          chunk_state_ = CHUNK_TRAILER_START;
+        }
+        break;
+
+      case (CHUNK_LAST_LF):
+        if (c != '\n') {
+          FLOGE << "Malformed last chunk";
+          SetUntilClose();
+          return size;
+        }
+        is_complete_ = true;
+        break;
+    }
+    ++i;
+  }
+  return i;
+}
+
+void HttpParser::SetUntilClose() {
+  body_type_ = BODY_UNTIL_CLOSE;
+  is_keep_alive_ = false;
+  if (end_header_pos_ == std::string::npos) {
+    end_header_pos_ = 0;
+  }
+}
+
 }
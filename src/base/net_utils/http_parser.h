@@ -1,41 +1,120 @@
 #ifndef BASE_NET_UTILS_HTTP_PARSER_H_
 #define BASE_NET_UTILS_HTTP_PARSER_H_
 
+#include <stdint.h>
+
 #include <string>
 
 namespace net_utils {
 
+// Request parser accumulates the whole request. Response parser only tracks
+// framing of relayed data to find where the response ends: the body isn't
+// stored.
 class HttpParser {
  public:
   enum AppendResult {
     SUCCESS,
     READY_REQUEST,
+    READY_RESPONSE,
     ERROR
   };
 
-  HttpParser(bool is_request = true);
+  // Response to HEAD request has no body.
+  HttpParser(bool is_request = true, bool is_head_request = false);
   ~HttpParser();
 
-  AppendResult Append(const std::string& message);
+  // Response parser stops at the end of the response; consumed, if given,
+  // is set to the number of bytes which belong to it. Request parser keeps
+  // everything for the next requests.
+  AppendResult Append(const char* data, size_t size,
+                      size_t* consumed = nullptr);
+  // Drops the ready request and parses bytes which were received after it,
+  // so READY_REQUEST is returned if the next request is complete too.
+  AppendResult Reset();
+  // Returns bytes which were received after the ready request; they aren't
+  // parsed by Reset. Bytes after CONNECT belong to the tunnel.
+  std::string TakeRest();
 
   std::string GetRequest() const;
+  std::string GetMethod() const;
   std::string GetHost() const;
   std::string GetPort() const;
+  // Request asks for a tunnel; host and port are taken from the target.
+  bool IsConnect() const;
+  // Request target as it's in the request line.
+  std::string GetTarget() const;
+  // Value of the header field; empty if there is no such field.
+  std::string GetHeaderValue(const std::string& name) const;
+  // Status code of the response; 0 until its header is parsed.
+  int GetStatusCode() const;
+  // Response body ends only when the server closes the connection.
+  bool IsBodyUntilClose() const;
+  // Bytes of the response which were consumed by Append.
+  uint64_t GetAppendedSize() const;
 
+  // Makes request target relative and asks the server to keep the
+  // connection alive.
   void ModifyHeader();
 
+  // Whether the client can send the next request after this one or the
+  // server can take the next request after this response.
+  bool IsKeepAlive() const;
+  // Number of body bytes which may be relayed without passing through
+  // Append: rest of the body of known length, SIZE_MAX if body lasts until
+  // the connection is closed, 0 if it isn't known or has to be parsed.
+  size_t GetOpaqueBodyLength() const;
+  // Accounts body bytes which were relayed without Append.
+  AppendResult SkipBody(size_t size);
+
  private:
+  enum BodyType {
+    BODY_NONE,
+    BODY_LENGTH,
+    BODY_CHUNKED,
+    BODY_UNTIL_CLOSE
+  };
+
+  enum ChunkState {
+    CHUNK_SIZE,
+    CHUNK_EXTENSION,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER_START,
+    CHUNK_TRAILER,
+    CHUNK_LAST_LF
+  };
+
+  // Position of the tag at the beginning of a header line which starts at
+  // from or after it.
+  size_t FindTag(const std::string& tag, size_t from = 0) const;
+  // Whether the field is present more than once.
+  bool IsTagRepeated(const std::string& tag) const;
   std::string GetTagValue(const std::string& tag) const;
 
-  void ParseLength();
-  void ParseHostAndPort();
+  // Returns false if Content-Length is present but isn't a number.
+  bool ParseLength();
+  void ParseHostAndPort(const std::string& host_and_port);
 
   bool ParseHeader();
 
   void SetTag(const std::string&, const std::string&);
+  void RemoveTag(const std::string&);
   void InsertTag(const std::string&, const std::string&);
   void ReplaceTag(const std::string&, const std::string&, size_t);
 
+  // Each returns number of consumed bytes.
+  size_t AppendResponseHeader(const char* data, size_t size);
+  size_t AppendResponseBody(const char* data, size_t size);
+  size_t AppendChunks(const char* data, size_t size);
+  // Parses received part of chunked request body; it's complete once the
+  // last chunk and trailer are received.
+  AppendResult AppendRequestChunks();
+  void ParseResponseHeader();
+  // Response can't be framed; it's relayed until the server closes.
+  void SetUntilClose();
+
   std::string header_;
   std::string host_;
   std::string port_;
@@ -43,6 +122,18 @@ class HttpParser {
   size_t length_;
   size_t end_header_pos_;
   bool is_request_;
+
+  bool is_head_request_;
+  bool is_keep_alive_;
+  bool is_complete_;
+  BodyType body_type_;
+  ChunkState chunk_state_;
+  // Left bytes of body of known length or of the current chunk.
+  uint64_t body_left_;
+  int status_code_;
+  uint64_t appended_size_;
+  // Bytes of chunked request body which were parsed.
+  size_t chunked_size_;
 };
 
 }
@@ -1,15 +1,19 @@
 #include "net_utils.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <netdb.h>
 #include <netinet/in.h>
+#include <string.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 #include <functional>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "file_descriptor.h"
 #include "logger.h"
@@ -38,7 +42,7 @@ int CreateEpollFD() {
 
 
 
-int CreateServerSocket(uint16_t port, uint32_t s_addr) {
+int CreateServerSocket(uint16_t port, uint32_t s_addr, bool reuse_port) {
   int socket_fd;
   for (size_t i = 0; i < kAttemptsToCreateServerSocket; ++i) {
     socket_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
@@ -52,6 +56,16 @@ int CreateServerSocket(uint16_t port, uint32_t s_addr) {
 
     base::FileDescriptor scoped_fd(socket_fd);
 
+    int enable = 1;
+    if (reuse_port && ::setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT,
+                                   &enable, sizeof(enable)) < 0) {
+      LOGE << "Error to set SO_REUSEPORT for server socket: " << socket_fd
+           << ". Attempt: " << i + 1 << " failed!";
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(kSleepBeforeNextAttemptMs));
+      continue;
+    }
+
     ::sockaddr_in addr;
     memset(&addr, 0, sizeof(::sockaddr_in));
     addr.sin_family = AF_INET;
@@ -92,88 +106,128 @@ int AcceptNonblocking(int server_fd) {
   return client_fd;
 }
 
-bool ChangeFileDescriptorFlags(int fd, int flags, std::function<int(int, int)> changer) {
-  int old_flags = ::fcntl(fd, F_GETFD);
+bool MakeNonblocking(int fd) {
+  int old_flags = ::fcntl(fd, F_GETFL);
   if (old_flags == -1) {
-    FLOGE << "Error to retreive flags for fd: " << fd;
+    FLOGE << "Error to retreive status flags for fd: " << fd;
     return false;
   }
-  if (::fcntl(fd, F_SETFD, changer(old_flags, flags)) == -1) {
-    FLOGE << "Error to set flags for fd: " << fd;
+  if (::fcntl(fd, F_SETFL, old_flags | O_NONBLOCK) == -1) {
+    FLOGE << "Error to make fd: " << fd << " nonblocking";
     return false;
   }
   return true;
 }
 
-bool AddFileDescriptorFlags(int fd, int flags) {
-  if (!ChangeFileDescriptorFlags(fd, flags, [](int a, int b) {
-    return a | b; })) {
-    FLOGE << "Error to add flag to fd: " << fd;
+bool SetBusyPoll(int fd, uint32_t microseconds) {
+  int value = microseconds;
+  if (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0) {
+    FLOGE << "Error to set SO_BUSY_POLL for fd: " << fd;
     return false;
   }
   return true;
 }
 
-bool RemoveFileDescriptorFlags(int fd, int flags) {
-  if (!ChangeFileDescriptorFlags(fd, flags, [](int a, int b) {
-    return a & (~b); })) {
-    FLOGE << "Error to remove flag to fd: " << fd;
-    return false;
+int CreateUdpSocket() {
+  int socket_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                           0);
+  if (socket_fd < 0) {
+    LOGE << "Error to create UDP socket";
   }
-  return true;
+  return socket_fd;
+}
+
+bool MakeAddress(const std::string& ip, uint16_t port,
+                 sockaddr_storage* address) {
+  *address = sockaddr_storage();
+  sockaddr_in* address_v4 = reinterpret_cast<sockaddr_in*>(address);
+  if (::inet_pton(AF_INET, ip.c_str(), &address_v4->sin_addr) == 1) {
+    address_v4->sin_family = AF_INET;
+    address_v4->sin_port = htons(port);
+    return true;
+  }
+  sockaddr_in6* address_v6 = reinterpret_cast<sockaddr_in6*>(address);
+  if (::inet_pton(AF_INET6, ip.c_str(), &address_v6->sin6_addr) == 1) {
+    address_v6->sin6_family = AF_INET6;
+    address_v6->sin6_port = htons(port);
+    return true;
+  }
+  return false;
 }
 
-int CreateExternalServerSocket(const char* host_name, const char* port) {
-  FLOGI << "Resolve name: " << host_name
-        << "; port: " << port;
-  ::addrinfo hints;
-  memset(&hints, 0, sizeof(::addrinfo));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-  ::addrinfo* result = nullptr;
-  if (::getaddrinfo(host_name, port, &hints, &result) != 0) {
-    FLOGE << "Couldn't resolve host name: " << host_name << ":" << port;
+socklen_t GetAddressSize(const sockaddr_storage& address) {
+  return (address.ss_family == AF_INET6) ? sizeof(sockaddr_in6)
+                                         : sizeof(sockaddr_in);
+}
+
+int StartConnect(const sockaddr_storage& address) {
+  int socket_fd = ::socket(address.ss_family,
+                           SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (socket_fd < 0) {
+    FLOGE << "Error to create socket for " << AddressToString(address);
+    return -1;
+  }
+  base::FileDescriptor scoped_socket(socket_fd);
+  if (::connect(socket_fd, reinterpret_cast<const sockaddr*>(&address),
+                GetAddressSize(address)) < 0 && errno != EINPROGRESS) {
+    FLOGE << "Error to connect to " << AddressToString(address)
+          << "; fd: " << socket_fd;
     return -1;
   }
-  FLOGI << "Resolve complete successfully";
+  FLOGI << "Connecting to " << AddressToString(address)
+        << "; fd: " << socket_fd;
+  return scoped_socket.Release();
+}
 
-  for (::addrinfo* p = result; p != NULL; p = p->ai_next) {
-    int socket_fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (socket_fd <= 0) {
-      FLOGE << "Error to create socket from resolved name. Next entry";
-      continue;
-    }
-    FLOGI << "Create socket; fd: " << socket_fd;
-    base::FileDescriptor scoped_socket(socket_fd);
-    if (!RemoveFileDescriptorFlags(socket_fd, SOCK_NONBLOCK)) {
-      FLOGE << "Error to remove nonblock from socket: "
-            << socket_fd << ". Next entry";
-      continue;
-    }
-    FLOGI << "Make socket blocking successfully";
-    if (::connect(socket_fd, p->ai_addr, p->ai_addrlen) < 0) {
-      FLOGE << "Error to connect to server; fd: "
-            << socket_fd << ". Next entry";
-      continue;
-    }
-    if (!AddFileDescriptorFlags(socket_fd, SOCK_NONBLOCK)) {
-      FLOGE << "Error to make socket: " << socket_fd
-            << " nonblock. Next entry";
-      continue;
-    }
-    FLOGI << "Socket connection is successful. fd: " << socket_fd
-          << " was connected to " << host_name
-          << " port: " << ((port) ? (port) : (""))
-          << ". By IP: " << inet_ntoa(((::sockaddr_in*) p->ai_addr)->sin_addr);
-    scoped_socket.Release();
-    ::freeaddrinfo(result);
-    return socket_fd;
+int GetSocketError(int fd) {
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) {
+    return errno;
   }
-  ::freeaddrinfo(result);
+  return error;
+}
 
-  FLOGE << "Error to connect to any address: " << host_name
-        << "; port: " << ((port) ? (port) : (""));
-  return -1;
+bool ShutdownOutput(int fd) {
+  return ::shutdown(fd, SHUT_WR) == 0;
+}
+
+ssize_t SendFile(int socket_fd, int file_fd, uint64_t* offset, size_t size) {
+  off_t file_offset = *offset;
+  ssize_t was_sent = ::sendfile(socket_fd, file_fd, &file_offset, size);
+  if (was_sent > 0) {
+    *offset += was_sent;
+  }
+  return was_sent;
+}
+
+std::string AddressToString(const sockaddr_in& address) {
+  char ip[INET_ADDRSTRLEN];
+  if (::inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip)) == nullptr) {
+    return "";
+  }
+  return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+std::string AddressToString(const sockaddr_storage& address) {
+  if (address.ss_family != AF_INET6) {
+    return AddressToString(reinterpret_cast<const sockaddr_in&>(address));
+  }
+  const sockaddr_in6& address_v6 =
+      reinterpret_cast<const sockaddr_in6&>(address);
+  char ip[INET6_ADDRSTRLEN];
+  if (::inet_ntop(AF_INET6, &address_v6.sin6_addr, ip, sizeof(ip)) ==
+      nullptr) {
+    return "";
+  }
+  return "[" + std::string(ip) + "]:" +
+         std::to_string(ntohs(address_v6.sin6_port));
+}
+
+bool IsIdleConnectionAlive(int fd) {
+  char byte;
+  ssize_t ret = ::recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
 }
 
 }  // namespace net_utils
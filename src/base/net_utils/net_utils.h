@@ -1,14 +1,45 @@
 #ifndef BASE_NET_UTILS_NET_UTILS_H_
 #define BASE_NET_UTILS_NET_UTILS_H_
 
+#include <netinet/in.h>
 #include <stdint.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
 
 namespace net_utils {
 
 int CreateEpollFD();
-int CreateServerSocket(uint16_t port, uint32_t s_addr);
+int CreateServerSocket(uint16_t port, uint32_t s_addr,
+                       bool reuse_port = false);
 int AcceptNonblocking(int server_fd);
-int CreateExternalServerSocket(const char* host_name, const char* port);
+bool MakeNonblocking(int fd);
+// Sets SO_BUSY_POLL: blocking receives busy poll the device queue for up to
+// the given time. Raising it above net.core.busy_read needs CAP_NET_ADMIN.
+bool SetBusyPoll(int fd, uint32_t microseconds);
+// Nonblocking socket for datagrams; -1 on failure.
+int CreateUdpSocket();
+// Parses IPv4 or IPv6 address; returns false if ip isn't numeric.
+bool MakeAddress(const std::string& ip, uint16_t port,
+                 sockaddr_storage* address);
+socklen_t GetAddressSize(const sockaddr_storage& address);
+// Starts nonblocking connect. Descriptor becomes writable when connect
+// completes and GetSocketError tells its result. Returns -1 on failure.
+int StartConnect(const sockaddr_storage& address);
+// Pending error of the socket (SO_ERROR); 0 if there is none.
+int GetSocketError(int fd);
+// Half-closes the connection: peer reads end of file, but can still send.
+bool ShutdownOutput(int fd);
+// Sends up to size bytes of the file from offset, which is advanced, without
+// copying them to user space.
+ssize_t SendFile(int socket_fd, int file_fd, uint64_t* offset, size_t size);
+// "ip:port" or "[ip]:port"; empty on error.
+std::string AddressToString(const sockaddr_in& address);
+std::string AddressToString(const sockaddr_storage& address);
+// Connection which isn't used has to have nothing to read: unexpected data
+// or end of file means it can't carry the next request.
+bool IsIdleConnectionAlive(int fd);
 
 }  // namespace net_utils
 
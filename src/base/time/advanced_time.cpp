@@ -6,6 +6,7 @@
 #include <limits>
 #include <stdint.h>
 #include <string>
+#include <time.h>
 
 #include "logger.h"
 
@@ -26,13 +27,31 @@ AdvancedTime InfinityIfOverflowAfterMultiplication(uint64_t val,
   return AdvancedTime::FromMilliseconds(val * mult);
 }
 
+AdvancedTime GetClockTime(clockid_t clock_id) {
+  ::timespec ts;
+  if (::clock_gettime(clock_id, &ts) < 0) {
+    LOGE << "Error to get time of clock: " << clock_id;
+    return AdvancedTime::FromMilliseconds(0);
+  }
+  return AdvancedTime::FromMilliseconds(
+      static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000);
+}
+
 }  // namespace
 
 // static
 AdvancedTime AdvancedTime::Now() {
-  auto time_point = std::chrono::high_resolution_clock::now();
-  auto dur = time_point.time_since_epoch();
-  return FromMilliseconds (std::chrono::duration_cast<std::chrono::milliseconds>(dur).count());
+  return GetClockTime(CLOCK_MONOTONIC);
+}
+
+// static
+AdvancedTime AdvancedTime::CoarseNow() {
+  return GetClockTime(CLOCK_MONOTONIC_COARSE);
+}
+
+// static
+AdvancedTime AdvancedTime::WallNow() {
+  return GetClockTime(CLOCK_REALTIME_COARSE);
 }
 
 // static
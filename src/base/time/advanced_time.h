@@ -14,7 +14,12 @@ class AdvancedTime {
 
   AdvancedTime& operator=(const AdvancedTime& other) = default;
 
+  // Steady time (CLOCK_MONOTONIC), which isn't affected by wall clock jumps.
   static AdvancedTime Now();
+  // Same clock with a tick resolution, but cheaper to read.
+  static AdvancedTime CoarseNow();
+  // Wall clock time; the only kind of time GetDate makes sense for.
+  static AdvancedTime WallNow();
   static AdvancedTime FromSeconds(uint64_t seconds);
   static AdvancedTime FromMilliseconds(uint64_t milliseconds);
   static AdvancedTime Infinity();
@@ -1,138 +1,422 @@
 #ifndef BASE_TIME_TIMER_CONTAINER_H_
 #define BASE_TIME_TIMER_CONTAINER_H_
 
-#include <list>
-#include <map>
+#include <stdint.h>
+
 #include <memory>
-#include <set>
+#include <vector>
 
 #include "advanced_time.h"
 #include "logger.h"
+#include "macros.h"
 #include "terminal_error.h"
 
 namespace base {
 
+// Hierarchical timing wheel with millisecond granularity.
+// Level i has kSlots slots, each of them covers kSlots^i milliseconds. Wheel
+// follows the owner's clock through Advance; timer is placed to the lowest
+// level where its expiration time shares all higher digits with the current
+// position, so slots of every level are ahead of the position. When the
+// position moves, slots which it has passed are taken off and the higher
+// level slot which it has entered is cascaded down.
+// Timers which expire by the current position are kept in its slot, overdue
+// ones first. Timers beyond the wheel's horizon (including infinite ones) are
+// kept in a min-heap and moved to the wheel once the horizon reaches them.
+// Nodes are intrusive and reused, so Insert, Erase and Update of timers in
+// the wheel are O(1) and don't allocate memory in a steady state.
 template <typename T>
 class TimerContainer {
  private:
-  typedef std::list<std::pair<AdvancedTime, T>> List;
-  typedef std::shared_ptr<List> ListPtr;
-  typedef std::pair<ListPtr, AdvancedTime> ListPtrTimeout;
-  typedef std::set<ListPtrTimeout, bool(*)(const ListPtrTimeout&,
-                                           const ListPtrTimeout&)> SetForLists;
-  typedef std::map<AdvancedTime, typename SetForLists::iterator>
-                                                            SetItByTimeout;
+  static const uint32_t kSlotBits = 6;
+  static const uint32_t kSlots = 1 << kSlotBits;
+  static const uint32_t kLevels = 4;
+  static const uint32_t kHorizonBits = kSlotBits * kLevels;
+  static const uint8_t kOverflowLevel = kLevels;
+  static const size_t kNodesInBlock = 256;
+
+  struct Node {
+    Node* prev;
+    Node* next;
+    AdvancedTime expiration_time;
+    AdvancedTime timeout;
+    T value;
+    uint8_t level;
+    uint8_t slot;
+    // Position in the overflow heap.
+    size_t heap_index;
+  };
+
+  struct List {
+    List() : head(nullptr), tail(nullptr) {}
+
+    bool IsEmpty() const {
+      return head == nullptr;
+    }
+
+    void PushBack(Node* node) {
+      InsertAfter(tail, node);
+    }
+
+    void PushFront(Node* node) {
+      InsertAfter(nullptr, node);
+    }
+
+    // Moves all nodes of the other list to the end of this one.
+    void Append(List* other) {
+      if (other->IsEmpty()) {
+        return;
+      }
+      if (IsEmpty()) {
+        head = other->head;
+      } else {
+        tail->next = other->head;
+        other->head->prev = tail;
+      }
+      tail = other->tail;
+      *other = List();
+    }
+
+    void InsertAfter(Node* position, Node* node) {
+      node->prev = position;
+      node->next = (position == nullptr) ? (head) : (position->next);
+      if (node->next == nullptr) {
+        tail = node;
+      } else {
+        node->next->prev = node;
+      }
+      if (position == nullptr) {
+        head = node;
+      } else {
+        position->next = node;
+      }
+    }
+
+    void Remove(Node* node) {
+      if (node->prev == nullptr) {
+        head = node->next;
+      } else {
+        node->prev->next = node->next;
+      }
+      if (node->next == nullptr) {
+        tail = node->prev;
+      } else {
+        node->next->prev = node->prev;
+      }
+      node->prev = nullptr;
+      node->next = nullptr;
+    }
+
+    Node* head;
+    Node* tail;
+  };
+
  public:
   class Iterator {
    public:
-    Iterator() = default;
-    Iterator(const AdvancedTime& timeout,
-             const typename List::iterator& list_it) :
-                timeout_(timeout),
-                list_it_(list_it) {}
+    Iterator() : node_(nullptr) {}
     Iterator(const Iterator& other) = default;
 
     ~Iterator() = default;
 
     AdvancedTime GetTimeout() const {
-      return timeout_;
+      return node_->timeout;
     }
 
     T GetValue() const {
-      return list_it_->second;
+      return node_->value;
     }
 
     AdvancedTime GetExpirationTime() const {
-      return list_it_->first;
+      return node_->expiration_time;
     }
 
    private:
-    typename List::iterator GetListIterator() const {
-      return list_it_;
-    }
+    explicit Iterator(Node* node) : node_(node) {}
 
     friend class TimerContainer;
 
-    AdvancedTime timeout_;
-    typename List::iterator list_it_;
+    Node* node_;
   };
 
-  TimerContainer() : sorted_lists_(&ListsComparator) {}
+  TimerContainer() : current_(0), size_(0), free_nodes_(nullptr) {
+    for (uint32_t level = 0; level < kLevels; ++level) {
+      occupied_[level] = 0;
+    }
+  }
   ~TimerContainer() {}
 
   Iterator Insert(const T& value, const AdvancedTime& timeout,
                                   const AdvancedTime& expiration_time) {
-    ListPtrTimeout cur;
-    typename List::iterator list_it;
-    auto it = iterators_by_timeouts_.find(timeout);
-    if (it == iterators_by_timeouts_.end()) {
-      ListPtr list_ptr = std::make_shared<List>();
-      list_it = list_ptr->insert(list_ptr->end(), {expiration_time, value});
-      cur = {list_ptr, timeout};
-    } else {
-      cur = *(it->second);
-      sorted_lists_.erase(it->second);
-      iterators_by_timeouts_.erase(it);
-      list_it = cur.first->insert(cur.first->end(), {expiration_time, value});
-    }
-
-    iterators_by_timeouts_[timeout] = sorted_lists_.insert(cur).first;
-    return Iterator(timeout, list_it);
+    Node* node = AllocateNode();
+    node->expiration_time = expiration_time;
+    node->timeout = timeout;
+    node->value = value;
+    Place(node);
+    ++size_;
+    return Iterator(node);
   }
 
   void Erase(const Iterator& it) {
-    AdvancedTime timeout = it.GetTimeout();
-    auto list_it = it.GetListIterator();
-    auto sorted_lists_it = iterators_by_timeouts_[timeout];
-    ListPtrTimeout cur = *(sorted_lists_it);
-    iterators_by_timeouts_.erase(timeout);
-    sorted_lists_.erase(sorted_lists_it);
-    cur.first->erase(list_it);
-    if (cur.first->empty()) {
+    Unlink(it.node_);
+    --size_;
+    FreeNode(it.node_);
+  }
+
+  // Node is reused, so the given iterator stays valid.
+  Iterator Update(const Iterator& it, AdvancedTime new_start_time) {
+    Node* node = it.node_;
+    Unlink(node);
+    node->expiration_time = new_start_time + node->timeout;
+    Place(node);
+    return it;
+  }
+
+  // Moves the wheel to the given time; earlier time is ignored. Timers which
+  // expire by then become due.
+  void Advance(const AdvancedTime& now) {
+    if (!now.IsFinite() || now.GetMilliseconds() <= current_) {
       return;
     }
-    iterators_by_timeouts_[timeout] = sorted_lists_.insert(cur).first;
+    uint64_t now_ms = now.GetMilliseconds();
+    List passed;
+    List entered;
+    for (uint32_t level = 0; level < kLevels; ++level) {
+      if (occupied_[level] == 0) {
+        continue;
+      }
+      uint32_t upper_shift = kSlotBits * (level + 1);
+      if ((now_ms >> upper_shift) != (current_ >> upper_shift)) {
+        // Whole level belongs to the range which was passed.
+        TakeSlots(level, occupied_[level], &passed);
+        continue;
+      }
+      uint32_t from = GetSlot(current_, level);
+      uint32_t to = GetSlot(now_ms, level);
+      TakeSlots(level, GetMask(to) & ~GetMask(from), &passed);
+      if (level > 0 && from != to) {
+        TakeSlots(level, occupied_[level] & (1ULL << to), &entered);
+      }
+    }
+    current_ = now_ms;
+    PlaceAll(&passed);
+    PlaceAll(&entered);
+    while (!overflow_.empty() &&
+           overflow_.front()->expiration_time.IsFinite() &&
+           (overflow_.front()->expiration_time.GetMilliseconds() >>
+               kHorizonBits) <= (current_ >> kHorizonBits)) {
+      Node* node = overflow_.front();
+      RemoveFromOverflow(node);
+      Place(node);
+    }
   }
 
-  Iterator Update(const Iterator& it, AdvancedTime new_start_time =
-                                                        AdvancedTime::Now()) {
-    T value = it.GetValue();
-    AdvancedTime timeout = it.GetTimeout();
-    Erase(it);
-    return Insert(value, timeout, new_start_time + timeout);
+  // Returns false if no timer expires by the current position of the wheel.
+  bool HasDue() const {
+    return (occupied_[0] & (1ULL << GetSlot(current_, 0))) != 0;
   }
 
-  Iterator GetNext() const {
+  // Overdue timers go before ones which expire exactly at the current
+  // position.
+  Iterator GetDue() const {
+    if (!HasDue()) {
+      LOGE << "Timer Container has no due timers";
+      throw TerminalError();
+    }
+    return Iterator(slots_[0][GetSlot(current_, 0)].head);
+  }
+
+  // Timers of a higher level slot are reported by the slot's start: the
+  // wheel has to be advanced to it to tell their order.
+  AdvancedTime GetNextExpirationTime() const {
     if (IsEmpty()) {
       LOGE << "Timer Container is empty. Cannot retrieve next element";
       throw TerminalError();
     }
-    auto it = sorted_lists_.begin();
-    return Iterator(it->second, it->first->begin());
+    uint64_t mask = occupied_[0] & ~GetMask(GetSlot(current_, 0));
+    if (mask != 0) {
+      return slots_[0][__builtin_ctzll(mask)].head->expiration_time;
+    }
+    for (uint32_t level = 1; level < kLevels; ++level) {
+      mask = occupied_[level] & ~GetMask(GetSlot(current_, level) + 1);
+      if (mask == 0) {
+        continue;
+      }
+      uint32_t upper_shift = kSlotBits * (level + 1);
+      return AdvancedTime::FromMilliseconds(
+          ((current_ >> upper_shift) << upper_shift) |
+          (static_cast<uint64_t>(__builtin_ctzll(mask)) <<
+              (kSlotBits * level)));
+    }
+    return overflow_.front()->expiration_time;
   }
 
   bool IsEmpty() const {
-    return iterators_by_timeouts_.empty();
+    return size_ == 0;
   }
 
  private:
-  static bool ListsComparator(const ListPtrTimeout& lp1,
-                              const ListPtrTimeout& lp2) {
-    if (lp1.first->empty() || lp2.first->empty()) {
-      LOGE << "There is empty list it Timer Container";
-      throw TerminalError();
+  void Place(Node* node) {
+    if (!node->expiration_time.IsFinite()) {
+      PushToOverflow(node);
+      return;
     }
-    if (lp1.first->front().first < lp2.first->front().first) {
-      return true;
+
+    uint64_t expiration_ms = node->expiration_time.GetMilliseconds();
+    if (expiration_ms < current_) {
+      uint32_t slot = GetSlot(current_, 0);
+      slots_[0][slot].PushFront(node);
+      occupied_[0] |= (1ULL << slot);
+      node->level = 0;
+      node->slot = slot;
+      return;
     }
-    if (lp1.first->front().first > lp2.first->front().first) {
-      return false;
+
+    for (uint32_t level = 0; level < kLevels; ++level) {
+      uint32_t upper_shift = kSlotBits * (level + 1);
+      if ((expiration_ms >> upper_shift) != (current_ >> upper_shift)) {
+        continue;
+      }
+      uint32_t slot = GetSlot(expiration_ms, level);
+      slots_[level][slot].PushBack(node);
+      occupied_[level] |= (1ULL << slot);
+      node->level = level;
+      node->slot = slot;
+      return;
+    }
+    PushToOverflow(node);
+  }
+
+  void PlaceAll(List* list) {
+    while (!list->IsEmpty()) {
+      Node* node = list->head;
+      list->Remove(node);
+      Place(node);
+    }
+  }
+
+  // Moves nodes of the level's slots from the mask to the list.
+  void TakeSlots(uint32_t level, uint64_t mask, List* list) {
+    mask &= occupied_[level];
+    occupied_[level] &= ~mask;
+    while (mask != 0) {
+      uint32_t slot = __builtin_ctzll(mask);
+      mask &= mask - 1;
+      list->Append(&slots_[level][slot]);
+    }
+  }
+
+  void Unlink(Node* node) {
+    if (node->level == kOverflowLevel) {
+      RemoveFromOverflow(node);
+      return;
+    }
+    List& list = slots_[node->level][node->slot];
+    list.Remove(node);
+    if (list.IsEmpty()) {
+      occupied_[node->level] &= ~(1ULL << node->slot);
+    }
+  }
+
+  void PushToOverflow(Node* node) {
+    node->level = kOverflowLevel;
+    overflow_.push_back(node);
+    SiftUp(overflow_.size() - 1);
+  }
+
+  void RemoveFromOverflow(Node* node) {
+    size_t index = node->heap_index;
+    Node* last = overflow_.back();
+    overflow_.pop_back();
+    if (last == node) {
+      return;
     }
-    return lp1.first < lp2.first;
+    overflow_[index] = last;
+    SiftUp(index);
+    SiftDown(last->heap_index);
   }
 
-  SetForLists sorted_lists_;
-  SetItByTimeout iterators_by_timeouts_;
+  void SiftUp(size_t index) {
+    Node* node = overflow_[index];
+    while (index > 0) {
+      size_t parent = (index - 1) / 2;
+      if (!(node->expiration_time < overflow_[parent]->expiration_time)) {
+        break;
+      }
+      SetHeapNode(index, overflow_[parent]);
+      index = parent;
+    }
+    SetHeapNode(index, node);
+  }
+
+  void SiftDown(size_t index) {
+    Node* node = overflow_[index];
+    while (true) {
+      size_t child = 2 * index + 1;
+      if (child >= overflow_.size()) {
+        break;
+      }
+      if (child + 1 < overflow_.size() &&
+          overflow_[child + 1]->expiration_time <
+              overflow_[child]->expiration_time) {
+        ++child;
+      }
+      if (!(overflow_[child]->expiration_time < node->expiration_time)) {
+        break;
+      }
+      SetHeapNode(index, overflow_[child]);
+      index = child;
+    }
+    SetHeapNode(index, node);
+  }
+
+  void SetHeapNode(size_t index, Node* node) {
+    overflow_[index] = node;
+    node->heap_index = index;
+  }
+
+  Node* AllocateNode() {
+    if (free_nodes_ == nullptr) {
+      blocks_.emplace_back(new Node[kNodesInBlock]);
+      Node* block = blocks_.back().get();
+      for (size_t i = 0; i < kNodesInBlock; ++i) {
+        block[i].next = free_nodes_;
+        free_nodes_ = &block[i];
+      }
+    }
+    Node* node = free_nodes_;
+    free_nodes_ = node->next;
+    node->prev = nullptr;
+    node->next = nullptr;
+    return node;
+  }
+
+  void FreeNode(Node* node) {
+    node->value = T();
+    node->next = free_nodes_;
+    free_nodes_ = node;
+  }
+
+  static uint32_t GetSlot(uint64_t time_ms, uint32_t level) {
+    return (time_ms >> (kSlotBits * level)) & (kSlots - 1);
+  }
+
+  // Mask of slots which are below the given one.
+  static uint64_t GetMask(uint32_t slot) {
+    return (slot >= kSlots) ? (~0ULL) : ((1ULL << slot) - 1);
+  }
+
+  List slots_[kLevels][kSlots];
+  uint64_t occupied_[kLevels];
+  std::vector<Node*> overflow_;
+
+  uint64_t current_;  // in milliseconds;
+  size_t size_;
+
+  std::vector<std::unique_ptr<Node[]>> blocks_;
+  Node* free_nodes_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(TimerContainer);
 };
 
 }  // namespace base
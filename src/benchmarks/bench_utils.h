@@ -0,0 +1,82 @@
+#ifndef BENCHMARKS_BENCH_UTILS_H_
+#define BENCHMARKS_BENCH_UTILS_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "logger.h"
+
+namespace benchmarks {
+
+inline uint64_t GetNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void Fail(const char* what) {
+  LOGE << "Benchmark failed: " << what;
+  exit(1);
+}
+
+// Opens a blocking listening socket on an ephemeral loopback port.
+inline int ListenLoopback(uint16_t* port) {
+  int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_size = sizeof(address);
+  if (listener < 0 ||
+      ::bind(listener, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) < 0 ||
+      ::listen(listener, SOMAXCONN) < 0 ||
+      ::getsockname(listener, reinterpret_cast<sockaddr*>(&address),
+                    &address_size) < 0) {
+    Fail("can't listen");
+  }
+  *port = ntohs(address.sin_port);
+  return listener;
+}
+
+// Opens a blocking connection to the loopback port with Nagle's algorithm
+// disabled.
+inline int ConnectLoopback(uint16_t port) {
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) < 0) {
+    Fail("can't connect");
+  }
+  int enable = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return fd;
+}
+
+// Opens both ends of a loopback TCP connection with Nagle's algorithm
+// disabled; descriptors are blocking.
+inline void ConnectLoopback(int* client_fd, int* server_fd) {
+  uint16_t port = 0;
+  int listener = ListenLoopback(&port);
+  *client_fd = ConnectLoopback(port);
+  *server_fd = ::accept(listener, nullptr, nullptr);
+  if (*server_fd < 0) {
+    Fail("can't accept");
+  }
+  ::close(listener);
+  int enable = 1;
+  ::setsockopt(*server_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+}  // namespace benchmarks
+
+#endif  // BENCHMARKS_BENCH_UTILS_H_
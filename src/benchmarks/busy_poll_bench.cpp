@@ -0,0 +1,247 @@
+// Measures round trip latency of request/response ping-pong with and without
+// the busy-poll phase of the loop, and CPU time which the loop burns after
+// traffic stops. The loop echoes on its own thread; the client pauses between
+// requests, as a real client does, so a blocking loop falls asleep between
+// them. The loop and the client are pinned to different CPUs; with one CPU
+// they share it and the latencies say little about busy polling.
+//
+// Usage: ./bench_busy_poll [round_trips] [pause_us]
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "advanced_time.h"
+#include "bench_utils.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "logger.h"
+#include "net_utils.h"
+
+using base::AdvancedTime;
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using epoll::EpollRecord;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const size_t kDefaultRoundTrips = 20000;
+const uint64_t kDefaultPauseUs = 20;
+const uint32_t kBusyPollUs[] = {0, 50, 200};
+const size_t kMessageSize = 64;
+const uint64_t kIdleMs = 1000;
+const uint64_t kTimeoutMs = 3600000;
+
+class EchoRecord : public EpollRecord {
+ public:
+  EchoRecord(int fd, std::shared_ptr<Epoll> epoll_ptr,
+             std::atomic<bool>* is_closed) :
+      EpollRecord(fd, epoll_ptr, EpollRecord::IN,
+                  AdvancedTime::FromMilliseconds(kTimeoutMs)),
+      is_closed_(is_closed) {}
+
+  void OnIn() override {
+    base::ReceiveBuffer message;
+    bool is_open = ReadInput(&message);
+    if (!message.IsEmpty() &&
+        (!Append(message.GetData(), message.GetSize()) || !WriteOutput())) {
+      Fail("can't echo");
+    }
+    if (!is_open) {
+      RemoveFlag(EpollRecord::IN);
+      *is_closed_ = true;
+    }
+  }
+
+  void OnOut() override {}
+
+  void OnTimeExpired() override {
+    Fail("record was expired");
+  }
+
+  void OnError() override {
+    Fail("record was broken");
+  }
+
+ private:
+  std::atomic<bool>* is_closed_;
+};
+
+// Returns false if the process may run on one CPU only.
+bool GetTwoCpus(int* loop_cpu, int* client_cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (::sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+    Fail("can't get CPUs");
+  }
+  std::vector<int> allowed;
+  for (int cpu = 0; cpu < CPU_SETSIZE && allowed.size() < 2; ++cpu) {
+    if (CPU_ISSET(cpu, &cpus)) {
+      allowed.push_back(cpu);
+    }
+  }
+  if (allowed.size() < 2) {
+    return false;
+  }
+  *loop_cpu = allowed[0];
+  *client_cpu = allowed[1];
+  return true;
+}
+
+// Pins the calling thread; negative CPU leaves it as is.
+void PinToCpu(int cpu) {
+  if (cpu < 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (::sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    Fail("can't pin thread to CPU");
+  }
+}
+
+void RunLoop(int fd, const Epoll::Options& options, int cpu,
+             std::atomic<bool>* is_closed) {
+  InitFileLogger("/dev/null");
+  PinToCpu(cpu);
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>(options);
+  EchoRecord record(fd, epoll_ptr, is_closed);
+  while (!*is_closed) {
+    epoll_ptr->Process();
+  }
+}
+
+uint64_t GetThreadCpuNanoseconds(std::thread* thread) {
+  clockid_t clock;
+  timespec time;
+  if (::pthread_getcpuclockid(thread->native_handle(), &clock) != 0 ||
+      ::clock_gettime(clock, &time) < 0) {
+    Fail("can't read CPU time of the loop");
+  }
+  return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void SpinFor(uint64_t nanoseconds) {
+  uint64_t end = GetNanoseconds() + nanoseconds;
+  while (GetNanoseconds() < end) {
+  }
+}
+
+std::string Run(uint32_t busy_poll_us, bool socket_busy_poll, int loop_cpu,
+                size_t round_trips, uint64_t pause_us) {
+  int client_fd = -1;
+  int server_fd = -1;
+  benchmarks::ConnectLoopback(&client_fd, &server_fd);
+  net_utils::MakeNonblocking(server_fd);
+  Epoll::Options options;
+  options.busy_poll_us = busy_poll_us;
+  bool has_socket_busy_poll = socket_busy_poll &&
+      net_utils::SetBusyPoll(server_fd, busy_poll_us);
+  std::atomic<bool> is_closed(false);
+  std::thread loop(RunLoop, server_fd, options, loop_cpu, &is_closed);
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(round_trips);
+  char message[kMessageSize] = {};
+  for (size_t i = 0; i < round_trips; ++i) {
+    SpinFor(pause_us * 1000);
+    uint64_t start = GetNanoseconds();
+    if (::write(client_fd, message, sizeof(message)) !=
+        static_cast<ssize_t>(sizeof(message))) {
+      Fail("can't write");
+    }
+    size_t received = 0;
+    while (received < sizeof(message)) {
+      ssize_t size = ::read(client_fd, message + received,
+                            sizeof(message) - received);
+      if (size <= 0) {
+        Fail("can't read");
+      }
+      received += size;
+    }
+    latencies.push_back(GetNanoseconds() - start);
+  }
+
+  // Loop has to stop spinning once traffic is gone.
+  uint64_t cpu_start = GetThreadCpuNanoseconds(&loop);
+  ::usleep(kIdleMs * 1000);
+  double idle_cpu = (GetThreadCpuNanoseconds(&loop) - cpu_start) * 100.0 /
+                    (kIdleMs * 1000000);
+  ::shutdown(client_fd, SHUT_WR);
+  loop.join();
+  ::close(client_fd);
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double part) {
+    return latencies[static_cast<size_t>(part * (latencies.size() - 1))] /
+           1000.0;
+  };
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1)
+       << std::setw(10) << busy_poll_us
+       << std::setw(8) << ((has_socket_busy_poll) ? "yes" : "no")
+       << std::setw(10) << percentile(0.5)
+       << std::setw(10) << percentile(0.99)
+       << std::setw(10) << percentile(0.999)
+       << std::setw(12) << idle_cpu;
+  return line.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t round_trips = kDefaultRoundTrips;
+  uint64_t pause_us = kDefaultPauseUs;
+  if (argc > 1) {
+    round_trips = strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    pause_us = strtoull(argv[2], nullptr, 10);
+  }
+  InitFileLogger("/dev/null");
+  int loop_cpu = -1;
+  int client_cpu = -1;
+  if (GetTwoCpus(&loop_cpu, &client_cpu)) {
+    PinToCpu(client_cpu);
+  } else {
+    LOGW << "Only one CPU is available; the spinning loop takes it from the "
+         << "client, so gains of busy polling can't be measured";
+  }
+
+  std::vector<std::string> lines;
+  for (uint32_t busy_poll_us : kBusyPollUs) {
+    lines.push_back(Run(busy_poll_us, false, loop_cpu, round_trips,
+                        pause_us));
+    // SO_BUSY_POLL needs CAP_NET_ADMIN; without it only the loop spins.
+    if (busy_poll_us != 0) {
+      lines.push_back(Run(busy_poll_us, true, loop_cpu, round_trips,
+                          pause_us));
+    }
+  }
+  cout << std::setw(10) << "busy, us" << std::setw(8) << "socket"
+       << std::setw(10) << "p50, us" << std::setw(10) << "p99, us"
+       << std::setw(10) << "p999, us" << std::setw(12) << "idle CPU, %"
+       << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+// Compares the output buffer of IOFileDescriptor, a chain of blocks written
+// with writev, against the std::string buffer it replaced, which moved the
+// unwritten tail to the front after every partial write. A slow peer is a
+// pipe read by fixed portions: before every Write the peer takes one portion,
+// so the write is partial, and then the buffer is refilled by appends up to
+// the backlog, as a handler refills it from upstream.
+//
+// Usage: ./bench_chain_buffer [megabytes]
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_utils.h"
+#include "file_descriptor.h"
+#include "logger.h"
+
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const uint64_t kDefaultMegabytes = 512;
+const size_t kMaxBufferSize = 128 * 1024;
+const int kPipeSize = 64 * 1024;
+
+struct Pattern {
+  const char* name;
+  size_t append_size;
+  // Portion taken by the peer before every write; pipe frees whole pages, so
+  // it's a multiple of the page size.
+  size_t drain_size;
+  size_t backlog;
+};
+
+const Pattern kPatterns[] = {
+  {"small appends", 100, 4096, kMaxBufferSize},
+  {"segments", 1460, 4096, kMaxBufferSize},
+  {"blocks", 16 * 1024, 16 * 1024, kMaxBufferSize},
+  {"short backlog", 1460, 4096, 8 * 1024},
+};
+
+// IOFileDescriptor before the chain buffer.
+class StringOutput {
+ public:
+  explicit StringOutput(int fd) : fd_(fd) {}
+
+  ~StringOutput() {
+    ::close(fd_);
+  }
+
+  bool Append(const char* data, size_t size) {
+    if (kMaxBufferSize - buffer_.size() < size) {
+      return false;
+    }
+    buffer_.append(data, size);
+    return true;
+  }
+
+  bool Write() {
+    ssize_t was_written = ::write(fd_, buffer_.c_str(), buffer_.size());
+    if (was_written <= 0) {
+      return false;
+    }
+    size_t size = buffer_.size();
+    for (size_t i = was_written; i < size; ++i) {
+      buffer_[i - was_written] = buffer_[i];
+    }
+    buffer_.resize(size - was_written);
+    return true;
+  }
+
+  size_t GetSize() const {
+    return buffer_.size();
+  }
+
+ private:
+  int fd_;
+  std::string buffer_;
+};
+
+class ChainOutput {
+ public:
+  explicit ChainOutput(int fd) : descriptor_(fd, kMaxBufferSize) {}
+
+  bool Append(const char* data, size_t size) {
+    return descriptor_.Append(data, size);
+  }
+
+  bool Write() {
+    return descriptor_.Write();
+  }
+
+  size_t GetSize() const {
+    return descriptor_.GetSize();
+  }
+
+ private:
+  base::IOFileDescriptor descriptor_;
+};
+
+void DrainPipe(int fd, std::vector<char>* scratch, size_t size) {
+  while (size > 0) {
+    ssize_t was_read = ::read(fd, scratch->data(), size);
+    if (was_read <= 0) {
+      Fail("can't read pipe");
+    }
+    size -= was_read;
+  }
+}
+
+template <typename Output>
+std::string Run(const char* output_name, const Pattern& pattern,
+                uint64_t megabytes) {
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK) < 0 ||
+      ::fcntl(fds[1], F_SETPIPE_SZ, kPipeSize) < 0) {
+    Fail("can't create pipe");
+  }
+  Output output(fds[1]);
+  std::string chunk(pattern.append_size, 'x');
+  std::vector<char> scratch(pattern.drain_size);
+  auto refill = [&output, &chunk, &pattern]() {
+    while (output.GetSize() + chunk.size() <= pattern.backlog) {
+      if (!output.Append(chunk.data(), chunk.size())) {
+        Fail("buffer is overflowed");
+      }
+    }
+  };
+  // Pipe is full before measuring, so every write is partial.
+  while (::write(fds[1], scratch.data(), scratch.size()) > 0) {
+  }
+  refill();
+
+  uint64_t total = megabytes * 1024 * 1024;
+  uint64_t written = 0;
+  uint64_t writes = 0;
+  uint64_t start = GetNanoseconds();
+  while (written < total) {
+    DrainPipe(fds[0], &scratch, pattern.drain_size);
+    size_t size = output.GetSize();
+    if (!output.Write()) {
+      Fail("can't write");
+    }
+    written += size - output.GetSize();
+    ++writes;
+    refill();
+  }
+  uint64_t elapsed = GetNanoseconds() - start;
+  ::close(fds[0]);
+
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1)
+       << std::setw(15) << pattern.name
+       << std::setw(8) << output_name
+       << std::setw(10) << written / (1024.0 * 1024.0) * 1e9 / elapsed
+       << std::setw(12) << elapsed * 1.0 / writes;
+  return line.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t megabytes = kDefaultMegabytes;
+  if (argc > 1) {
+    megabytes = strtoull(argv[1], nullptr, 10);
+  }
+  InitFileLogger("/dev/null");
+
+  std::vector<std::string> lines;
+  for (const Pattern& pattern : kPatterns) {
+    lines.push_back(Run<StringOutput>("string", pattern, megabytes));
+    lines.push_back(Run<ChainOutput>("chain", pattern, megabytes));
+  }
+  cout << std::setw(15) << "pattern" << std::setw(8) << "buffer"
+       << std::setw(10) << "MB/s" << std::setw(12) << "ns/write" << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,242 @@
+// Measures how fast the disk tier of the response cache serves hits: every
+// hit is a Lookup, the stored header written to a loopback socket and the
+// body sent from the segment file with sendfile, as ClientSocket does. A
+// thread drains the other end. Copying the body through user space with
+// pread and write is the baseline. Segments are freshly written, so they're
+// in the page cache.
+//
+// Usage: ./bench_disk_cache [directory] [seconds]
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_utils.h"
+#include "disk_cache.h"
+#include "logger.h"
+#include "net_utils.h"
+
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using net_utils::DiskCache;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char kDefaultDirectory[] = "/tmp/bench_disk_cache";
+const char kSegmentPrefix[] = "segment_";
+const uint64_t kDefaultSeconds = 2;
+const uint64_t kCapacity = 256 * 1024 * 1024;
+const uint64_t kExpirationSeconds = 3600;
+const uint64_t kStoreTimeoutMs = 60000;
+const size_t kChunkSize = 64 * 1024;
+
+struct ObjectSet {
+  const char* name;
+  size_t size;
+  size_t count;
+};
+
+const ObjectSet kObjectSets[] = {
+  {"1KB", 1024, 1024},
+  {"100KB", 100 * 1024, 256},
+  {"10MB", 10 * 1024 * 1024, 8},
+};
+
+std::string GetKey(const ObjectSet& set, size_t index) {
+  std::ostringstream key;
+  key << "http://bench/" << set.name << "/" << index;
+  return key.str();
+}
+
+std::string GetMeta(size_t size) {
+  std::ostringstream meta;
+  meta << "HTTP/1.1 200 OK\r\nContent-Length: " << size << "\r\n\r\n";
+  return meta.str();
+}
+
+void StoreObjects(const ObjectSet& set) {
+  DiskCache* cache_ptr = DiskCache::GetInstance();
+  if (set.size > cache_ptr->GetMaxObjectSize()) {
+    Fail("object doesn't fit into a segment");
+  }
+  auto body_ptr = std::make_shared<const std::string>(set.size, 'x');
+  time_t expiration = ::time(nullptr) + kExpirationSeconds;
+  for (size_t i = 0; i < set.count; ++i) {
+    cache_ptr->Store(GetKey(set, i), GetMeta(set.size), body_ptr, expiration);
+  }
+  // Objects become visible once the writer thread has written them.
+  DiskCache::Record record;
+  uint64_t deadline = GetNanoseconds() + kStoreTimeoutMs * 1000000;
+  while (!cache_ptr->Lookup(GetKey(set, set.count - 1), &record)) {
+    if (GetNanoseconds() > deadline) {
+      Fail("objects weren't stored");
+    }
+    ::usleep(1000);
+  }
+}
+
+void WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written <= 0) {
+      Fail("can't write");
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+void SendBody(int fd, const DiskCache::Record& record) {
+  uint64_t offset = record.offset;
+  uint64_t end = record.offset + record.size;
+  while (offset < end) {
+    if (net_utils::SendFile(fd, record.file->GetFD(), &offset,
+                            end - offset) <= 0) {
+      Fail("can't send file");
+    }
+  }
+}
+
+void CopyBody(int fd, const DiskCache::Record& record,
+              std::vector<char>* chunk) {
+  uint64_t offset = record.offset;
+  uint64_t end = record.offset + record.size;
+  while (offset < end) {
+    size_t to_read = std::min<uint64_t>(chunk->size(), end - offset);
+    ssize_t was_read = ::pread(record.file->GetFD(), chunk->data(), to_read,
+                               offset);
+    if (was_read <= 0) {
+      Fail("can't read file");
+    }
+    WriteAll(fd, chunk->data(), was_read);
+    offset += was_read;
+  }
+}
+
+uint64_t ReadAll(int fd) {
+  std::vector<char> chunk(kChunkSize);
+  uint64_t received = 0;
+  for (;;) {
+    ssize_t was_read = ::read(fd, chunk.data(), chunk.size());
+    if (was_read < 0) {
+      Fail("can't read");
+    }
+    if (was_read == 0) {
+      return received;
+    }
+    received += was_read;
+  }
+}
+
+std::string Run(const ObjectSet& set, bool use_sendfile, uint64_t seconds) {
+  int client_fd = -1;
+  int server_fd = -1;
+  benchmarks::ConnectLoopback(&client_fd, &server_fd);
+  uint64_t received = 0;
+  std::thread reader([client_fd, &received]() {
+    received = ReadAll(client_fd);
+  });
+
+  DiskCache* cache_ptr = DiskCache::GetInstance();
+  std::vector<char> chunk(kChunkSize);
+  uint64_t hits = 0;
+  uint64_t sent = 0;
+  uint64_t start = GetNanoseconds();
+  uint64_t end = start + seconds * 1000000000ULL;
+  uint64_t now = start;
+  while (now < end) {
+    DiskCache::Record record;
+    if (!cache_ptr->Lookup(GetKey(set, hits % set.count), &record)) {
+      Fail("object was evicted");
+    }
+    WriteAll(server_fd, record.meta.data(), record.meta.size());
+    if (use_sendfile) {
+      SendBody(server_fd, record);
+    } else {
+      CopyBody(server_fd, record, &chunk);
+    }
+    sent += record.meta.size() + record.size;
+    ++hits;
+    now = GetNanoseconds();
+  }
+  ::shutdown(server_fd, SHUT_WR);
+  reader.join();
+  now = GetNanoseconds();
+  ::close(server_fd);
+  ::close(client_fd);
+  if (received != sent) {
+    Fail("data was lost");
+  }
+
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1)
+       << std::setw(8) << set.name
+       << std::setw(10) << ((use_sendfile) ? "sendfile" : "copy")
+       << std::setw(12) << hits * 1e9 / (now - start)
+       << std::setw(10) << sent / (1024.0 * 1024.0) * 1e9 / (now - start);
+  return line.str();
+}
+
+// Removes segment files and the directory if nothing else is left in it.
+void RemoveSegments(const std::string& directory) {
+  DIR* dir = ::opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  while (dirent* entry = ::readdir(dir)) {
+    if (strncmp(entry->d_name, kSegmentPrefix, strlen(kSegmentPrefix)) == 0) {
+      ::unlink((directory + "/" + entry->d_name).c_str());
+    }
+  }
+  ::closedir(dir);
+  ::rmdir(directory.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string directory = kDefaultDirectory;
+  uint64_t seconds = kDefaultSeconds;
+  if (argc > 1) {
+    directory = argv[1];
+  }
+  if (argc > 2) {
+    seconds = strtoull(argv[2], nullptr, 10);
+  }
+  InitFileLogger("/dev/null");
+  // Objects of earlier runs would be loaded and counted.
+  RemoveSegments(directory);
+  DiskCache* cache_ptr = DiskCache::GetInstance();
+  cache_ptr->Open(directory, kCapacity);
+
+  std::vector<std::string> lines;
+  for (const ObjectSet& set : kObjectSets) {
+    StoreObjects(set);
+    lines.push_back(Run(set, false, seconds));
+    lines.push_back(Run(set, true, seconds));
+  }
+  cache_ptr->Close();
+  RemoveSegments(directory);
+
+  cout << std::setw(8) << "object" << std::setw(10) << "body"
+       << std::setw(12) << "hits/s" << std::setw(10) << "MB/s" << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+// Compares level-triggered and edge-triggered records receiving bulk data,
+// as a client socket receives a large response. Writer threads stream data
+// into loopback TCP connections and one loop reads them; the number of loop
+// wakeups and handler calls per megabyte shows the system calls which
+// draining saves. Level-triggered records which read at most 4 KB per wakeup,
+// as records did before reads became adaptive, are the baseline.
+//
+// Usage: ./bench_edge_triggered [megabytes]
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "advanced_time.h"
+#include "bench_utils.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "logger.h"
+
+using base::AdvancedTime;
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using epoll::EpollRecord;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const uint64_t kDefaultMegabytes = 256;
+const size_t kStreams[] = {1, 16};
+const size_t kWriteSize = 64 * 1024;
+const size_t kBaselineReadLimit = 4095;
+const uint64_t kTimeoutMs = 3600000;
+
+class SinkRecord : public EpollRecord {
+ public:
+  SinkRecord(int fd, std::shared_ptr<Epoll> epoll_ptr, size_t read_limit) :
+      EpollRecord(fd, epoll_ptr, EpollRecord::IN | epoll_ptr->GetModeFlags(),
+                  AdvancedTime::FromMilliseconds(kTimeoutMs)),
+      read_limit_(read_limit), received_(0), calls_(0), is_finished_(false) {}
+
+  void OnIn() override {
+    ++calls_;
+    base::ReceiveBuffer message;
+    bool is_open = ReadInput(&message, read_limit_);
+    received_ += message.GetSize();
+    if (!is_open) {
+      is_finished_ = true;
+      RemoveFlag(EpollRecord::IN);
+    }
+  }
+
+  void OnOut() override {}
+
+  void OnTimeExpired() override {
+    Fail("record was expired");
+  }
+
+  void OnError() override {
+    Fail("record was broken");
+  }
+
+  uint64_t GetReceived() const {
+    return received_;
+  }
+
+  uint64_t GetCalls() const {
+    return calls_;
+  }
+
+  bool IsFinished() const {
+    return is_finished_;
+  }
+
+ private:
+  size_t read_limit_;
+  uint64_t received_;
+  uint64_t calls_;
+  bool is_finished_;
+};
+
+void WriteStream(int fd, uint64_t size) {
+  std::string block(kWriteSize, 'x');
+  while (size > 0) {
+    size_t to_write = (size < kWriteSize) ? (size) : (kWriteSize);
+    ssize_t written = ::write(fd, block.data(), to_write);
+    if (written <= 0) {
+      Fail("can't write");
+    }
+    size -= written;
+  }
+  ::shutdown(fd, SHUT_WR);
+}
+
+std::string Run(const char* name, bool edge_triggered, size_t read_limit,
+                size_t streams, uint64_t megabytes) {
+  Epoll::Options options;
+  options.edge_triggered = edge_triggered;
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>(options);
+
+  uint64_t stream_size = megabytes * 1024 * 1024 / streams;
+  std::vector<std::unique_ptr<SinkRecord>> sinks;
+  std::vector<int> writer_fds;
+  for (size_t i = 0; i < streams; ++i) {
+    int client_fd = -1;
+    int server_fd = -1;
+    benchmarks::ConnectLoopback(&client_fd, &server_fd);
+    sinks.emplace_back(new SinkRecord(server_fd, epoll_ptr, read_limit));
+    writer_fds.push_back(client_fd);
+  }
+
+  uint64_t start = GetNanoseconds();
+  std::vector<std::thread> writers;
+  for (int fd : writer_fds) {
+    writers.emplace_back(WriteStream, fd, stream_size);
+  }
+  uint64_t iterations = 0;
+  size_t finished = 0;
+  while (finished < streams) {
+    epoll_ptr->Process();
+    ++iterations;
+    finished = 0;
+    for (const auto& sink_ptr : sinks) {
+      finished += sink_ptr->IsFinished() ? 1 : 0;
+    }
+  }
+  uint64_t elapsed = GetNanoseconds() - start;
+  for (size_t i = 0; i < streams; ++i) {
+    writers[i].join();
+    ::close(writer_fds[i]);
+  }
+
+  uint64_t received = 0;
+  uint64_t calls = 0;
+  for (const auto& sink_ptr : sinks) {
+    received += sink_ptr->GetReceived();
+    calls += sink_ptr->GetCalls();
+  }
+  if (received != stream_size * streams) {
+    Fail("data was lost");
+  }
+  double received_mb = received / (1024.0 * 1024.0);
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1)
+       << std::setw(10) << name
+       << std::setw(9) << streams
+       << std::setw(10) << received_mb * 1e9 / elapsed
+       << std::setw(12) << iterations / received_mb
+       << std::setw(12) << calls / received_mb;
+  return line.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t megabytes = kDefaultMegabytes;
+  if (argc > 1) {
+    megabytes = strtoull(argv[1], nullptr, 10);
+  }
+  // Records log through the file logger.
+  InitFileLogger("/dev/null");
+
+  std::vector<std::string> lines;
+  for (size_t streams : kStreams) {
+    lines.push_back(Run("level-4k", false, kBaselineReadLimit, streams,
+                        megabytes));
+    lines.push_back(Run("level", false, SIZE_MAX, streams, megabytes));
+    lines.push_back(Run("edge", true, SIZE_MAX, streams, megabytes));
+  }
+  cout << std::setw(10) << "mode" << std::setw(9) << "streams"
+       << std::setw(10) << "MB/s" << std::setw(12) << "wakeups/MB"
+       << std::setw(12) << "calls/MB" << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
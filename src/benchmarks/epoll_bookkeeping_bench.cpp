@@ -0,0 +1,284 @@
+// Measures per-event overhead of Epoll with many registered records.
+//
+// First, bookkeeping alone: records tracked by a std::map of timer handles
+// and a per-iteration std::unordered_set of deleted records, as Epoll did
+// before, against generation stamps kept in the records. Every iteration
+// dispatches a batch of random records, and some of them are closed and
+// replaced during dispatch.
+//
+// Then the loop itself: records of eventfds are registered and a batch of
+// them is signaled before every Process call, so the time includes the
+// system calls. Number of records is capped by the limit of descriptors.
+//
+// Usage: ./bench_epoll_bookkeeping [records]
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include "advanced_time.h"
+#include "bench_utils.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "logger.h"
+
+using base::AdvancedTime;
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using epoll::EpollRecord;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const size_t kDefaultRecords = 50000;
+const size_t kBatchSize = 256;
+const size_t kIterations = 20000;
+// One of this many dispatched records is closed and replaced.
+const size_t kChurnRatio = 100;
+const uint64_t kTimeoutMs = 3600000;
+// Descriptors left for the loop itself.
+const size_t kReservedDescriptors = 64;
+
+struct Result {
+  double subscribe_ns;
+  double dispatch_ns;
+  double unsubscribe_ns;
+};
+
+struct FakeRecord {
+  FakeRecord() : timer_handle(0), generation(0), event_index(0) {}
+
+  size_t timer_handle;
+  uint64_t generation;
+  size_t event_index;
+};
+
+// Epoll before the bookkeeping moved into records.
+class TreeBookkeeping {
+ public:
+  void Subscribe(FakeRecord* record) {
+    in_container_[record] = ++next_handle_;
+  }
+
+  void StartIteration(std::vector<FakeRecord*>*) {
+    deleted_records_.clear();
+  }
+
+  bool IsAlive(std::vector<FakeRecord*>*, size_t, FakeRecord* record) {
+    return deleted_records_.find(record) == deleted_records_.end();
+  }
+
+  // Record's deadline is refreshed when it's handled.
+  void Touch(FakeRecord* record) {
+    ++in_container_[record];
+  }
+
+  void Unsubscribe(std::vector<FakeRecord*>*, FakeRecord* record) {
+    in_container_.erase(record);
+    deleted_records_.insert(record);
+  }
+
+ private:
+  std::map<FakeRecord*, size_t> in_container_;
+  std::unordered_set<FakeRecord*> deleted_records_;
+  size_t next_handle_ = 0;
+};
+
+// Epoll now: record stamps itself with the iteration it's ready in.
+class IntrusiveBookkeeping {
+ public:
+  void Subscribe(FakeRecord* record) {
+    record->timer_handle = ++next_handle_;
+  }
+
+  void StartIteration(std::vector<FakeRecord*>* events) {
+    ++generation_;
+    for (size_t i = 0; i < events->size(); ++i) {
+      (*events)[i]->generation = generation_;
+      (*events)[i]->event_index = i;
+    }
+  }
+
+  bool IsAlive(std::vector<FakeRecord*>* events, size_t index,
+               FakeRecord*) {
+    return (*events)[index] != nullptr;
+  }
+
+  void Touch(FakeRecord* record) {
+    ++record->timer_handle;
+  }
+
+  void Unsubscribe(std::vector<FakeRecord*>* events, FakeRecord* record) {
+    if (record->generation == generation_) {
+      (*events)[record->event_index] = nullptr;
+    }
+  }
+
+ private:
+  uint64_t generation_ = 0;
+  size_t next_handle_ = 0;
+};
+
+template <typename Bookkeeping>
+Result RunBookkeeping(size_t count) {
+  Bookkeeping bookkeeping;
+  std::vector<FakeRecord> records(count);
+  std::mt19937_64 random(count);
+  Result result;
+
+  uint64_t start = GetNanoseconds();
+  for (FakeRecord& record : records) {
+    bookkeeping.Subscribe(&record);
+  }
+  result.subscribe_ns = (GetNanoseconds() - start) * 1.0 / count;
+
+  std::vector<FakeRecord*> events(kBatchSize);
+  uint64_t dispatched = 0;
+  start = GetNanoseconds();
+  for (size_t iteration = 0; iteration < kIterations; ++iteration) {
+    for (FakeRecord*& event : events) {
+      event = &records[random() % count];
+    }
+    bookkeeping.StartIteration(&events);
+    for (size_t i = 0; i < events.size(); ++i) {
+      FakeRecord* record = events[i];
+      if (!bookkeeping.IsAlive(&events, i, record)) {
+        continue;
+      }
+      ++dispatched;
+      bookkeeping.Touch(record);
+      if (dispatched % kChurnRatio == 0) {
+        bookkeeping.Unsubscribe(&events, record);
+        bookkeeping.Subscribe(record);
+      }
+    }
+  }
+  result.dispatch_ns = (GetNanoseconds() - start) * 1.0 / dispatched;
+
+  std::vector<FakeRecord*> no_events;
+  bookkeeping.StartIteration(&no_events);
+  start = GetNanoseconds();
+  for (FakeRecord& record : records) {
+    bookkeeping.Unsubscribe(&no_events, &record);
+  }
+  result.unsubscribe_ns = (GetNanoseconds() - start) * 1.0 / count;
+  return result;
+}
+
+class CounterRecord : public EpollRecord {
+ public:
+  CounterRecord(int fd, std::shared_ptr<Epoll> epoll_ptr) :
+      EpollRecord(fd, epoll_ptr, EpollRecord::IN,
+                  AdvancedTime::FromMilliseconds(kTimeoutMs)) {}
+
+  void OnIn() override {
+    eventfd_t value = 0;
+    if (::eventfd_read(GetFD(), &value) < 0) {
+      Fail("can't read eventfd");
+    }
+  }
+
+  void OnOut() override {}
+
+  void OnTimeExpired() override {
+    Fail("record was expired");
+  }
+
+  void OnError() override {
+    Fail("record was broken");
+  }
+};
+
+// Returns time of Process per dispatched event.
+double RunLoop(size_t count) {
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>();
+  std::vector<std::unique_ptr<CounterRecord>> records;
+  for (size_t i = 0; i < count; ++i) {
+    int fd = ::eventfd(0, EFD_NONBLOCK);
+    if (fd < 0) {
+      Fail("can't create eventfd");
+    }
+    records.emplace_back(new CounterRecord(fd, epoll_ptr));
+  }
+
+  std::mt19937_64 random(count);
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  uint64_t elapsed = 0;
+  uint64_t dispatched = 0;
+  for (size_t iteration = 0; iteration < kIterations / 10; ++iteration) {
+    // Distinct records, so the whole batch is ready in one Process.
+    for (size_t i = 0; i < kBatchSize; ++i) {
+      std::swap(order[i], order[i + random() % (count - i)]);
+      ::eventfd_write(records[order[i]]->GetFD(), 1);
+    }
+    uint64_t start = GetNanoseconds();
+    epoll_ptr->Process();
+    elapsed += GetNanoseconds() - start;
+    dispatched += kBatchSize;
+  }
+  return elapsed * 1.0 / dispatched;
+}
+
+size_t GetDescriptorLimit() {
+  rlimit limit;
+  if (::getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    return 0;
+  }
+  limit.rlim_cur = limit.rlim_max;
+  ::setrlimit(RLIMIT_NOFILE, &limit);
+  return limit.rlim_cur;
+}
+
+void PrintResult(const char* name, size_t count, const Result& result) {
+  cout << std::setw(12) << name << std::setw(10) << count
+       << std::setw(14) << result.subscribe_ns
+       << std::setw(14) << result.dispatch_ns
+       << std::setw(16) << result.unsubscribe_ns << endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t count = kDefaultRecords;
+  if (argc > 1) {
+    count = strtoull(argv[1], nullptr, 10);
+  }
+  // Records log through the file logger.
+  InitFileLogger("/dev/null");
+
+  cout << std::fixed << std::setprecision(1);
+  cout << std::setw(12) << "bookkeeping" << std::setw(10) << "records"
+       << std::setw(14) << "subscribe, ns" << std::setw(14) << "dispatch, ns"
+       << std::setw(16) << "unsubscribe, ns" << endl;
+  PrintResult("tree", count, RunBookkeeping<TreeBookkeeping>(count));
+  PrintResult("intrusive", count, RunBookkeeping<IntrusiveBookkeeping>(count));
+
+  size_t loop_count = count;
+  size_t limit = GetDescriptorLimit();
+  if (loop_count + kReservedDescriptors > limit) {
+    loop_count = (limit > kReservedDescriptors) ?
+                 (limit - kReservedDescriptors) : (0);
+  }
+  if (loop_count < kBatchSize) {
+    Fail("too few descriptors");
+  }
+  double event_ns = RunLoop(loop_count);
+  cout << "Process per event with " << loop_count << " records: "
+       << event_ns << " ns" << endl;
+  return 0;
+}
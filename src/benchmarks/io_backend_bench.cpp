@@ -0,0 +1,195 @@
+// Compares throughput of the loop's backends: epoll and io_uring, which
+// receives input ahead into provided buffers. Pairs of connected loopback TCP
+// sockets are served by one loop; one end sends a message and the other
+// echoes it back, so every record is woken up once per round trip.
+//
+// Usage: ./bench_io_backend [connections] [seconds]
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "advanced_time.h"
+#include "bench_utils.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "logger.h"
+#include "uring_poller.h"
+
+using base::AdvancedTime;
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using epoll::EpollRecord;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const size_t kDefaultConnections = 64;
+const uint64_t kDefaultSeconds = 1;
+const size_t kMessageSizes[] = {64, 16 * 1024};
+const uint64_t kTimeoutMs = 3600000;
+
+// Both records of a pair write the same way: whatever doesn't fit into the
+// socket waits for OUT.
+class BenchRecord : public EpollRecord {
+ public:
+  BenchRecord(int fd, std::shared_ptr<Epoll> epoll_ptr) :
+      EpollRecord(fd, epoll_ptr, EpollRecord::IN | epoll_ptr->GetModeFlags(),
+                  AdvancedTime::FromMilliseconds(kTimeoutMs)) {
+    ReceiveAhead();
+  }
+
+  void OnOut() override {
+    Send(nullptr, 0);
+  }
+
+  void OnTimeExpired() override {
+    Fail("record was expired");
+  }
+
+  void OnError() override {
+    Fail("record was broken");
+  }
+
+ protected:
+  void Send(const char* data, size_t size) {
+    if ((size > 0 && !Append(data, size)) || !WriteOutput()) {
+      Fail("can't write");
+    }
+    if (IsEmpty()) {
+      RemoveFlag(EpollRecord::OUT);
+    } else {
+      AddFlag(EpollRecord::OUT);
+    }
+  }
+};
+
+class EchoRecord : public BenchRecord {
+ public:
+  EchoRecord(int fd, std::shared_ptr<Epoll> epoll_ptr) :
+      BenchRecord(fd, epoll_ptr) {}
+
+  void OnIn() override {
+    base::ReceiveBuffer message;
+    if (!ReadInput(&message)) {
+      Fail("echo connection was closed");
+    }
+    if (!message.IsEmpty()) {
+      Send(message.GetData(), message.GetSize());
+    }
+  }
+};
+
+class PingRecord : public BenchRecord {
+ public:
+  PingRecord(int fd, std::shared_ptr<Epoll> epoll_ptr, size_t size) :
+      BenchRecord(fd, epoll_ptr), message_(size, 'x'), received_(0),
+      round_trips_(0) {
+    Send(message_.data(), message_.size());
+  }
+
+  void OnIn() override {
+    base::ReceiveBuffer message;
+    if (!ReadInput(&message)) {
+      Fail("ping connection was closed");
+    }
+    received_ += message.GetSize();
+    if (received_ == message_.size()) {
+      received_ = 0;
+      ++round_trips_;
+      Send(message_.data(), message_.size());
+    }
+  }
+
+  uint64_t GetRoundTrips() const {
+    return round_trips_;
+  }
+
+ private:
+  std::string message_;
+  size_t received_;
+  uint64_t round_trips_;
+};
+
+double Run(bool io_uring, bool edge_triggered, size_t connections,
+           size_t size, uint64_t seconds) {
+  Epoll::Options options;
+  options.io_uring = io_uring;
+  options.edge_triggered = edge_triggered;
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>(options);
+
+  std::vector<std::unique_ptr<EchoRecord>> echoes;
+  std::vector<std::unique_ptr<PingRecord>> pings;
+  for (size_t i = 0; i < connections; ++i) {
+    int client_fd = -1;
+    int server_fd = -1;
+    benchmarks::ConnectLoopback(&client_fd, &server_fd);
+    echoes.emplace_back(new EchoRecord(server_fd, epoll_ptr));
+    pings.emplace_back(new PingRecord(client_fd, epoll_ptr, size));
+  }
+
+  uint64_t start = GetNanoseconds();
+  uint64_t end = start + seconds * 1000000000ULL;
+  uint64_t now = start;
+  while (now < end) {
+    epoll_ptr->Process();
+    now = GetNanoseconds();
+  }
+  uint64_t round_trips = 0;
+  for (const auto& ping_ptr : pings) {
+    round_trips += ping_ptr->GetRoundTrips();
+  }
+  return round_trips * 1e9 / (now - start);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t connections = kDefaultConnections;
+  uint64_t seconds = kDefaultSeconds;
+  if (argc > 1) {
+    connections = strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    seconds = strtoull(argv[2], nullptr, 10);
+  }
+  // Records log through the file logger.
+  InitFileLogger("/dev/null");
+  bool has_io_uring = epoll::UringPoller::Create() != nullptr;
+  if (!has_io_uring) {
+    LOGW << "io_uring isn't available; only epoll is measured";
+  }
+
+  std::vector<std::string> lines;
+  for (size_t size : kMessageSizes) {
+    for (int backend = 0; backend < (has_io_uring ? 2 : 1); ++backend) {
+      for (int edge_triggered = 0; edge_triggered < 2; ++edge_triggered) {
+        double rate = Run(backend == 1, edge_triggered == 1, connections,
+                          size, seconds);
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1)
+             << std::setw(10) << ((backend == 1) ? "io_uring" : "epoll")
+             << std::setw(8) << ((edge_triggered == 1) ? "edge" : "level")
+             << std::setw(10) << size
+             << std::setw(14) << rate
+             << std::setw(12) << rate * size * 2 / (1024 * 1024);
+        lines.push_back(line.str());
+      }
+    }
+  }
+  cout << std::setw(10) << "backend" << std::setw(8) << "mode"
+       << std::setw(10) << "message" << std::setw(14) << "round trips/s"
+       << std::setw(12) << "MB/s" << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
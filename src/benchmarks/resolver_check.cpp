@@ -0,0 +1,344 @@
+// Checks the stub resolver against a responder on loopback: a query which
+// the first server doesn't answer goes to the next one, a missing name is
+// cached as a failure, CNAMEs before the addresses are skipped and an
+// answer with a wrong id is dropped. The resolver reads a temporary
+// resolv.conf given through Epoll::Options::resolv_conf. The responder binds
+// port 53, so it needs CAP_NET_BIND_SERVICE. Exits with 1 on the first
+// failed check.
+//
+// Usage: ./check_resolver
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_utils.h"
+#include "dns_cache.h"
+#include "dns_resolver.h"
+#include "epoll.h"
+#include "logger.h"
+#include "net_utils.h"
+#include "server_socket.h"
+
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using net_utils::DnsCache;
+using std::cout;
+using std::endl;
+
+namespace {
+
+// Doesn't answer kRetryName; answers everything else as the second one.
+const char kSilentServer[] = "127.0.0.2";
+const char kServer[] = "127.0.0.3";
+const uint16_t kDnsPort = 53;
+const char kPort[] = "80";
+const char kRetryName[] = "retry.test";
+const char kMissingName[] = "missing.test";
+// Answered with a CNAME to kTargetName before the addresses.
+const char kAliasName[] = "alias.test";
+const char kTargetName[] = "target.test";
+// Right answer follows an answer with another id and other addresses.
+const char kWrongIdName[] = "wrong-id.test";
+const char kAddresses[] = "[::1]:80 127.0.0.1:80";
+const uint64_t kTimeoutMs = 10000;
+const int kPollTimeoutMs = 100;
+const uint16_t kTypeA = 1;
+const uint16_t kTypeCname = 5;
+const uint16_t kTypeAAAA = 28;
+const uint16_t kFlagsAnswer = 0x8180;
+const uint16_t kFlagsNameError = 0x8183;
+const size_t kHeaderSize = 12;
+
+void Check(bool condition, const char* what) {
+  if (!condition) {
+    LOGE << "Check failed: " << what;
+    exit(1);
+  }
+}
+
+void AppendUint16(uint16_t value, std::string* data) {
+  data->push_back(static_cast<char>(value >> 8));
+  data->push_back(static_cast<char>(value & 0xff));
+}
+
+void AppendUint32(uint32_t value, std::string* data) {
+  AppendUint16(value >> 16, data);
+  AppendUint16(value & 0xffff, data);
+}
+
+void AppendName(const std::string& name, std::string* data) {
+  size_t begin = 0;
+  while (begin < name.size()) {
+    size_t end = name.find('.', begin);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    data->push_back(static_cast<char>(end - begin));
+    data->append(name, begin, end - begin);
+    begin = end + 1;
+  }
+  data->push_back(0);
+}
+
+// Owner is a compression pointer to the given offset of the message.
+void AppendRecord(uint16_t owner_offset, uint16_t type,
+                  const std::string& record_data, std::string* data) {
+  AppendUint16(0xc000 | owner_offset, data);
+  AppendUint16(type, data);
+  AppendUint16(1, data);  // class IN
+  AppendUint32(60, data);
+  AppendUint16(record_data.size(), data);
+  data->append(record_data);
+}
+
+struct Query {
+  uint16_t id;
+  std::string name;
+  uint16_t type;
+  // Question section as it was sent.
+  std::string question;
+};
+
+bool ParseQuery(const char* data, size_t size, Query* query) {
+  if (size < kHeaderSize + 5) {
+    return false;
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  query->id = (bytes[0] << 8) | bytes[1];
+  query->name.clear();
+  size_t pos = kHeaderSize;
+  while (pos < size && bytes[pos] != 0) {
+    size_t length = bytes[pos];
+    if (pos + 1 + length > size) {
+      return false;
+    }
+    if (!query->name.empty()) {
+      query->name.push_back('.');
+    }
+    query->name.append(data + pos + 1, length);
+    pos += 1 + length;
+  }
+  if (pos + 5 > size) {
+    return false;
+  }
+  query->type = (bytes[pos + 1] << 8) | bytes[pos + 2];
+  query->question.assign(data + kHeaderSize, pos + 5 - kHeaderSize);
+  return true;
+}
+
+std::string BuildAnswer(const Query& query, uint16_t id, bool is_right) {
+  std::string answer;
+  AppendUint16(id, &answer);
+  bool is_missing = query.name == kMissingName;
+  bool is_alias = query.name == kAliasName;
+  AppendUint16((is_missing) ? (kFlagsNameError) : (kFlagsAnswer), &answer);
+  AppendUint16(1, &answer);
+  AppendUint16((is_missing) ? (0) : ((is_alias) ? (2) : (1)), &answer);
+  AppendUint16(0, &answer);
+  AppendUint16(0, &answer);
+  answer.append(query.question);
+  if (is_missing) {
+    return answer;
+  }
+  uint16_t owner_offset = kHeaderSize;
+  if (is_alias) {
+    std::string target;
+    AppendName(kTargetName, &target);
+    // Target starts after the owner, type, class, TTL and size.
+    owner_offset = answer.size() + 12;
+    AppendRecord(kHeaderSize, kTypeCname, target, &answer);
+  }
+  std::string address;
+  if (query.type == kTypeA) {
+    in_addr ip;
+    ::inet_pton(AF_INET, (is_right) ? ("127.0.0.1") : ("10.0.0.1"), &ip);
+    address.assign(reinterpret_cast<const char*>(&ip), sizeof(ip));
+  } else {
+    in6_addr ip;
+    ::inet_pton(AF_INET6, (is_right) ? ("::1") : ("100::1"), &ip);
+    address.assign(reinterpret_cast<const char*>(&ip), sizeof(ip));
+  }
+  AppendRecord(owner_offset, query.type, address, &answer);
+  return answer;
+}
+
+// Answers queries of the resolver on its own thread and counts them.
+class Responder {
+ public:
+  Responder() : is_stopped_(false) {
+    fds_[0] = Bind(kSilentServer);
+    fds_[1] = Bind(kServer);
+    thread_ = std::thread(&Responder::Run, this);
+  }
+
+  ~Responder() {
+    is_stopped_ = true;
+    thread_.join();
+    ::close(fds_[0]);
+    ::close(fds_[1]);
+  }
+
+  size_t GetQueries(const std::string& server, const std::string& name) {
+    std::unique_lock<std::mutex> lock(locker_);
+    return queries_[server + " " + name];
+  }
+
+ private:
+  static int Bind(const char* ip) {
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(kDnsPort);
+    ::inet_pton(AF_INET, ip, &address.sin_addr);
+    if (fd < 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)) < 0) {
+      LOGE << "Can't bind " << ip << ":" << kDnsPort;
+      exit(1);
+    }
+    return fd;
+  }
+
+  void Run() {
+    pollfd fds[2] = {{fds_[0], POLLIN, 0}, {fds_[1], POLLIN, 0}};
+    while (!is_stopped_) {
+      if (::poll(fds, 2, kPollTimeoutMs) <= 0) {
+        continue;
+      }
+      for (size_t i = 0; i < 2; ++i) {
+        if (fds[i].revents & POLLIN) {
+          Receive(fds_[i], (i == 0) ? (kSilentServer) : (kServer));
+        }
+      }
+    }
+  }
+
+  void Receive(int fd, const std::string& server) {
+    char data[512];
+    sockaddr_in client;
+    socklen_t client_size = sizeof(client);
+    ssize_t size = ::recvfrom(fd, data, sizeof(data), 0,
+                              reinterpret_cast<sockaddr*>(&client),
+                              &client_size);
+    Query query;
+    if (size <= 0 || !ParseQuery(data, size, &query)) {
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(locker_);
+      ++queries_[server + " " + query.name];
+    }
+    if (server == kSilentServer && query.name == kRetryName) {
+      return;
+    }
+    if (query.name == kWrongIdName) {
+      Send(fd, client, BuildAnswer(query, query.id ^ 0x5555, false));
+    }
+    Send(fd, client, BuildAnswer(query, query.id, true));
+  }
+
+  static void Send(int fd, const sockaddr_in& client,
+                   const std::string& answer) {
+    ::sendto(fd, answer.data(), answer.size(), 0,
+             reinterpret_cast<const sockaddr*>(&client), sizeof(client));
+  }
+
+  int fds_[2];
+  std::thread thread_;
+  std::atomic<bool> is_stopped_;
+  std::mutex locker_;
+  // Number of queries by server and name.
+  std::map<std::string, size_t> queries_;
+};
+
+// Runs the loop until the resolver answers; addresses are joined.
+std::string Resolve(Epoll* epoll_ptr, sockets::DnsResolver* resolver_ptr,
+                    const std::string& host) {
+  bool is_done = false;
+  std::string result;
+  resolver_ptr->Resolve(
+      host, kPort,
+      [&is_done, &result](const std::vector<sockaddr_storage>& addresses) {
+        for (const sockaddr_storage& address : addresses) {
+          result += ((result.empty()) ? ("") : (" ")) +
+                    net_utils::AddressToString(address);
+        }
+        is_done = true;
+      });
+  uint64_t deadline = GetNanoseconds() + kTimeoutMs * 1000000;
+  while (!is_done) {
+    Check(GetNanoseconds() < deadline, "resolver doesn't answer");
+    epoll_ptr->Process();
+  }
+  return result;
+}
+
+std::string WriteResolvConf() {
+  char path[] = "/tmp/check_resolver_XXXXXX";
+  int fd = ::mkstemp(path);
+  std::string config = std::string("nameserver ") + kSilentServer +
+                       "\nnameserver " + kServer +
+                       "\noptions timeout:1 attempts:1\n";
+  Check(fd >= 0 && ::write(fd, config.data(), config.size()) ==
+                       static_cast<ssize_t>(config.size()),
+        "can't write resolv.conf");
+  ::close(fd);
+  return path;
+}
+
+}  // namespace
+
+int main() {
+  InitFileLogger("/dev/null");
+  Responder responder;
+  Epoll::Options options;
+  options.resolv_conf = WriteResolvConf();
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>(options);
+  // Resolver of the server socket reads the configuration.
+  std::unique_ptr<sockets::ServerSocket> server_ptr(
+      new sockets::ServerSocket(epoll_ptr, 0, htonl(INADDR_LOOPBACK)));
+  ::unlink(options.resolv_conf.c_str());
+  sockets::DnsResolver* resolver_ptr = server_ptr->GetDnsResolverPtr();
+  DnsCache::Callback ignore = [](const std::vector<sockaddr_storage>&) {};
+  std::vector<sockaddr_storage> addresses;
+
+  Check(Resolve(epoll_ptr.get(), resolver_ptr, kRetryName) == kAddresses,
+        "retry: wrong addresses");
+  Check(responder.GetQueries(kSilentServer, kRetryName) == 2 &&
+            responder.GetQueries(kServer, kRetryName) == 2,
+        "retry: query wasn't sent to the next server");
+  cout << "retransmit to the next server: ok" << endl;
+
+  Check(Resolve(epoll_ptr.get(), resolver_ptr, kMissingName).empty(),
+        "missing name: addresses are given");
+  Check(responder.GetQueries(kSilentServer, kMissingName) == 2 &&
+            responder.GetQueries(kServer, kMissingName) == 0,
+        "missing name: name error was retried");
+  Check(DnsCache::GetInstance()->Lookup(kMissingName, kPort, &addresses,
+                                        ignore) == DnsCache::NEGATIVE,
+        "missing name: failure isn't cached");
+  cout << "missing name is cached: ok" << endl;
+
+  Check(Resolve(epoll_ptr.get(), resolver_ptr, kAliasName) == kAddresses,
+        "alias: CNAME isn't skipped");
+  cout << "CNAME is skipped: ok" << endl;
+
+  Check(Resolve(epoll_ptr.get(), resolver_ptr, kWrongIdName) == kAddresses,
+        "wrong id: answer isn't dropped");
+  cout << "answer with wrong id is dropped: ok" << endl;
+  return 0;
+}
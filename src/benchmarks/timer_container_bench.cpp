@@ -0,0 +1,235 @@
+// Compares the timing wheel with the set of per-timeout lists which
+// TimerContainer used before. Every timer is armed, re-armed once as an
+// active connection would be, and then expires while the clock runs over
+// the whole range of timeouts.
+//
+// Usage: ./bench_timer_container [max_timers]
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "advanced_time.h"
+#include "timer_container.h"
+
+using base::AdvancedTime;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const size_t kDefaultMaxTimers = 1000000;
+// Timeouts are spread like those of connects, DNS queries and idle
+// connections.
+const uint64_t kMaxTimeoutMs = 60000;
+const uint64_t kStartMs = 1000000;
+
+// TimerContainer before the timing wheel: sorted set of lists, one list per
+// timeout value.
+template <typename T>
+class ListSetTimerContainer {
+ private:
+  typedef std::list<std::pair<AdvancedTime, T>> List;
+  typedef std::shared_ptr<List> ListPtr;
+  typedef std::pair<ListPtr, AdvancedTime> ListPtrTimeout;
+  typedef std::set<ListPtrTimeout, bool(*)(const ListPtrTimeout&,
+                                           const ListPtrTimeout&)> SetForLists;
+  typedef std::map<AdvancedTime, typename SetForLists::iterator>
+                                                            SetItByTimeout;
+
+ public:
+  struct Iterator {
+    AdvancedTime timeout;
+    typename List::iterator list_it;
+  };
+
+  ListSetTimerContainer() : sorted_lists_(&ListsComparator) {}
+
+  Iterator Insert(const T& value, const AdvancedTime& timeout,
+                  const AdvancedTime& expiration_time) {
+    ListPtrTimeout cur;
+    typename List::iterator list_it;
+    auto it = iterators_by_timeouts_.find(timeout);
+    if (it == iterators_by_timeouts_.end()) {
+      ListPtr list_ptr = std::make_shared<List>();
+      list_it = list_ptr->insert(list_ptr->end(), {expiration_time, value});
+      cur = {list_ptr, timeout};
+    } else {
+      cur = *(it->second);
+      sorted_lists_.erase(it->second);
+      iterators_by_timeouts_.erase(it);
+      list_it = cur.first->insert(cur.first->end(), {expiration_time, value});
+    }
+    iterators_by_timeouts_[timeout] = sorted_lists_.insert(cur).first;
+    return {timeout, list_it};
+  }
+
+  void Erase(const Iterator& it) {
+    auto sorted_lists_it = iterators_by_timeouts_[it.timeout];
+    ListPtrTimeout cur = *(sorted_lists_it);
+    iterators_by_timeouts_.erase(it.timeout);
+    sorted_lists_.erase(sorted_lists_it);
+    cur.first->erase(it.list_it);
+    if (cur.first->empty()) {
+      return;
+    }
+    iterators_by_timeouts_[it.timeout] = sorted_lists_.insert(cur).first;
+  }
+
+  Iterator Update(const Iterator& it, AdvancedTime new_start_time) {
+    T value = it.list_it->second;
+    AdvancedTime timeout = it.timeout;
+    Erase(it);
+    return Insert(value, timeout, new_start_time + timeout);
+  }
+
+  Iterator GetNext() const {
+    auto it = sorted_lists_.begin();
+    return {it->second, it->first->begin()};
+  }
+
+  bool IsEmpty() const {
+    return iterators_by_timeouts_.empty();
+  }
+
+ private:
+  static bool ListsComparator(const ListPtrTimeout& lp1,
+                              const ListPtrTimeout& lp2) {
+    if (lp1.first->front().first < lp2.first->front().first) {
+      return true;
+    }
+    if (lp1.first->front().first > lp2.first->front().first) {
+      return false;
+    }
+    return lp1.first < lp2.first;
+  }
+
+  SetForLists sorted_lists_;
+  SetItByTimeout iterators_by_timeouts_;
+};
+
+struct Result {
+  double insert_ns;
+  double update_ns;
+  double expire_ns;
+};
+
+uint64_t GetNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<uint64_t> MakeTimeouts(size_t count) {
+  std::mt19937_64 random(count);
+  std::vector<uint64_t> timeouts(count);
+  for (uint64_t& timeout : timeouts) {
+    timeout = 1 + random() % kMaxTimeoutMs;
+  }
+  return timeouts;
+}
+
+Result RunWheel(const std::vector<uint64_t>& timeouts) {
+  typedef base::TimerContainer<size_t> Container;
+  Container container;
+  std::vector<Container::Iterator> iterators(timeouts.size());
+  container.Advance(AdvancedTime::FromMilliseconds(kStartMs));
+  Result result;
+
+  uint64_t start = GetNanoseconds();
+  for (size_t i = 0; i < timeouts.size(); ++i) {
+    AdvancedTime timeout = AdvancedTime::FromMilliseconds(timeouts[i]);
+    iterators[i] = container.Insert(
+        i, timeout, AdvancedTime::FromMilliseconds(kStartMs) + timeout);
+  }
+  result.insert_ns = (GetNanoseconds() - start) * 1.0 / timeouts.size();
+
+  AdvancedTime now = AdvancedTime::FromMilliseconds(kStartMs + 1);
+  container.Advance(now);
+  start = GetNanoseconds();
+  for (size_t i = 0; i < timeouts.size(); ++i) {
+    iterators[i] = container.Update(iterators[i], now);
+  }
+  result.update_ns = (GetNanoseconds() - start) * 1.0 / timeouts.size();
+
+  size_t expired = 0;
+  start = GetNanoseconds();
+  for (uint64_t ms = kStartMs + 1; !container.IsEmpty(); ++ms) {
+    container.Advance(AdvancedTime::FromMilliseconds(ms));
+    while (container.HasDue()) {
+      container.Erase(container.GetDue());
+      ++expired;
+    }
+  }
+  result.expire_ns = (GetNanoseconds() - start) * 1.0 / expired;
+  return result;
+}
+
+Result RunListSet(const std::vector<uint64_t>& timeouts) {
+  typedef ListSetTimerContainer<size_t> Container;
+  Container container;
+  std::vector<Container::Iterator> iterators(timeouts.size());
+  Result result;
+
+  uint64_t start = GetNanoseconds();
+  for (size_t i = 0; i < timeouts.size(); ++i) {
+    AdvancedTime timeout = AdvancedTime::FromMilliseconds(timeouts[i]);
+    iterators[i] = container.Insert(
+        i, timeout, AdvancedTime::FromMilliseconds(kStartMs) + timeout);
+  }
+  result.insert_ns = (GetNanoseconds() - start) * 1.0 / timeouts.size();
+
+  AdvancedTime now = AdvancedTime::FromMilliseconds(kStartMs + 1);
+  start = GetNanoseconds();
+  for (size_t i = 0; i < timeouts.size(); ++i) {
+    iterators[i] = container.Update(iterators[i], now);
+  }
+  result.update_ns = (GetNanoseconds() - start) * 1.0 / timeouts.size();
+
+  size_t expired = 0;
+  start = GetNanoseconds();
+  for (uint64_t ms = kStartMs + 1; !container.IsEmpty(); ++ms) {
+    now = AdvancedTime::FromMilliseconds(ms);
+    while (!container.IsEmpty() &&
+           container.GetNext().list_it->first <= now) {
+      container.Erase(container.GetNext());
+      ++expired;
+    }
+  }
+  result.expire_ns = (GetNanoseconds() - start) * 1.0 / expired;
+  return result;
+}
+
+void PrintResult(const char* name, size_t count, const Result& result) {
+  cout << std::setw(10) << name << std::setw(10) << count
+       << std::setw(12) << result.insert_ns
+       << std::setw(12) << result.update_ns
+       << std::setw(12) << result.expire_ns << endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t max_timers = kDefaultMaxTimers;
+  if (argc > 1) {
+    max_timers = strtoull(argv[1], nullptr, 10);
+  }
+  cout << std::fixed << std::setprecision(1);
+  cout << std::setw(10) << "container" << std::setw(10) << "timers"
+       << std::setw(12) << "insert, ns" << std::setw(12) << "update, ns"
+       << std::setw(12) << "expire, ns" << endl;
+  for (size_t count = 10000; count <= max_timers; count *= 10) {
+    std::vector<uint64_t> timeouts = MakeTimeouts(count);
+    PrintResult("wheel", count, RunWheel(timeouts));
+    PrintResult("list-set", count, RunListSet(timeouts));
+  }
+  return 0;
+}
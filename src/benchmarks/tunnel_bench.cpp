@@ -0,0 +1,259 @@
+// Measures sustained throughput of CONNECT tunnels relayed by one loop, and
+// how much of a core the loop spends on it. Clients open tunnels through a
+// ServerSocket to an upstream of the benchmark and stream data one way, so
+// the other direction only carries the half-close.
+//
+// Usage: ./bench_tunnel [megabytes]
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_utils.h"
+#include "epoll.h"
+#include "epoll_notifier.h"
+#include "logger.h"
+#include "server_socket.h"
+#include "uring_poller.h"
+
+using benchmarks::Fail;
+using benchmarks::GetNanoseconds;
+using epoll::Epoll;
+using epoll::EpollNotifier;
+using std::cout;
+using std::endl;
+
+namespace {
+
+const uint64_t kDefaultMegabytes = 512;
+const size_t kStreams[] = {1, 16};
+const size_t kChunkSize = 64 * 1024;
+
+struct Mode {
+  const char* name;
+  bool edge_triggered;
+  bool io_uring;
+  bool splice_relay;
+};
+
+const Mode kModes[] = {
+  {"level", false, false, false},
+  {"edge", true, false, false},
+  {"splice", false, false, true},
+  {"io_uring", false, true, false},
+};
+
+void WriteAll(int fd, uint64_t size) {
+  std::string chunk(kChunkSize, 'x');
+  while (size > 0) {
+    size_t to_write = (size < kChunkSize) ? (size) : (kChunkSize);
+    ssize_t written = ::write(fd, chunk.data(), to_write);
+    if (written <= 0) {
+      Fail("can't write");
+    }
+    size -= written;
+  }
+}
+
+// Returns number of bytes read until end of file.
+uint64_t ReadAll(int fd) {
+  std::vector<char> chunk(kChunkSize);
+  uint64_t received = 0;
+  for (;;) {
+    ssize_t was_read = ::read(fd, chunk.data(), chunk.size());
+    if (was_read < 0) {
+      Fail("can't read");
+    }
+    if (was_read == 0) {
+      return received;
+    }
+    received += was_read;
+  }
+}
+
+// Sender writes its part and half-closes; receiver reads until the end of
+// file which the tunnel forwards, and then closes, which ends the other
+// direction.
+uint64_t Transfer(int fd, bool is_sender, uint64_t size) {
+  uint64_t received = 0;
+  if (is_sender) {
+    WriteAll(fd, size);
+    ::shutdown(fd, SHUT_WR);
+    ReadAll(fd);
+  } else {
+    received = ReadAll(fd);
+  }
+  ::close(fd);
+  return received;
+}
+
+// Returns bytes which came after the reply within the same read.
+uint64_t OpenTunnel(int fd, uint16_t upstream_port) {
+  std::ostringstream request;
+  request << "CONNECT 127.0.0.1:" << upstream_port << " HTTP/1.1\r\n"
+          << "Host: 127.0.0.1:" << upstream_port << "\r\n\r\n";
+  std::string request_str = request.str();
+  if (::write(fd, request_str.data(), request_str.size()) !=
+      static_cast<ssize_t>(request_str.size())) {
+    Fail("can't send CONNECT");
+  }
+  std::string reply;
+  size_t header_end = std::string::npos;
+  char chunk[4096];
+  while (header_end == std::string::npos) {
+    ssize_t was_read = ::read(fd, chunk, sizeof(chunk));
+    if (was_read <= 0) {
+      Fail("tunnel wasn't established");
+    }
+    reply.append(chunk, was_read);
+    header_end = reply.find("\r\n\r\n");
+  }
+  if (reply.compare(0, 12, "HTTP/1.1 200") != 0) {
+    Fail("CONNECT was refused");
+  }
+  return reply.size() - header_end - 4;
+}
+
+void RunClient(uint16_t proxy_port, uint16_t upstream_port, bool upload,
+               uint64_t size, std::atomic<uint64_t>* received) {
+  int fd = benchmarks::ConnectLoopback(proxy_port);
+  uint64_t early = OpenTunnel(fd, upstream_port);
+  *received += early + Transfer(fd, upload, size);
+}
+
+void RunUpstream(int fd, bool upload, uint64_t size,
+                 std::atomic<uint64_t>* received) {
+  *received += Transfer(fd, !upload, size);
+}
+
+uint64_t GetThreadCpuNanoseconds(std::thread* thread) {
+  clockid_t clock;
+  timespec time;
+  if (::pthread_getcpuclockid(thread->native_handle(), &clock) != 0 ||
+      ::clock_gettime(clock, &time) < 0) {
+    Fail("can't read CPU time of the loop");
+  }
+  return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void RunLoop(std::shared_ptr<Epoll> epoll_ptr, std::atomic<bool>* is_stopped) {
+  InitFileLogger("/dev/null");
+  while (!*is_stopped) {
+    epoll_ptr->Process();
+  }
+}
+
+std::string Run(const Mode& mode, bool upload, size_t streams,
+                uint64_t megabytes) {
+  Epoll::Options options;
+  options.edge_triggered = mode.edge_triggered;
+  options.io_uring = mode.io_uring;
+  options.splice_relay = mode.splice_relay;
+  std::shared_ptr<Epoll> epoll_ptr = std::make_shared<Epoll>(options);
+  // Records are created before the loop thread starts and destroyed after
+  // it stops, so they are never touched concurrently.
+  std::unique_ptr<sockets::ServerSocket> server_ptr(
+      new sockets::ServerSocket(epoll_ptr, 0, htonl(INADDR_LOOPBACK)));
+  std::unique_ptr<EpollNotifier> notifier_ptr(
+      new EpollNotifier(epoll_ptr, []() {}));
+  sockaddr_in address = {};
+  socklen_t address_size = sizeof(address);
+  if (::getsockname(server_ptr->GetFD(), reinterpret_cast<sockaddr*>(&address),
+                    &address_size) < 0) {
+    Fail("can't get port of the proxy");
+  }
+  uint16_t proxy_port = ntohs(address.sin_port);
+  uint16_t upstream_port = 0;
+  int listener = benchmarks::ListenLoopback(&upstream_port);
+
+  std::atomic<bool> is_stopped(false);
+  std::thread loop(RunLoop, epoll_ptr, &is_stopped);
+  uint64_t stream_size = megabytes * 1024 * 1024 / streams;
+  std::atomic<uint64_t> received(0);
+  uint64_t start = GetNanoseconds();
+  uint64_t cpu_start = GetThreadCpuNanoseconds(&loop);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < streams; ++i) {
+    threads.emplace_back(RunClient, proxy_port, upstream_port, upload,
+                         stream_size, &received);
+  }
+  for (size_t i = 0; i < streams; ++i) {
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      Fail("can't accept upstream connection");
+    }
+    threads.emplace_back(RunUpstream, fd, upload, stream_size, &received);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  uint64_t elapsed = GetNanoseconds() - start;
+  uint64_t cpu = GetThreadCpuNanoseconds(&loop) - cpu_start;
+  is_stopped = true;
+  notifier_ptr->Notify();
+  loop.join();
+  ::close(listener);
+  notifier_ptr = nullptr;
+  server_ptr = nullptr;
+
+  if (received != stream_size * streams) {
+    Fail("data was lost");
+  }
+  double received_mb = received / (1024.0 * 1024.0);
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1)
+       << std::setw(10) << mode.name
+       << std::setw(8) << ((upload) ? "up" : "down")
+       << std::setw(9) << streams
+       << std::setw(10) << received_mb * 1e9 / elapsed
+       << std::setw(10) << cpu * 100.0 / elapsed
+       << std::setw(14) << received_mb * 1e9 / cpu;
+  return line.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t megabytes = kDefaultMegabytes;
+  if (argc > 1) {
+    megabytes = strtoull(argv[1], nullptr, 10);
+  }
+  // Sockets log through the file logger.
+  InitFileLogger("/dev/null");
+  bool has_io_uring = epoll::UringPoller::Create() != nullptr;
+  if (!has_io_uring) {
+    LOGW << "io_uring isn't available; it's skipped";
+  }
+
+  std::vector<std::string> lines;
+  for (const Mode& mode : kModes) {
+    if (mode.io_uring && !has_io_uring) {
+      continue;
+    }
+    for (size_t streams : kStreams) {
+      for (int upload = 0; upload < 2; ++upload) {
+        lines.push_back(Run(mode, upload == 1, streams, megabytes));
+      }
+    }
+  }
+  cout << std::setw(10) << "mode" << std::setw(8) << "way"
+       << std::setw(9) << "streams" << std::setw(10) << "MB/s"
+       << std::setw(10) << "loop CPU%" << std::setw(14) << "MB/CPU second"
+       << endl;
+  for (const std::string& line : lines) {
+    cout << line << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "completion_queue.h"
+
+#include "logger.h"
+
+namespace epoll {
+
+CompletionQueue::CompletionQueue(std::shared_ptr<Epoll> epoll_ptr) :
+    head_(nullptr) {
+  notifier_.reset(new EpollNotifier(epoll_ptr, [this]() {
+    Process();
+  }));
+}
+
+CompletionQueue::~CompletionQueue() {
+  Node* node = head_.exchange(nullptr);
+  while (node != nullptr) {
+    Node* next = node->next;
+    delete node;
+    node = next;
+  }
+}
+
+void CompletionQueue::Post(const Func& task) {
+  Node* node = new Node{task, head_.load(std::memory_order_relaxed)};
+  while (!head_.compare_exchange_weak(node->next, node,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed)) {}
+  if (node->next == nullptr) {
+    // Loop takes the whole stack, so it has to be woken only for the first
+    // task after that.
+    notifier_->Notify();
+  }
+}
+
+void CompletionQueue::Process() {
+  // Notification is already consumed, so a task posted after the exchange
+  // will wake the loop again.
+  Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+  Node* reversed = nullptr;
+  while (node != nullptr) {
+    Node* next = node->next;
+    node->next = reversed;
+    reversed = node;
+    node = next;
+  }
+
+  size_t processed = 0;
+  while (reversed != nullptr) {
+    std::unique_ptr<Node> current(reversed);
+    reversed = reversed->next;
+    current->task();
+    ++processed;
+  }
+  FLOGI << "Completion queue processed " << processed << " tasks";
+}
+
+}  // namespace epoll
@@ -0,0 +1,46 @@
+#ifndef EPOLL_COMPLETION_QUEUE_H_
+#define EPOLL_COMPLETION_QUEUE_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "epoll.h"
+#include "epoll_notifier.h"
+#include "macros.h"
+
+namespace epoll {
+
+// Delivers results of other threads' work to the loop thread.
+// Producers push tasks to a lock-free stack and wake the loop only when the
+// stack was empty; the loop takes the whole stack at once and runs tasks in
+// the order they were posted.
+class CompletionQueue {
+ private:
+  typedef std::function<void(void)> Func;
+
+ public:
+  explicit CompletionQueue(std::shared_ptr<Epoll> epoll_ptr);
+  // Tasks which weren't run are dropped.
+  ~CompletionQueue();
+
+  // Thread-safe.
+  void Post(const Func& task);
+
+ private:
+  struct Node {
+    Func task;
+    Node* next;
+  };
+
+  void Process();
+
+  std::atomic<Node*> head_;
+  std::unique_ptr<EpollNotifier> notifier_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(CompletionQueue);
+};
+
+}  // namespace epoll
+
+#endif  // EPOLL_COMPLETION_QUEUE_H_
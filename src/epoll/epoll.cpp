@@ -1,5 +1,6 @@
 #include "epoll.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include <sys/epoll.h>
@@ -7,7 +8,6 @@
 #include "advanced_time.h"
 #include "epoll_record.h"
 #include "logger.h"
-#include "net_utils.h"
 #include "signal_handler.h"
 #include "terminal_error.h"
 
@@ -20,24 +20,33 @@ const uint64_t kMaximalEpollWaitTimeMs = 36 * 60 * 1000;
 }  // namespace
 
 using base::AdvancedTime;
-using base::FileDescriptor;
 
-Epoll::Epoll() : FileDescriptor(net_utils::CreateEpollFD()) {
-  if (!base::FileDescriptor::IsValid()) {
+Epoll::Epoll(const Options& options) :
+    options_(options),
+    poller_(CreatePoller(options.io_uring)),
+    generation_(0),
+    last_activity_us_(0) {
+  UpdateNow();
+  if (!poller_) {
     LOGE << "TERMINATION_ERROR: Can't create epoll";
     throw TerminalError();
   }
-  LOGI << "Epoll was created; fd: " << GetFD();
+  LOGI << "Epoll was created; backend: " << poller_->GetName()
+       << " fd: " << poller_->GetFD();
 }
 
 Epoll::~Epoll() {
-  LOGI << "Epoll was destroyed; fd: " << GetFD();
+  if (poller_) {
+    LOGI << "Epoll was destroyed; fd: " << poller_->GetFD();
+  }
 }
 
 void Epoll::Process() {
   FLOGI << "***********************************";
   FLOGI << "Start epoll's processing";
-  deleted_records_.clear();
+  ++generation_;
+  const bool collect_stats = options_.collect_stats;
+  uint64_t iteration_start_us = collect_stats ? GetMonotonicMicroseconds() : 0;
 
   if (timer_container_.IsEmpty()) {
     LOGE << "TERMINATION_ERROR: Timer container is empty!";
@@ -45,18 +54,27 @@ void Epoll::Process() {
     return;
   }
 
-  AdvancedTime current_time = AdvancedTime::Now();
-  while (!timer_container_.IsEmpty()) {
-    auto it = timer_container_.GetNext();
-    if (it.GetExpirationTime() < current_time) {
-      EpollRecord* record_ptr = it.GetValue();
-      LOGW << "Epoll Record: " << record_ptr->GetFD()
-            << " was expired";
-      record_ptr->OnTimeExpired();
-    } else {
+  // Time was read after the previous wait, only handlers ran since then.
+  AdvancedTime current_time = now_;
+  uint64_t timers_expired = 0;
+  while (timer_container_.HasDue()) {
+    auto it = timer_container_.GetDue();
+    if (it.GetExpirationTime() >= current_time) {
       break;
     }
+    EpollRecord* record_ptr = it.GetValue();
+    if (record_ptr->GetExpirationTime() >= current_time) {
+      // Deadline was refreshed after the timer had been armed.
+      record_ptr->timer_it_ = timer_container_.Update(
+          it, record_ptr->GetExpirationTime() - record_ptr->GetTimeout());
+      continue;
+    }
+    LOGW << "Epoll Record: " << record_ptr->GetFD()
+          << " was expired";
+    ++timers_expired;
+    CallHandler(record_ptr, LoopStats::ON_TIME_EXPIRED);
   }
+  ApplyFlagChanges();
 
   if (timer_container_.IsEmpty()) {
     LOGE << "TERMINATION_ERROR: Timer container is empty after time expiration!";
@@ -65,96 +83,283 @@ void Epoll::Process() {
   }
 
   AdvancedTime waiting_time =
-    timer_container_.GetNext().GetExpirationTime() - current_time;
+    timer_container_.GetNextExpirationTime() - current_time;
 
   uint64_t wtime = waiting_time.GetMilliseconds();
   int current_timeout = -1;
-  if (wtime >= kMaximalEpollWaitTimeMs) {
+  if (!scheduled_records_.empty()) {
+    FLOGI << "There are scheduled records. Don't wait";
+    current_timeout = 0;
+  } else if (wtime >= kMaximalEpollWaitTimeMs) {
     FLOGI << "Wait any time!";
   } else {
     FLOGI << "Wait for " << waiting_time.GetMilliseconds() << " milliseconds";
     current_timeout = waiting_time.GetMilliseconds();
   }
+  if (current_timeout != 0 && options_.busy_poll_us != 0 &&
+      GetMonotonicMicroseconds() - last_activity_us_ < options_.busy_poll_us) {
+    // Traffic was seen recently: spin to avoid the wakeup latency. Spinning
+    // stops busy_poll_us after the traffic stops.
+    FLOGI << "Busy poll";
+    current_timeout = 0;
+  }
 
-  int ready = ::epoll_wait(GetFD(), events_,
-                           kEpollEventsNumber, current_timeout);
+  // Leave room in the batch for scheduled records.
+  size_t max_ready = kEpollEventsNumber;
+  if (!scheduled_records_.empty()) {
+    max_ready -= std::min(scheduled_records_.size(), kEpollEventsNumber / 2);
+  }
+  uint64_t wait_start_us = collect_stats ? GetMonotonicMicroseconds() : 0;
+  int ready = poller_->Wait(events_, max_ready, current_timeout);
+  UpdateNow();
+  if (ready < 0) {
+    LOGE << "Error to wait for epoll events";
+    ready = 0;
+  }
+  if (ready > 0 && options_.busy_poll_us != 0) {
+    last_activity_us_ = GetMonotonicMicroseconds();
+  }
+  if (collect_stats) {
+    uint64_t wait_end_us = GetMonotonicMicroseconds();
+    stats_.wait_us.Add(wait_end_us - wait_start_us);
+    stats_.events_per_wait.Add(ready);
+    if (static_cast<size_t>(ready) == max_ready) {
+      ++stats_.full_batches;
+    }
+    stats_.timers_expired.Add(timers_expired);
+    if (ready == 0 && current_timeout > 0) {
+      uint64_t expected_us = wait_start_us + current_timeout * 1000ULL;
+      stats_.wakeup_lag_us.Add(
+          (wait_end_us > expected_us) ? (wait_end_us - expected_us) : (0));
+    }
+  }
 
   FLOGI << "Ready " << ready << " records";
-  for (int i = 0; i < ready; ++i) {
+  size_t events_number = PrepareEvents(ready);
+  for (size_t i = 0; i < events_number; ++i) {
     epoll_event& event = events_[i];
     EpollRecord* record_ptr = static_cast<EpollRecord*>(event.data.ptr);
-    if (deleted_records_.find(record_ptr) != deleted_records_.end()) {
+    if (record_ptr == nullptr) {
       continue;
     }
 
-    if (!record_ptr->ResetDeadline()) {
-      record_ptr->OnError();
-      continue;
-    }
+    record_ptr->ResetDeadline();
 
-    if (event.events & EPOLLIN) {
+    // All ready bits are serviced in one pass: OnIn, then OnOut, then
+    // OnError. Handler can destroy the record (its slot in events_ is reset
+    // then) or change its flags, so both are re-checked before every call.
+    uint32_t events = event.events;
+    bool is_handled = false;
+    bool is_read = false;
+    if ((events & EPOLLIN) && (record_ptr->GetFlags() & EpollRecord::IN)) {
       FLOGI << "OnIn record: " << record_ptr->GetFD();
-      record_ptr->OnIn();
-      continue;
+      CallHandler(record_ptr, LoopStats::ON_IN);
+      is_handled = true;
+      is_read = true;
     }
-    if (event.events & EPOLLOUT) {
+    if ((events & EPOLLOUT) && event.data.ptr != nullptr &&
+        (record_ptr->GetFlags() & EpollRecord::OUT)) {
       FLOGI << "OnOut record: " << record_ptr->GetFD();
-      record_ptr->OnOut();
-      continue;
+      CallHandler(record_ptr, LoopStats::ON_OUT);
+      is_handled = true;
     }
-    if ((event.events & EPOLLERR) || (event.events & EPOLLHUP)) {
+    // Hang up is left to OnIn if it was called: it reads the rest of the
+    // data and sees the end of the stream.
+    if (((events & EPOLLERR) || ((events & EPOLLHUP) && !is_read)) &&
+        event.data.ptr != nullptr) {
       LOGI << "Epoll error or hup for record: " << record_ptr->GetFD();
-      record_ptr->OnError();
+      CallHandler(record_ptr, LoopStats::ON_ERROR);
+      is_handled = true;
+    }
+    if (is_handled || event.data.ptr == nullptr) {
+      continue;
+    }
+    if (events & (EPOLLIN | EPOLLOUT)) {
+      FLOGI << "Record: " << record_ptr->GetFD()
+            << " isn't interested in its events anymore";
       continue;
     }
 
-    LOGE << "Uncatched event: " << event.events
+    LOGE << "Uncatched event: " << events
          << " for record: " << record_ptr->GetFD();
-    record_ptr->OnError();
+    CallHandler(record_ptr, LoopStats::ON_ERROR);
+  }
+  if (collect_stats) {
+    stats_.iteration_us.Add(GetMonotonicMicroseconds() - iteration_start_us);
   }
   FLOGI << "End epoll's processing";
   FLOGI << "###################################";
 }
 
-bool Epoll::SubscribeRecord(EpollRecord* record_ptr) {
-  epoll_event ev;
-  ev.events = record_ptr->GetFlags();
-  ev.data.ptr = static_cast<void*>(record_ptr);
+const Epoll::Options& Epoll::GetOptions() const {
+  return options_;
+}
+
+AdvancedTime Epoll::GetNow() const {
+  return now_;
+}
+
+void Epoll::UpdateNow() {
+  now_ = options_.coarse_clock ? AdvancedTime::CoarseNow()
+                               : AdvancedTime::Now();
+  timer_container_.Advance(now_);
+}
+
+const LoopStats& Epoll::GetStats() const {
+  return stats_;
+}
+
+void Epoll::CallHandler(EpollRecord* record_ptr, LoopStats::Handler handler) {
+  // Record can be destroyed by its handler, so its type is taken in advance.
+  const char* record_type = nullptr;
+  uint64_t start_us = 0;
+  if (options_.collect_stats) {
+    record_type = record_ptr->GetTypeName();
+    start_us = GetMonotonicMicroseconds();
+  }
+  switch (handler) {
+    case (LoopStats::ON_IN):
+      record_ptr->OnIn();
+      break;
+    case (LoopStats::ON_OUT):
+      record_ptr->OnOut();
+      break;
+    case (LoopStats::ON_TIME_EXPIRED):
+      record_ptr->OnTimeExpired();
+      break;
+    default:
+      record_ptr->OnError();
+      break;
+  }
+  if (options_.collect_stats) {
+    stats_.AddHandlerTime(record_type, handler,
+                          GetMonotonicMicroseconds() - start_us);
+  }
+}
+
+uint32_t Epoll::GetModeFlags() const {
+  return options_.edge_triggered ? static_cast<uint32_t>(EpollRecord::EDGE)
+                                 : 0;
+}
+
+void Epoll::ScheduleIn(EpollRecord* record_ptr) {
+  if (record_ptr->scheduled_index_ != EpollRecord::kNotScheduled) {
+    return;
+  }
+  record_ptr->scheduled_index_ = scheduled_records_.size();
+  scheduled_records_.push_back(record_ptr);
+}
+
+size_t Epoll::PrepareEvents(size_t ready) {
+  for (size_t i = 0; i < ready; ++i) {
+    EpollRecord* record_ptr = static_cast<EpollRecord*>(events_[i].data.ptr);
+    record_ptr->generation_ = generation_;
+    record_ptr->event_index_ = i;
+  }
+
+  size_t taken = 0;
+  for (; taken < scheduled_records_.size() && ready < kEpollEventsNumber;
+       ++taken) {
+    EpollRecord* record_ptr = scheduled_records_[taken];
+    if (record_ptr == nullptr) {
+      continue;
+    }
+    record_ptr->scheduled_index_ = EpollRecord::kNotScheduled;
+    if (!(record_ptr->GetFlags() & EpollRecord::IN)) {
+      continue;
+    }
+    if (record_ptr->generation_ == generation_) {
+      events_[record_ptr->event_index_].events |= EPOLLIN;
+      continue;
+    }
+    FLOGI << "Scheduled OnIn record: " << record_ptr->GetFD();
+    events_[ready].events = EPOLLIN;
+    events_[ready].data.ptr = static_cast<void*>(record_ptr);
+    record_ptr->generation_ = generation_;
+    record_ptr->event_index_ = ready;
+    ++ready;
+  }
 
-  if (::epoll_ctl(GetFD(), EPOLL_CTL_ADD, record_ptr->GetFD(), &ev) < 0) {
+  scheduled_records_.erase(scheduled_records_.begin(),
+                           scheduled_records_.begin() + taken);
+  for (size_t i = 0; i < scheduled_records_.size(); ++i) {
+    if (scheduled_records_[i] != nullptr) {
+      scheduled_records_[i]->scheduled_index_ = i;
+    }
+  }
+  return ready;
+}
+
+bool Epoll::SubscribeRecord(EpollRecord* record_ptr) {
+  if (!poller_->Add(record_ptr->GetFD(), record_ptr->GetFlags(),
+                    static_cast<void*>(record_ptr))) {
     LOGE << "Error to subscribe record to epoll. fd: " << record_ptr->GetFD();
     return false;
   }
 
-  in_container_[record_ptr] = timer_container_.Insert(
-                                record_ptr,
-                                record_ptr->GetTimeout(),
-                                record_ptr->GetExpirationTime());
+  record_ptr->timer_it_ = timer_container_.Insert(
+                             record_ptr,
+                             record_ptr->GetTimeout(),
+                             record_ptr->GetExpirationTime());
   FLOGI << "Record: " << record_ptr->GetFD() << " was subscribed";
   return true;
 }
 
-bool Epoll::UpdateRecord(EpollRecord* record_ptr) {
-  epoll_event ev;
-  ev.events = record_ptr->GetFlags();
-  ev.data.ptr = static_cast<void*>(record_ptr);
+void Epoll::MarkDirty(EpollRecord* record_ptr) {
+  if (record_ptr->dirty_index_ != EpollRecord::kNotDirty) {
+    return;
+  }
+  record_ptr->dirty_index_ = dirty_records_.size();
+  dirty_records_.push_back(record_ptr);
+}
 
-  if (::epoll_ctl(GetFD(), EPOLL_CTL_MOD, record_ptr->GetFD(), &ev) < 0) {
-    LOGE << "Error to modify record in epoll. fd: " << record_ptr->GetFD();
-    return false;
+void Epoll::ApplyFlagChanges() {
+  // OnError can destroy records and change flags of others, so the list is
+  // re-read on every step.
+  for (size_t i = 0; i < dirty_records_.size(); ++i) {
+    EpollRecord* record_ptr = dirty_records_[i];
+    if (record_ptr == nullptr) {
+      continue;
+    }
+    dirty_records_[i] = nullptr;
+    record_ptr->dirty_index_ = EpollRecord::kNotDirty;
+    if (record_ptr->GetFlags() == record_ptr->applied_flags_ &&
+        !record_ptr->needs_rearm_) {
+      continue;
+    }
+    record_ptr->needs_rearm_ = false;
+    if (!poller_->Modify(record_ptr->GetFD(), record_ptr->GetFlags(),
+                         static_cast<void*>(record_ptr))) {
+      LOGE << "Error to modify record in epoll. fd: " << record_ptr->GetFD();
+      CallHandler(record_ptr, LoopStats::ON_ERROR);
+      continue;
+    }
+    record_ptr->applied_flags_ = record_ptr->GetFlags();
+    FLOGI << "Record: " << record_ptr->GetFD() << " was updated";
   }
+  dirty_records_.clear();
+}
 
-  in_container_[record_ptr] = timer_container_.Update(
-                                                  in_container_[record_ptr]);
-  FLOGI << "Record: " << record_ptr->GetFD() << " was updated";
-  return true;
+void Epoll::RearmTimer(EpollRecord* record_ptr) {
+  timer_container_.Erase(record_ptr->timer_it_);
+  record_ptr->timer_it_ = timer_container_.Insert(
+                             record_ptr,
+                             record_ptr->GetTimeout(),
+                             record_ptr->GetExpirationTime());
 }
 
 bool Epoll::UnsubscribeRecord(EpollRecord* record_ptr) {
-  timer_container_.Erase(in_container_[record_ptr]);
-  in_container_.erase(record_ptr);
-  deleted_records_.insert(record_ptr);
-  if (::epoll_ctl(GetFD(), EPOLL_CTL_DEL, record_ptr->GetFD(), NULL) < 0) {
+  timer_container_.Erase(record_ptr->timer_it_);
+  if (record_ptr->generation_ == generation_) {
+    events_[record_ptr->event_index_].data.ptr = nullptr;
+  }
+  if (record_ptr->scheduled_index_ != EpollRecord::kNotScheduled) {
+    scheduled_records_[record_ptr->scheduled_index_] = nullptr;
+  }
+  if (record_ptr->dirty_index_ != EpollRecord::kNotDirty) {
+    dirty_records_[record_ptr->dirty_index_] = nullptr;
+  }
+  if (!poller_->Remove(record_ptr->GetFD())) {
     LOGE << "Error to delete record from epoll. fd: " << record_ptr->GetFD();
     return false;
   }
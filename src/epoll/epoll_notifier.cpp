@@ -2,7 +2,9 @@
 
 #include <functional>
 
-#include <sys/timerfd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "advanced_time.h"
 #include "logger.h"
@@ -12,14 +14,14 @@ namespace epoll {
 
 const size_t kAttemptsToCreateEpollNotifier = 5;
 
-int CreateTimerFD() {
+int CreateEventFD() {
   for (size_t i = 0; i < kAttemptsToCreateEpollNotifier; ++i) {
-    int timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (timer_fd < 0) {
+    int event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
       LOGE << "Error to create EpollNotifier fd; Attempt: " << i + 1;
       continue;
     }
-    return timer_fd;
+    return event_fd;
   }
   LOGE << "Error to create EpollNotifier";
   throw TerminalError();
@@ -27,7 +29,7 @@ int CreateTimerFD() {
 
 EpollNotifier::EpollNotifier(std::shared_ptr<Epoll> epoll_ptr,
                              const Func& on_in_handler) :
-      EpollRecord(CreateTimerFD(),
+      EpollRecord(CreateEventFD(),
                   epoll_ptr,
                   EpollRecord::IN,
                   base::AdvancedTime::Infinity()),
@@ -40,23 +42,27 @@ EpollNotifier::~EpollNotifier() {
 }
 
 void EpollNotifier::Notify() {
-  ::itimerspec exp;
-  exp.it_interval.tv_sec = 0;
-  exp.it_interval.tv_nsec = 0;
-  exp.it_value.tv_sec = 0;
-  exp.it_value.tv_nsec = 100;
-  if (::timerfd_settime(GetFD(), 0, &exp, NULL) < 0) {
-    LOGE << "Error to set time for EpollNotifier; fd: " << GetFD();
+  uint64_t value = 1;
+  ssize_t written = 0;
+  do {
+    written = ::write(GetFD(), &value, sizeof(value));
+  } while (written < 0 && errno == EINTR);
+  // EAGAIN means that the counter is saturated, so the loop is woken anyway.
+  if (written < 0 && errno != EAGAIN) {
+    LOGE << "Error to notify EpollNotifier; fd: " << GetFD();
     throw TerminalError();
   }
-  FLOGI << "Time for EpollNotifier was set; fd: " << GetFD();
+  FLOGI << "EpollNotifier was notified; fd: " << GetFD();
 }
 
 void EpollNotifier::OnIn() {
-  std::string times = IOFileDescriptor::Read();
-  uint64_t* times_ptr = (uint64_t*)((void*) times.c_str());
-  FLOGI << "EpollNotifier was triggered " << *times_ptr << " times; fd: "
-        << GetFD();
+  uint64_t times = 0;
+  if (::read(GetFD(), &times, sizeof(times)) < 0) {
+    FLOGI << "EpollNotifier was triggered spuriously; fd: " << GetFD();
+  } else {
+    FLOGI << "EpollNotifier was triggered " << times << " times; fd: "
+          << GetFD();
+  }
   on_in_handler_();
 }
 
@@ -78,4 +84,8 @@ void EpollNotifier::OnError() {
   throw TerminalError();
 }
 
+const char* EpollNotifier::GetTypeName() const {
+  return "EpollNotifier";
+}
+
 }  // namespace epoll
@@ -9,6 +9,8 @@
 
 namespace epoll {
 
+// Wakes up the loop from any thread; backed by eventfd, so notifications
+// which come before the loop handles them are merged into one.
 class EpollNotifier : public EpollRecord {
  private:
   typedef std::function<void(void)> Func;
@@ -23,7 +25,9 @@ class EpollNotifier : public EpollRecord {
   void OnOut() override;
   void OnTimeExpired() override;
   void OnError() override;
+  const char* GetTypeName() const override;
 
+  // Thread-safe.
   void Notify();
 
  private:
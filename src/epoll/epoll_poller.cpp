@@ -0,0 +1,65 @@
+#include "epoll_poller.h"
+
+#include <sys/epoll.h>
+
+#include "logger.h"
+#include "net_utils.h"
+
+namespace epoll {
+
+EpollPoller::EpollPoller() : FileDescriptor(net_utils::CreateEpollFD()) {}
+
+EpollPoller::~EpollPoller() {}
+
+bool EpollPoller::Add(int fd, uint32_t flags, void* data) {
+  epoll_event ev;
+  ev.events = flags;
+  ev.data.ptr = data;
+  return ::epoll_ctl(GetFD(), EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EpollPoller::Modify(int fd, uint32_t flags, void* data) {
+  epoll_event ev;
+  ev.events = flags;
+  ev.data.ptr = data;
+  return ::epoll_ctl(GetFD(), EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool EpollPoller::Remove(int fd) {
+  return ::epoll_ctl(GetFD(), EPOLL_CTL_DEL, fd, NULL) == 0;
+}
+
+int EpollPoller::Wait(epoll_event* events, size_t max_events, int timeout_ms) {
+  return ::epoll_wait(GetFD(), events, max_events, timeout_ms);
+}
+
+bool EpollPoller::StartReceiving(int) {
+  return false;
+}
+
+bool EpollPoller::TakeReceived(int, base::ReceiveBuffer*, size_t,
+                               base::IOFileDescriptor::ReadResult*) {
+  return false;
+}
+
+bool EpollPoller::HasReceived(int) const {
+  return false;
+}
+
+bool EpollPoller::StartAccepting(int) {
+  return false;
+}
+
+bool EpollPoller::TakeAccepted(int, int*) {
+  return false;
+}
+
+int EpollPoller::GetFD() const {
+  return FileDescriptor::GetFD();
+}
+
+const char* EpollPoller::GetName() const {
+  return "epoll";
+}
+
+}  // namespace epoll
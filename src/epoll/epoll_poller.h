@@ -0,0 +1,37 @@
+#ifndef EPOLL_EPOLL_POLLER_H_
+#define EPOLL_EPOLL_POLLER_H_
+
+#include "file_descriptor.h"
+#include "macros.h"
+#include "poller.h"
+
+namespace epoll {
+
+class EpollPoller : public Poller, public base::FileDescriptor {
+ public:
+  EpollPoller();
+  ~EpollPoller() override;
+
+  bool Add(int fd, uint32_t flags, void* data) override;
+  bool Modify(int fd, uint32_t flags, void* data) override;
+  bool Remove(int fd) override;
+  int Wait(epoll_event* events, size_t max_events, int timeout_ms) override;
+
+  // Readiness only: records read and accept themselves.
+  bool StartReceiving(int fd) override;
+  bool TakeReceived(int fd, base::ReceiveBuffer* data, size_t budget,
+                    base::IOFileDescriptor::ReadResult* result) override;
+  bool HasReceived(int fd) const override;
+  bool StartAccepting(int fd) override;
+  bool TakeAccepted(int fd, int* client_fd) override;
+
+  int GetFD() const override;
+  const char* GetName() const override;
+
+ private:
+  PROHIBIT_COPY_AND_COPY_ASSIGN(EpollPoller);
+};
+
+}  // namespace epoll
+
+#endif  // EPOLL_EPOLL_POLLER_H_
@@ -1,9 +1,16 @@
 #include "epoll_record.h"
 
 #include "logger.h"
+#include "net_utils.h"
 
 namespace epoll {
 
+namespace {
+
+const size_t kEdgeTriggeredReadBudget = 64 * 1024;
+
+}  // namespace
+
 using base::AdvancedTime;
 using base::IOFileDescriptor;
 
@@ -13,10 +20,22 @@ EpollRecord::EpollRecord(int fd,
                          AdvancedTime timeout,
                          AdvancedTime delay) :
     IOFileDescriptor(fd),
+    generation_(0),
+    event_index_(0),
+    scheduled_index_(kNotScheduled),
+    dirty_index_(kNotDirty),
+    applied_flags_(flags),
+    needs_rearm_(false),
     timeout_(timeout),
-    expiration_time_(AdvancedTime::Now() + delay + timeout),
+    expiration_time_(epoll_ptr->GetNow() + delay + timeout),
     flags_(flags),
+    is_receiving_ahead_(false),
+    is_accepting_ahead_(false),
     epoll_ptr_(epoll_ptr) {
+  if ((flags_ & EDGE) && !net_utils::MakeNonblocking(fd)) {
+    LOGE << "Error to make edge-triggered record nonblocking: " << fd;
+    throw std::runtime_error("Can't create epoll record");
+  }
   if (!epoll_ptr_->SubscribeRecord(this)) {
     LOGE << "Error to subscribe record: " << fd;
     throw std::runtime_error("Can't create epoll record");
@@ -44,12 +63,17 @@ AdvancedTime EpollRecord::GetExpirationTime() const {
 }
 
 bool EpollRecord::SetFlags(uint32_t new_flags) {
+  // For edge-triggered record epoll_ctl also re-checks readiness and can
+  // produce new edge, so adding a flag has to reach epoll even if the flag
+  // was removed earlier in the same iteration.
+  if (IsEdgeTriggered() && (new_flags & ~flags_) != 0) {
+    needs_rearm_ = true;
+  }
   flags_ = new_flags;
-  bool ret = epoll_ptr_->UpdateRecord(this);
-  if (!ret) {
-    LOGE << "Error to set flags for record: " << GetFD();
+  if (flags_ != applied_flags_ || needs_rearm_) {
+    epoll_ptr_->MarkDirty(this);
   }
-  return ret;
+  return true;
 }
 
 bool EpollRecord::AddFlag(uint32_t flag) {
@@ -65,13 +89,94 @@ bool EpollRecord::RemoveFlag(uint32_t flag) {
   return SetFlags(flags);
 }
 
-bool EpollRecord::ResetDeadline() {
-  expiration_time_ = AdvancedTime::Now() + timeout_;
-  bool ret = epoll_ptr_->UpdateRecord(this);
-  if (!ret) {
-    LOGE << "Error to reset deadline for record: " << GetFD();
+bool EpollRecord::IsEdgeTriggered() const {
+  return (flags_ & EDGE) != 0;
+}
+
+bool EpollRecord::SwitchToEdgeTriggered() {
+  return SetFlags(flags_ | IN | EDGE);
+}
+
+void EpollRecord::ScheduleIn() {
+  epoll_ptr_->ScheduleIn(this);
+}
+
+bool EpollRecord::ReadInput(base::ReceiveBuffer* data, size_t limit) {
+  size_t budget = (limit < kEdgeTriggeredReadBudget) ?
+                   (limit) : (kEdgeTriggeredReadBudget);
+  ReadResult result;
+  // Level-triggered record is woken up by the backend while received input
+  // is left.
+  if (is_receiving_ahead_ &&
+      epoll_ptr_->poller_->TakeReceived(GetFD(), data, budget, &result)) {
+    return OnDrained(result, budget);
+  }
+  if (!IsEdgeTriggered()) {
+    return IOFileDescriptor::Read(data, limit);
   }
-  return ret;
+  return OnDrained(IOFileDescriptor::Drain(data, budget), budget);
+}
+
+bool EpollRecord::WriteOutput() {
+  if (!IsEdgeTriggered()) {
+    return IOFileDescriptor::Write();
+  }
+  return IOFileDescriptor::Flush();
+}
+
+void EpollRecord::ReceiveAhead() {
+  is_receiving_ahead_ = epoll_ptr_->poller_->StartReceiving(GetFD());
+}
+
+bool EpollRecord::HasReceivedInput() const {
+  return is_receiving_ahead_ && epoll_ptr_->poller_->HasReceived(GetFD());
+}
+
+void EpollRecord::AcceptAhead() {
+  is_accepting_ahead_ = epoll_ptr_->poller_->StartAccepting(GetFD());
+}
+
+int EpollRecord::Accept() {
+  int client_fd = -1;
+  if (is_accepting_ahead_ &&
+      epoll_ptr_->poller_->TakeAccepted(GetFD(), &client_fd)) {
+    return client_fd;
+  }
+  return net_utils::AcceptNonblocking(GetFD());
+}
+
+bool EpollRecord::OnDrained(ReadResult result, size_t budget) {
+  switch (result) {
+    case (IOFileDescriptor::ReadResult::WOULD_BLOCK):
+      return true;
+
+    case (IOFileDescriptor::ReadResult::BUDGET_EXHAUSTED):
+      if (IsEdgeTriggered() && budget == kEdgeTriggeredReadBudget) {
+        FLOGI << "Read budget is exhausted for record: " << GetFD();
+        ScheduleIn();
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void EpollRecord::ResetDeadline() {
+  AdvancedTime expiration_time = epoll_ptr_->GetNow() + timeout_;
+  if (expiration_time > expiration_time_) {
+    expiration_time_ = expiration_time;
+  }
+}
+
+void EpollRecord::SetTimeout(AdvancedTime timeout) {
+  timeout_ = timeout;
+  expiration_time_ = epoll_ptr_->GetNow() + timeout;
+  epoll_ptr_->RearmTimer(this);
+}
+
+const char* EpollRecord::GetTypeName() const {
+  return "EpollRecord";
 }
 
 std::shared_ptr<Epoll> EpollRecord::GetEpollPtr() const {
@@ -1,11 +1,15 @@
 #ifndef EPOLL_EPOLL_RECORD_H_
 #define EPOLL_EPOLL_RECORD_H_
 
+#include <stdint.h>
+
 #include <memory>
+#include <string>
 
 #include "advanced_time.h"
 #include "epoll.h"
 #include "file_descriptor.h"
+#include "timer_container.h"
 
 namespace epoll {
 
@@ -14,6 +18,7 @@ class EpollRecord : public base::IOFileDescriptor {
   enum Flags {
     IN = EPOLLIN,
     OUT = EPOLLOUT,
+    EDGE = EPOLLET,
   };
 
   EpollRecord(int fd_,
@@ -29,23 +34,87 @@ class EpollRecord : public base::IOFileDescriptor {
   base::AdvancedTime GetTimeout() const;
   base::AdvancedTime GetExpirationTime() const;
 
-  bool ResetDeadline();
+  // Only moves the deadline later and doesn't touch epoll: timer is
+  // re-checked when it pops.
+  void ResetDeadline();
+  // Replaces the timeout and restarts the deadline from now.
+  void SetTimeout(base::AdvancedTime timeout);
+  // Flags are applied to epoll once per iteration, right before waiting, so
+  // several changes within an iteration cost at most one epoll_ctl. Failure
+  // to apply them is reported through OnError.
   bool SetFlags(uint32_t new_flags);
 
   bool AddFlag(uint32_t flag);
   bool RemoveFlag(uint32_t flag);
 
+  bool IsEdgeTriggered() const;
+  // Hang-up is reported on every wait whatever the flags are, so a
+  // level-triggered record which postpones reading the rest of the input or
+  // has already read it would spin. Such record is switched to
+  // edge-triggered mode and resumes reading through ScheduleIn.
+  bool SwitchToEdgeTriggered();
+  // Calls OnIn on the next iteration without waiting for the descriptor.
+  void ScheduleIn();
+
+  // Reads input which is available for the record. In edge-triggered mode
+  // descriptor is drained until EAGAIN within per-wakeup budget; if budget
+  // is spent, OnIn will be called again on the next iteration. If limit is
+  // reached instead, the caller has to call ScheduleIn when it is ready for
+  // more data.
+  // Data is read into a buffer borrowed from the thread's pool, which is
+  // returned when data is destroyed; read size adapts to the traffic.
+  // Returns false if connection was closed or broken (some data still can be
+  // read before that).
+  bool ReadInput(base::ReceiveBuffer* data, size_t limit = SIZE_MAX);
+  // Writes buffered output. In edge-triggered mode writes until EAGAIN.
+  bool WriteOutput();
+
+  // Lets the loop's backend receive input of the stream socket ahead of
+  // ReadInput if it can (io_uring). Descriptor mustn't be read other than by
+  // ReadInput then.
+  void ReceiveAhead();
+  // Input or its end was received ahead and isn't read yet.
+  bool HasReceivedInput() const;
+  // Lets the backend accept connections of the listening socket ahead.
+  void AcceptAhead();
+  // Returns nonblocking descriptor of a new connection or -1 with errno.
+  int Accept();
+
   virtual void OnIn() = 0;
   virtual void OnOut() = 0;
   virtual void OnTimeExpired() = 0;
   virtual void OnError() = 0;
+  // Groups records in loop statistics; has to return a string literal.
+  virtual const char* GetTypeName() const;
 
   std::shared_ptr<Epoll> GetEpollPtr() const;
 
  private:
+  // Bookkeeping of Epoll, kept in the record to avoid lookups.
+  friend class Epoll;
+
+  static const size_t kNotScheduled = SIZE_MAX;
+  static const size_t kNotDirty = SIZE_MAX;
+
+  // Maps result of draining to the one of ReadInput.
+  bool OnDrained(ReadResult result, size_t budget);
+
+  base::TimerContainer<EpollRecord*>::Iterator timer_it_;
+  // Iteration of Epoll in which record was ready and its index in the batch.
+  uint64_t generation_;
+  size_t event_index_;
+  size_t scheduled_index_;
+  // Position in Epoll's list of records with not yet applied flags.
+  size_t dirty_index_;
+  // Flags which epoll currently has for the record.
+  uint32_t applied_flags_;
+  bool needs_rearm_;
+
   base::AdvancedTime timeout_;
   base::AdvancedTime expiration_time_;
   uint32_t flags_;
+  bool is_receiving_ahead_;
+  bool is_accepting_ahead_;
   std::shared_ptr<Epoll> epoll_ptr_;
 };
 
@@ -0,0 +1,109 @@
+#include "loop_stats.h"
+
+#include <time.h>
+
+#include <sstream>
+
+#include "logger.h"
+
+namespace epoll {
+
+namespace {
+
+const char* const kHandlerNames[LoopStats::HANDLERS_NUMBER] = {
+  "OnIn", "OnOut", "OnTimeExpired", "OnError"
+};
+
+}  // namespace
+
+uint64_t GetMonotonicMicroseconds() {
+  ::timespec ts;
+  if (::clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+    LOGE << "Error to get monotonic time";
+    return 0;
+  }
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+Histogram::Histogram() : count_(0), sum_(0), max_(0) {
+  for (size_t i = 0; i < kBuckets; ++i) {
+    buckets_[i] = 0;
+  }
+}
+
+void Histogram::Add(uint64_t value) {
+  size_t bucket = (value == 0) ? (0) : (64 - __builtin_clzll(value));
+  ++buckets_[bucket];
+  ++count_;
+  sum_ += value;
+  if (value > max_) {
+    max_ = value;
+  }
+}
+
+uint64_t Histogram::GetCount() const {
+  return count_;
+}
+
+uint64_t Histogram::GetSum() const {
+  return sum_;
+}
+
+uint64_t Histogram::GetMax() const {
+  return max_;
+}
+
+uint64_t Histogram::GetPercentile(double quantile) const {
+  uint64_t rank = static_cast<uint64_t>(quantile * count_);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen > rank) {
+      uint64_t upper_bound = (i == 0) ? (0) : ((~0ULL) >> (64 - i));
+      return (upper_bound < max_) ? (upper_bound) : (max_);
+    }
+  }
+  return max_;
+}
+
+std::string Histogram::ToString() const {
+  std::stringstream stream;
+  stream << "count: " << count_;
+  if (count_ != 0) {
+    stream << " avg: " << sum_ / count_
+           << " p50: " << GetPercentile(0.5)
+           << " p99: " << GetPercentile(0.99)
+           << " max: " << max_;
+  }
+  return stream.str();
+}
+
+LoopStats::LoopStats() : full_batches(0) {}
+
+void LoopStats::AddHandlerTime(const char* record_type, Handler handler,
+                               uint64_t microseconds) {
+  handlers[record_type].durations_us[handler].Add(microseconds);
+}
+
+std::string LoopStats::ToString() const {
+  std::stringstream stream;
+  stream << "iteration_us: {" << iteration_us.ToString() << "}\n"
+         << "wait_us: {" << wait_us.ToString() << "}\n"
+         << "events_per_wait: {" << events_per_wait.ToString()
+         << "} full_batches: " << full_batches << "\n"
+         << "timers_expired: {" << timers_expired.ToString() << "}\n"
+         << "wakeup_lag_us: {" << wakeup_lag_us.ToString() << "}";
+  for (const auto& record_type : handlers) {
+    for (size_t i = 0; i < HANDLERS_NUMBER; ++i) {
+      const Histogram& durations = record_type.second.durations_us[i];
+      if (durations.GetCount() == 0) {
+        continue;
+      }
+      stream << "\n" << record_type.first << "::" << kHandlerNames[i]
+             << "_us: {" << durations.ToString() << "}";
+    }
+  }
+  return stream.str();
+}
+
+}  // namespace epoll
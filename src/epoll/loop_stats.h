@@ -0,0 +1,75 @@
+#ifndef EPOLL_LOOP_STATS_H_
+#define EPOLL_LOOP_STATS_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
+namespace epoll {
+
+// Monotonic time in microseconds; AdvancedTime is too coarse for handlers.
+uint64_t GetMonotonicMicroseconds();
+
+// Histogram with power of two buckets: bucket i counts values which have
+// i significant bits, so adding a value is a couple of instructions.
+class Histogram {
+ public:
+  static const size_t kBuckets = 65;
+
+  Histogram();
+
+  void Add(uint64_t value);
+
+  uint64_t GetCount() const;
+  uint64_t GetSum() const;
+  uint64_t GetMax() const;
+  // Upper bound of the bucket which contains the given quantile.
+  uint64_t GetPercentile(double quantile) const;
+
+  std::string ToString() const;
+
+ private:
+  uint64_t buckets_[kBuckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+struct LoopStats {
+  enum Handler {
+    ON_IN,
+    ON_OUT,
+    ON_TIME_EXPIRED,
+    ON_ERROR,
+    HANDLERS_NUMBER
+  };
+
+  struct HandlerStats {
+    Histogram durations_us[HANDLERS_NUMBER];
+  };
+
+  LoopStats();
+
+  void AddHandlerTime(const char* record_type, Handler handler,
+                      uint64_t microseconds);
+
+  std::string ToString() const;
+
+  Histogram iteration_us;
+  // Time spent blocked in the wait itself.
+  Histogram wait_us;
+  Histogram events_per_wait;
+  // Waits which filled all the available event slots.
+  uint64_t full_batches;
+  Histogram timers_expired;
+  // How much later than requested the loop woke up after a timed out wait.
+  Histogram wakeup_lag_us;
+  // Handler durations by record type. Keys are records' type names, which
+  // are string literals, so they are compared by address.
+  std::unordered_map<const char*, HandlerStats> handlers;
+};
+
+}  // namespace epoll
+
+#endif  // EPOLL_LOOP_STATS_H_
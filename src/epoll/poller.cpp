@@ -0,0 +1,24 @@
+#include "poller.h"
+
+#include "epoll_poller.h"
+#include "logger.h"
+#include "uring_poller.h"
+
+namespace epoll {
+
+std::unique_ptr<Poller> CreatePoller(bool use_io_uring) {
+  if (use_io_uring) {
+    std::unique_ptr<Poller> poller = UringPoller::Create();
+    if (poller) {
+      return poller;
+    }
+    LOGW << "io_uring is unavailable. Fall back to epoll";
+  }
+  std::unique_ptr<EpollPoller> poller(new EpollPoller());
+  if (!poller->IsValid()) {
+    return nullptr;
+  }
+  return poller;
+}
+
+}  // namespace epoll
@@ -0,0 +1,55 @@
+#ifndef EPOLL_POLLER_H_
+#define EPOLL_POLLER_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include <memory>
+
+#include "file_descriptor.h"
+#include "receive_buffer.h"
+
+namespace epoll {
+
+// Readiness notification backend of Epoll. Interest flags and reported events
+// use epoll's bit values; data is reported back as epoll_event::data.ptr.
+class Poller {
+ public:
+  virtual ~Poller() {}
+
+  virtual bool Add(int fd, uint32_t flags, void* data) = 0;
+  virtual bool Modify(int fd, uint32_t flags, void* data) = 0;
+  virtual bool Remove(int fd) = 0;
+  // Returns number of filled events (negative on error); timeout_ms < 0 means
+  // waiting without time limit.
+  virtual int Wait(epoll_event* events, size_t max_events, int timeout_ms) = 0;
+
+  // Completion-based backend can receive input of a stream socket ahead of
+  // its record, into buffers of its own, while EPOLLIN is in the flags. It's
+  // reported as EPOLLIN and taken through TakeReceived; descriptor mustn't be
+  // read in other ways then. Returns false if backend can't do it.
+  virtual bool StartReceiving(int fd) = 0;
+  // Moves no more than budget bytes of input received ahead to data; result
+  // tells whether more input may come. Returns false if nothing is received
+  // ahead, so descriptor has to be read directly.
+  virtual bool TakeReceived(int fd, base::ReceiveBuffer* data, size_t budget,
+                            base::IOFileDescriptor::ReadResult* result) = 0;
+  // Input or its end was received ahead and isn't taken yet.
+  virtual bool HasReceived(int fd) const = 0;
+  // Connections of a listening socket are accepted ahead the same way.
+  virtual bool StartAccepting(int fd) = 0;
+  // Returns false if nothing is accepted ahead, so descriptor has to be
+  // accepted from directly; client_fd is -1 if no connection is ready yet.
+  virtual bool TakeAccepted(int fd, int* client_fd) = 0;
+
+  virtual int GetFD() const = 0;
+  virtual const char* GetName() const = 0;
+};
+
+// Creates io_uring based poller if it's requested and supported by the kernel,
+// epoll based one otherwise. Returns nullptr if neither can be created.
+std::unique_ptr<Poller> CreatePoller(bool use_io_uring);
+
+}  // namespace epoll
+
+#endif  // EPOLL_POLLER_H_
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/signalfd.h>
+#include <unistd.h>
 
 #include "advanced_time.h"
 #include "epoll.h"
@@ -28,6 +29,10 @@ int GetSignalFD() {
     LOGE << "Unable to add SIGINT to mask";
     return -1;
   }
+  if (::sigaddset(&mask, SIGUSR1)) {
+    LOGE << "Unable to add SIGUSR1 to mask";
+    return -1;
+  }
   if (::sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
     LOGE << "Unable to process signal mask";
     return -1;
@@ -43,11 +48,13 @@ int GetSignalFD() {
 
 }
 
-SignalHandler::SignalHandler(std::shared_ptr<Epoll> epoll_ptr) :
+SignalHandler::SignalHandler(std::shared_ptr<Epoll> epoll_ptr,
+                             const Func& on_user_signal) :
     EpollRecord(GetSignalFD(),
                 epoll_ptr,
                 EpollRecord::IN,
-                base::AdvancedTime::Infinity()) {
+                base::AdvancedTime::Infinity()),
+    on_user_signal_(on_user_signal) {
   LOGI << "Signal Handler was created; fd: " << GetFD();
 }
 
@@ -56,8 +63,17 @@ SignalHandler::~SignalHandler() {
 }
 
 void SignalHandler::OnIn() {
-  LOGI << "Signal Handler catch termination signal";
-  Disconnect();
+  signalfd_siginfo info;
+  while (::read(GetFD(), &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo != SIGUSR1) {
+      LOGI << "Signal Handler catch termination signal";
+      Disconnect();
+    }
+    LOGI << "Signal Handler catch SIGUSR1";
+    if (on_user_signal_) {
+      on_user_signal_();
+    }
+  }
 }
 
 void SignalHandler::OnOut() {
@@ -77,6 +93,10 @@ void SignalHandler::OnError() {
   Disconnect();
 }
 
+const char* SignalHandler::GetTypeName() const {
+  return "SignalHandler";
+}
+
 void SignalHandler::Disconnect() {
   throw TerminalError();
 }
@@ -1,6 +1,7 @@
 #ifndef EPOLL_SIGNAL_HANDLER_H_
 #define EPOLL_SIGNAL_HANDLER_H_
 
+#include <functional>
 #include <memory>
 
 #include "epoll_record.h"
@@ -9,17 +10,27 @@ namespace epoll {
 
 class Epoll;
 
+// Terminates the loop on SIGTERM and SIGINT; calls the given handler on
+// SIGUSR1.
 class SignalHandler : public EpollRecord {
+ private:
+  typedef std::function<void(void)> Func;
+
  public:
-  SignalHandler(std::shared_ptr<Epoll> epoll_ptr);
+  SignalHandler(std::shared_ptr<Epoll> epoll_ptr,
+                const Func& on_user_signal = nullptr);
   ~SignalHandler() override;
 
   void OnIn() override;
   void OnOut() override;
   void OnTimeExpired() override;
   void OnError() override;
+  const char* GetTypeName() const override;
 
   void Disconnect();
+
+ private:
+  Func on_user_signal_;
 };
 
 }  // namespace epoll
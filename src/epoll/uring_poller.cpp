@@ -0,0 +1,765 @@
+#include "uring_poller.h"
+
+#include <errno.h>
+#include <linux/time_types.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "logger.h"
+
+namespace epoll {
+
+namespace {
+
+const unsigned kSubmissionQueueEntries = 4096;
+const unsigned kCompletionQueueEntries = 16384;
+// Completions of requests whose result doesn't matter (poll removals and
+// cancellations).
+const uint64_t kIgnoredUserData = ~0ULL;
+const uint32_t kPollMask = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP;
+const uint32_t kInterestMask = kPollMask | EPOLLET;
+// Provided buffers for reading ahead; their number has to be a power of 2.
+const unsigned kReceiveBuffers = 512;
+const size_t kReceiveBufferSize = 16 * 1024;
+const uint16_t kBufferGroup = 0;
+// Reading ahead of a descriptor pauses when this much input isn't taken.
+const size_t kMaxReceivedSize = 64 * 1024;
+const uint64_t kKindShift = 62;
+const uint64_t kFdMask = (1ULL << 30) - 1;
+
+int SetupRing(unsigned entries, io_uring_params* params) {
+  return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+int RegisterRing(int fd, unsigned opcode, void* arg, unsigned arg_count) {
+  return ::syscall(__NR_io_uring_register, fd, opcode, arg, arg_count);
+}
+
+int EnterRing(int fd, unsigned to_submit, unsigned min_complete,
+              unsigned flags, const void* arg, size_t arg_size) {
+  return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, arg_size);
+}
+
+unsigned* RingField(void* ring_ptr, uint32_t offset) {
+  return reinterpret_cast<unsigned*>(static_cast<char*>(ring_ptr) + offset);
+}
+
+}  // namespace
+
+std::unique_ptr<UringPoller> UringPoller::Create() {
+  std::unique_ptr<UringPoller> poller(new UringPoller());
+  if (!poller->Setup()) {
+    return nullptr;
+  }
+  return poller;
+}
+
+UringPoller::UringPoller() :
+    ring_ptr_(MAP_FAILED),
+    ring_size_(0),
+    sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+    sqes_size_(0),
+    sq_head_(nullptr),
+    sq_tail_(nullptr),
+    sq_mask_(0),
+    sq_entries_(0),
+    cq_head_(nullptr),
+    cq_tail_(nullptr),
+    cq_mask_(0),
+    cqes_(nullptr),
+    to_submit_(0),
+    buffer_ring_(nullptr),
+    buffer_ring_size_(0),
+    free_buffers_(0),
+    is_accept_supported_(true),
+    batch_(0) {}
+
+UringPoller::~UringPoller() {
+  for (Registration& registration : registrations_) {
+    ClearAhead(&registration);
+  }
+  if (buffer_ring_ != nullptr) {
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = kBufferGroup;
+    RegisterRing(ring_fd_.GetFD(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    ::munmap(buffer_ring_, buffer_ring_size_);
+  }
+  if (sqes_ != MAP_FAILED) {
+    ::munmap(sqes_, sqes_size_);
+  }
+  if (ring_ptr_ != MAP_FAILED) {
+    ::munmap(ring_ptr_, ring_size_);
+  }
+}
+
+bool UringPoller::Setup() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = kCompletionQueueEntries;
+  ring_fd_ = base::FileDescriptor(SetupRing(kSubmissionQueueEntries, &params));
+  if (!ring_fd_.IsValid()) {
+    LOGE << "Error to set up io_uring: " << strerror(errno);
+    return false;
+  }
+
+  uint32_t required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                               IORING_FEAT_EXT_ARG;
+  if ((params.features & required_features) != required_features) {
+    LOGE << "io_uring doesn't support required features: "
+         << params.features;
+    return false;
+  }
+
+  size_t sq_ring_size = params.sq_off.array +
+                        params.sq_entries * sizeof(unsigned);
+  size_t cq_ring_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(io_uring_cqe);
+  ring_size_ = (sq_ring_size > cq_ring_size) ? sq_ring_size : cq_ring_size;
+  ring_ptr_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_.GetFD(),
+                     IORING_OFF_SQ_RING);
+  if (ring_ptr_ == MAP_FAILED) {
+    LOGE << "Error to map io_uring's rings: " << strerror(errno);
+    return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(
+      ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_.GetFD(), IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    LOGE << "Error to map io_uring's submission entries: " << strerror(errno);
+    return false;
+  }
+
+  sq_head_ = RingField(ring_ptr_, params.sq_off.head);
+  sq_tail_ = RingField(ring_ptr_, params.sq_off.tail);
+  sq_mask_ = *RingField(ring_ptr_, params.sq_off.ring_mask);
+  sq_entries_ = *RingField(ring_ptr_, params.sq_off.ring_entries);
+  // Submission entries are always used in ring's order.
+  unsigned* sq_array = RingField(ring_ptr_, params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; ++i) {
+    sq_array[i] = i;
+  }
+  cq_head_ = RingField(ring_ptr_, params.cq_off.head);
+  cq_tail_ = RingField(ring_ptr_, params.cq_off.tail);
+  cq_mask_ = *RingField(ring_ptr_, params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(
+      static_cast<char*>(ring_ptr_) + params.cq_off.cqes);
+
+  LOGI << "io_uring was set up; fd: " << ring_fd_.GetFD()
+       << " sq_entries: " << sq_entries_
+       << " cq_entries: " << params.cq_entries;
+  if (SetupBufferRing()) {
+    LOGI << "io_uring reads ahead into " << kReceiveBuffers << " buffers of "
+         << kReceiveBufferSize << " bytes";
+  }
+  return true;
+}
+
+bool UringPoller::SetupBufferRing() {
+  size_t size = kReceiveBuffers * sizeof(io_uring_buf);
+  void* ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ring == MAP_FAILED) {
+    LOGE << "Error to map io_uring's buffer ring: " << strerror(errno);
+    return false;
+  }
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = kReceiveBuffers;
+  reg.bgid = kBufferGroup;
+  if (RegisterRing(ring_fd_.GetFD(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    LOGW << "io_uring doesn't support buffer rings, so it won't read ahead: "
+         << strerror(errno);
+    ::munmap(ring, size);
+    return false;
+  }
+  buffer_ring_ = static_cast<io_uring_buf_ring*>(ring);
+  buffer_ring_size_ = size;
+  buffers_.reset(new char[kReceiveBuffers * kReceiveBufferSize]);
+  for (unsigned i = 0; i < kReceiveBuffers; ++i) {
+    RecycleBuffer(i);
+  }
+  return true;
+}
+
+bool UringPoller::Add(int fd, uint32_t flags, void* data) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || registration->is_registered) {
+    return false;
+  }
+  registration->data = data;
+  registration->flags = flags;
+  registration->is_registered = true;
+  ++registration->generation;
+  ScheduleArm(fd, registration);
+  return true;
+}
+
+bool UringPoller::Modify(int fd, uint32_t flags, void* data) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered) {
+    return false;
+  }
+  registration->data = data;
+  uint32_t old_flags = registration->flags;
+  registration->flags = flags;
+  // Input which was read ahead is reported again, like readiness which
+  // EPOLL_CTL_MOD re-checks.
+  if ((flags & EPOLLIN) &&
+      (registration->is_receiving || registration->is_accepting)) {
+    if (IsAheadReady(*registration)) {
+      SchedulePendingEvent(fd, registration);
+    }
+    ScheduleArm(fd, registration);
+  }
+  // Like EPOLL_CTL_MOD, modification of edge-triggered registration re-checks
+  // readiness: new multishot poll reports current state on arming.
+  if (!(flags & EPOLLET) &&
+      (old_flags & kInterestMask) == (flags & kInterestMask)) {
+    return true;
+  }
+  Disarm(registration, fd);
+  ScheduleArm(fd, registration);
+  return true;
+}
+
+bool UringPoller::Remove(int fd) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered) {
+    return false;
+  }
+  Disarm(registration, fd);
+  // Request holds the socket, so it's closed only when the request is.
+  CancelAhead(fd, registration);
+  ClearAhead(registration);
+  ++registration->ahead_generation;
+  registration->is_receiving = false;
+  registration->is_accepting = false;
+  registration->is_ahead_armed = false;
+  registration->is_ahead_cancelled = false;
+  registration->is_registered = false;
+  registration->data = nullptr;
+  return true;
+}
+
+int UringPoller::Wait(epoll_event* events, size_t max_events,
+                      int timeout_ms) {
+  QueuePendingArms();
+  bool has_completions =
+      __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_ ||
+      !pending_events_.empty();
+  if (to_submit_ != 0 || (!has_completions && timeout_ms != 0)) {
+    if (!Enter(has_completions ? 0 : timeout_ms)) {
+      return -1;
+    }
+  }
+  return Reap(events, max_events);
+}
+
+bool UringPoller::StartReceiving(int fd) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered ||
+      buffer_ring_ == nullptr) {
+    return false;
+  }
+  registration->is_receiving = true;
+  ScheduleArm(fd, registration);
+  return true;
+}
+
+bool UringPoller::TakeReceived(int fd, base::ReceiveBuffer* data,
+                               size_t budget,
+                               base::IOFileDescriptor::ReadResult* result) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered ||
+      !(registration->is_ahead_armed || HasReceived(fd))) {
+    return false;
+  }
+  std::deque<Chunk>& received = registration->received;
+  size_t was_taken = 0;
+  while (!received.empty() && was_taken < budget &&
+         data->GetFreeSpace() > 0) {
+    Chunk& chunk = received.front();
+    size_t size = std::min<size_t>(chunk.size, budget - was_taken);
+    size = std::min(size, data->GetFreeSpace());
+    memcpy(data->GetTail(), GetBuffer(chunk.buffer_id) + chunk.offset, size);
+    data->Commit(size);
+    was_taken += size;
+    chunk.offset += size;
+    chunk.size -= size;
+    if (chunk.size == 0) {
+      RecycleBuffer(chunk.buffer_id);
+      received.pop_front();
+    }
+  }
+  registration->received_size -= was_taken;
+
+  if (!received.empty()) {
+    *result = base::IOFileDescriptor::BUDGET_EXHAUSTED;
+    // Level-triggered record expects to be woken up while input is left.
+    if (!(registration->flags & EPOLLET)) {
+      SchedulePendingEvent(fd, registration);
+    }
+  } else if (registration->receive_end ==
+             base::IOFileDescriptor::READ_ERROR) {
+    errno = registration->receive_error;
+    LOGE << "Reading error for fd: " << fd;
+    *result = registration->receive_end;
+  } else {
+    *result = registration->receive_end;
+  }
+  if (!registration->is_ahead_armed &&
+      registration->received_size < kMaxReceivedSize) {
+    ScheduleArm(fd, registration);
+  }
+  return true;
+}
+
+bool UringPoller::HasReceived(int fd) const {
+  if (fd < 0 || static_cast<size_t>(fd) >= registrations_.size()) {
+    return false;
+  }
+  const Registration& registration = registrations_[fd];
+  return !registration.received.empty() ||
+         registration.receive_end != base::IOFileDescriptor::WOULD_BLOCK;
+}
+
+bool UringPoller::StartAccepting(int fd) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered ||
+      !is_accept_supported_) {
+    return false;
+  }
+  registration->is_accepting = true;
+  ScheduleArm(fd, registration);
+  return true;
+}
+
+bool UringPoller::TakeAccepted(int fd, int* client_fd) {
+  Registration* registration = GetRegistration(fd);
+  if (registration == nullptr || !registration->is_registered) {
+    return false;
+  }
+  std::deque<int>& accepted = registration->accepted;
+  if (accepted.empty()) {
+    if (!registration->is_ahead_armed) {
+      return false;
+    }
+    *client_fd = -1;
+    errno = EAGAIN;
+    return true;
+  }
+  *client_fd = accepted.front();
+  accepted.pop_front();
+  if (!accepted.empty()) {
+    SchedulePendingEvent(fd, registration);
+  }
+  return true;
+}
+
+int UringPoller::GetFD() const {
+  return ring_fd_.GetFD();
+}
+
+const char* UringPoller::GetName() const {
+  return "io_uring";
+}
+
+UringPoller::Registration* UringPoller::GetRegistration(int fd) {
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (static_cast<size_t>(fd) >= registrations_.size()) {
+    registrations_.resize(fd + 1);
+  }
+  return &registrations_[fd];
+}
+
+void UringPoller::ScheduleArm(int fd, Registration* registration) {
+  if (registration->is_arm_pending) {
+    return;
+  }
+  registration->is_arm_pending = true;
+  pending_arms_.push_back(fd);
+}
+
+void UringPoller::Disarm(Registration* registration, int fd) {
+  if (registration->is_armed) {
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = MakeUserData(POLL_REQUEST, fd, registration->generation);
+    sqe->user_data = kIgnoredUserData;
+    registration->is_armed = false;
+  }
+  // Late completion of the old request won't match the new generation.
+  ++registration->generation;
+}
+
+void UringPoller::QueuePendingArms() {
+  for (int fd : pending_arms_) {
+    Registration& registration = registrations_[fd];
+    registration.is_arm_pending = false;
+    if (!registration.is_registered) {
+      continue;
+    }
+    ArmAhead(fd, &registration);
+    uint32_t mask = GetPollMask(registration);
+    if (registration.is_armed && registration.armed_mask != mask) {
+      Disarm(&registration, fd);
+    }
+    if (registration.is_armed) {
+      continue;
+    }
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = mask;
+    if (registration.flags & EPOLLET) {
+      sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = MakeUserData(POLL_REQUEST, fd, registration.generation);
+    registration.is_armed = true;
+    registration.armed_mask = mask;
+  }
+  pending_arms_.clear();
+}
+
+void UringPoller::ArmAhead(int fd, Registration* registration) {
+  if (registration->is_ahead_armed || !(registration->flags & EPOLLIN)) {
+    return;
+  }
+  if (registration->is_receiving) {
+    if (registration->receive_end != base::IOFileDescriptor::WOULD_BLOCK ||
+        registration->received_size >= kMaxReceivedSize) {
+      return;
+    }
+    if (free_buffers_ == 0) {
+      starved_.push_back(fd);
+      return;
+    }
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = MakeUserData(RECEIVE_REQUEST, fd,
+                                  registration->ahead_generation);
+  } else if (registration->is_accepting) {
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = MakeUserData(ACCEPT_REQUEST, fd,
+                                  registration->ahead_generation);
+  } else {
+    return;
+  }
+  registration->is_ahead_armed = true;
+  registration->is_ahead_cancelled = false;
+}
+
+void UringPoller::CancelAhead(int fd, Registration* registration) {
+  if (!registration->is_ahead_armed || registration->is_ahead_cancelled) {
+    return;
+  }
+  io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = MakeUserData(
+      registration->is_receiving ? RECEIVE_REQUEST : ACCEPT_REQUEST, fd,
+      registration->ahead_generation);
+  sqe->user_data = kIgnoredUserData;
+  registration->is_ahead_cancelled = true;
+}
+
+void UringPoller::ClearAhead(Registration* registration) {
+  for (const Chunk& chunk : registration->received) {
+    RecycleBuffer(chunk.buffer_id);
+  }
+  registration->received.clear();
+  registration->received_size = 0;
+  registration->receive_end = base::IOFileDescriptor::WOULD_BLOCK;
+  for (int client_fd : registration->accepted) {
+    ::close(client_fd);
+  }
+  registration->accepted.clear();
+}
+
+bool UringPoller::IsAheadReady(const Registration& registration) const {
+  return !registration.received.empty() || !registration.accepted.empty() ||
+         registration.receive_end != base::IOFileDescriptor::WOULD_BLOCK;
+}
+
+void UringPoller::SchedulePendingEvent(int fd, Registration* registration) {
+  if (registration->is_event_pending) {
+    return;
+  }
+  registration->is_event_pending = true;
+  pending_events_.push_back(fd);
+}
+
+uint32_t UringPoller::GetPollMask(const Registration& registration) const {
+  uint32_t mask = registration.flags & kPollMask;
+  if (registration.is_ahead_armed) {
+    mask &= ~(EPOLLIN | EPOLLRDHUP);
+  }
+  return mask;
+}
+
+io_uring_sqe* UringPoller::GetSqe() {
+  unsigned tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    // Kernel consumes all submitted entries during io_uring_enter.
+    Enter(0);
+    tail = *sq_tail_;
+  }
+  io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++to_submit_;
+  return sqe;
+}
+
+bool UringPoller::Enter(int timeout_ms) {
+  unsigned to_submit = to_submit_;
+  to_submit_ = 0;
+  int result = 0;
+  if (timeout_ms == 0) {
+    result = EnterRing(ring_fd_.GetFD(), to_submit, 0, 0, nullptr, 0);
+  } else if (timeout_ms < 0) {
+    result = EnterRing(ring_fd_.GetFD(), to_submit, 1,
+                       IORING_ENTER_GETEVENTS, nullptr, 0);
+  } else {
+    __kernel_timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    result = EnterRing(ring_fd_.GetFD(), to_submit, 1,
+                       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg));
+  }
+  if (result < 0 && errno != ETIME && errno != EINTR) {
+    LOGE << "Error to enter io_uring: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+size_t UringPoller::Reap(epoll_event* events, size_t max_events) {
+  size_t ready = 0;
+  ++batch_;
+  size_t taken = 0;
+  for (; taken < pending_events_.size() && ready < max_events; ++taken) {
+    int fd = pending_events_[taken];
+    Registration& registration = registrations_[fd];
+    registration.is_event_pending = false;
+    if (registration.is_registered && (registration.flags & EPOLLIN) &&
+        IsAheadReady(registration)) {
+      AddEvent(&registration, EPOLLIN, events, &ready);
+    }
+  }
+  pending_events_.erase(pending_events_.begin(),
+                        pending_events_.begin() + taken);
+
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail && ready < max_events; ++head) {
+    const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+    if (cqe.user_data == kIgnoredUserData) {
+      continue;
+    }
+    RequestKind kind = static_cast<RequestKind>(cqe.user_data >> kKindShift);
+    int fd = static_cast<int>((cqe.user_data >> 32) & kFdMask);
+    Registration& registration = registrations_[fd];
+    uint32_t mask = 0;
+    switch (kind) {
+      case (POLL_REQUEST):
+        mask = OnPollCompleted(&registration, fd, cqe);
+        break;
+
+      case (RECEIVE_REQUEST):
+        mask = OnReceiveCompleted(&registration, fd, cqe);
+        break;
+
+      default:
+        mask = OnAcceptCompleted(&registration, fd, cqe);
+        break;
+    }
+    if (mask != 0) {
+      AddEvent(&registration, mask, events, &ready);
+    }
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  return ready;
+}
+
+uint32_t UringPoller::OnPollCompleted(Registration* registration, int fd,
+                                      const io_uring_cqe& cqe) {
+  uint32_t generation = static_cast<uint32_t>(cqe.user_data);
+  if (!registration->is_registered ||
+      registration->generation != generation) {
+    return 0;
+  }
+  // Unlike epoll, io_uring always reports EPOLLRDHUP.
+  uint32_t mask = (cqe.res < 0) ? static_cast<uint32_t>(EPOLLERR)
+                                : static_cast<uint32_t>(cqe.res);
+  mask &= registration->flags | EPOLLERR | EPOLLHUP;
+  // Input which is read ahead may still be in flight; its end is reported
+  // after it.
+  if (registration->is_ahead_armed) {
+    mask &= ~(EPOLLIN | EPOLLRDHUP | EPOLLHUP);
+  }
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    registration->is_armed = false;
+    // Hang-up would complete the poll again at once; it's re-armed when
+    // reading ahead finishes instead.
+    bool is_hung_up = cqe.res > 0 && (cqe.res & EPOLLHUP);
+    if (!(registration->is_ahead_armed && is_hung_up)) {
+      // Re-armed with the flags the record has when the next wait starts.
+      ScheduleArm(fd, registration);
+    }
+  }
+  return mask;
+}
+
+uint32_t UringPoller::OnReceiveCompleted(Registration* registration, int fd,
+                                         const io_uring_cqe& cqe) {
+  uint32_t generation = static_cast<uint32_t>(cqe.user_data);
+  bool has_buffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+  uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+  if (has_buffer) {
+    --free_buffers_;
+  }
+  if (!registration->is_registered ||
+      registration->ahead_generation != generation) {
+    if (has_buffer) {
+      RecycleBuffer(buffer_id);
+    }
+    return 0;
+  }
+
+  uint32_t mask = EPOLLIN;
+  if (cqe.res > 0 && has_buffer) {
+    registration->received.push_back({buffer_id, 0,
+                                      static_cast<uint32_t>(cqe.res)});
+    registration->received_size += cqe.res;
+    has_buffer = false;
+  } else if (cqe.res == 0) {
+    registration->receive_end = base::IOFileDescriptor::END_OF_FILE;
+  } else if (cqe.res == -ENOBUFS) {
+    // Descriptor is read directly until buffers are returned.
+    starved_.push_back(fd);
+    mask = 0;
+  } else if (cqe.res == -ECANCELED) {
+    mask = 0;
+  } else if (cqe.res == -EINVAL && !HasReceived(fd)) {
+    LOGW << "io_uring can't receive ahead; fd: " << fd;
+    registration->is_receiving = false;
+    mask = 0;
+  } else {
+    registration->receive_end = base::IOFileDescriptor::READ_ERROR;
+    registration->receive_error = -cqe.res;
+  }
+  if (has_buffer) {
+    RecycleBuffer(buffer_id);
+  }
+
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    registration->is_ahead_armed = false;
+    registration->is_ahead_cancelled = false;
+    ScheduleArm(fd, registration);
+  } else if (registration->received_size >= kMaxReceivedSize) {
+    CancelAhead(fd, registration);
+  }
+  return mask & registration->flags;
+}
+
+uint32_t UringPoller::OnAcceptCompleted(Registration* registration, int fd,
+                                        const io_uring_cqe& cqe) {
+  uint32_t generation = static_cast<uint32_t>(cqe.user_data);
+  if (!registration->is_registered ||
+      registration->ahead_generation != generation) {
+    if (cqe.res >= 0) {
+      ::close(cqe.res);
+    }
+    return 0;
+  }
+
+  uint32_t mask = 0;
+  if (cqe.res >= 0) {
+    registration->accepted.push_back(cqe.res);
+    mask = EPOLLIN;
+  } else if (cqe.res == -EINVAL) {
+    LOGW << "io_uring can't accept ahead; fd: " << fd;
+    is_accept_supported_ = false;
+    registration->is_accepting = false;
+  } else if (cqe.res != -ECANCELED) {
+    LOGE << "Error to accept ahead; fd: " << fd << "; "
+         << strerror(-cqe.res);
+  }
+
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    registration->is_ahead_armed = false;
+    registration->is_ahead_cancelled = false;
+    ScheduleArm(fd, registration);
+  }
+  return mask & registration->flags;
+}
+
+void UringPoller::AddEvent(Registration* registration, uint32_t mask,
+                           epoll_event* events, size_t* ready) {
+  if (registration->reaped_batch == batch_) {
+    events[registration->event_index].events |= mask;
+    return;
+  }
+  registration->reaped_batch = batch_;
+  registration->event_index = *ready;
+  events[*ready].events = mask;
+  events[*ready].data.ptr = registration->data;
+  ++*ready;
+}
+
+char* UringPoller::GetBuffer(uint16_t buffer_id) {
+  return buffers_.get() + buffer_id * kReceiveBufferSize;
+}
+
+void UringPoller::RecycleBuffer(uint16_t buffer_id) {
+  uint16_t tail = buffer_ring_->tail;
+  // Not through io_uring_buf_ring::bufs: in C++ the flexible array is
+  // declared after an empty struct and doesn't start at the ring.
+  io_uring_buf* buffer = reinterpret_cast<io_uring_buf*>(buffer_ring_) +
+                         (tail & (kReceiveBuffers - 1));
+  buffer->addr = reinterpret_cast<uint64_t>(GetBuffer(buffer_id));
+  buffer->len = kReceiveBufferSize;
+  buffer->bid = buffer_id;
+  __atomic_store_n(&buffer_ring_->tail, tail + 1, __ATOMIC_RELEASE);
+  ++free_buffers_;
+  // Records which ran out of buffers resume reading ahead.
+  for (int fd : starved_) {
+    ScheduleArm(fd, &registrations_[fd]);
+  }
+  starved_.clear();
+}
+
+uint64_t UringPoller::MakeUserData(RequestKind kind, int fd,
+                                   uint32_t generation) {
+  return (static_cast<uint64_t>(kind) << kKindShift) |
+         (static_cast<uint64_t>(fd) << 32) | generation;
+}
+
+}  // namespace epoll
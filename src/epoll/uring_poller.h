@@ -0,0 +1,189 @@
+#ifndef EPOLL_URING_POLLER_H_
+#define EPOLL_URING_POLLER_H_
+
+#include <linux/io_uring.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "file_descriptor.h"
+#include "macros.h"
+#include "poller.h"
+
+namespace epoll {
+
+// Poller on top of io_uring's IORING_OP_POLL_ADD. Every subscribed descriptor
+// has at most one poll request in flight. Level-triggered descriptors use
+// single-shot polls which are re-armed after each completion, edge-triggered
+// ones use multishot polls which complete on every wakeup. New polls and
+// interest changes are queued to the submission ring and submitted by the same
+// io_uring_enter which waits for completions, so a loop iteration costs one
+// system call regardless of the number of ready descriptors.
+// Descriptors which ask for it are read ahead by multishot recv into a ring of
+// provided buffers, and listening ones are accepted from by multishot accept,
+// once EPOLLIN is in their flags; their poll waits for the rest of the events
+// then. Reading ahead pauses while too much input of a descriptor isn't
+// taken, and stops when the buffers run out: descriptor is polled for EPOLLIN
+// and read directly until they're returned.
+// Every request is tagged with its kind, descriptor and registration
+// generation, so completions of removed or replaced requests are dropped.
+class UringPoller : public Poller {
+ public:
+  // Returns nullptr if io_uring isn't available.
+  static std::unique_ptr<UringPoller> Create();
+
+  ~UringPoller() override;
+
+  bool Add(int fd, uint32_t flags, void* data) override;
+  bool Modify(int fd, uint32_t flags, void* data) override;
+  bool Remove(int fd) override;
+  int Wait(epoll_event* events, size_t max_events, int timeout_ms) override;
+
+  bool StartReceiving(int fd) override;
+  bool TakeReceived(int fd, base::ReceiveBuffer* data, size_t budget,
+                    base::IOFileDescriptor::ReadResult* result) override;
+  bool HasReceived(int fd) const override;
+  bool StartAccepting(int fd) override;
+  bool TakeAccepted(int fd, int* client_fd) override;
+
+  int GetFD() const override;
+  const char* GetName() const override;
+
+ private:
+  enum RequestKind {
+    POLL_REQUEST = 0,
+    RECEIVE_REQUEST = 1,
+    ACCEPT_REQUEST = 2,
+  };
+
+  // Part of a provided buffer which isn't taken yet.
+  struct Chunk {
+    uint16_t buffer_id;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  struct Registration {
+    Registration() : data(nullptr), flags(0), generation(0),
+                     ahead_generation(0), is_registered(false),
+                     is_armed(false), is_arm_pending(false),
+                     is_event_pending(false), reaped_batch(0),
+                     event_index(0), armed_mask(0), is_receiving(false),
+                     is_accepting(false), is_ahead_armed(false),
+                     is_ahead_cancelled(false), received_size(0),
+                     receive_end(base::IOFileDescriptor::WOULD_BLOCK) {}
+
+    void* data;
+    uint32_t flags;
+    uint32_t generation;
+    // Generation of receive and accept requests; it changes only when
+    // descriptor is added or removed, so their late results are kept.
+    uint32_t ahead_generation;
+    bool is_registered;
+    // Poll request was submitted and hasn't completed yet.
+    bool is_armed;
+    // Descriptor is in pending_arms_.
+    bool is_arm_pending;
+    // Descriptor is in pending_events_.
+    bool is_event_pending;
+    // Multishot poll may complete several times before it's reaped; such
+    // completions are merged into one event.
+    uint64_t reaped_batch;
+    size_t event_index;
+    // Events of the armed poll.
+    uint32_t armed_mask;
+
+    bool is_receiving;
+    bool is_accepting;
+    // Multishot receive or accept was submitted and hasn't finished yet.
+    bool is_ahead_armed;
+    bool is_ahead_cancelled;
+    std::deque<Chunk> received;
+    size_t received_size;
+    // END_OF_FILE or READ_ERROR once input has ended; it's reported after
+    // received data is taken.
+    base::IOFileDescriptor::ReadResult receive_end;
+    int receive_error;
+    std::deque<int> accepted;
+  };
+
+  UringPoller();
+
+  bool Setup();
+  // Registers the ring of provided buffers; reading ahead is disabled if
+  // kernel doesn't support it.
+  bool SetupBufferRing();
+  Registration* GetRegistration(int fd);
+  void ScheduleArm(int fd, Registration* registration);
+  void Disarm(Registration* registration, int fd);
+  void QueuePendingArms();
+  // Arms multishot receive or accept if descriptor asked for it and can
+  // take more input.
+  void ArmAhead(int fd, Registration* registration);
+  void CancelAhead(int fd, Registration* registration);
+  // Drops input and connections which weren't taken.
+  void ClearAhead(Registration* registration);
+  bool IsAheadReady(const Registration& registration) const;
+  // EPOLLIN is reported on the next wait without a new completion.
+  void SchedulePendingEvent(int fd, Registration* registration);
+  uint32_t GetPollMask(const Registration& registration) const;
+  io_uring_sqe* GetSqe();
+  // Submits queued requests and waits for at least one completion if
+  // timeout_ms isn't zero. Returns false on error.
+  bool Enter(int timeout_ms);
+  size_t Reap(epoll_event* events, size_t max_events);
+  // Returns mask of events to report.
+  uint32_t OnPollCompleted(Registration* registration, int fd,
+                           const io_uring_cqe& cqe);
+  uint32_t OnReceiveCompleted(Registration* registration, int fd,
+                              const io_uring_cqe& cqe);
+  uint32_t OnAcceptCompleted(Registration* registration, int fd,
+                             const io_uring_cqe& cqe);
+  void AddEvent(Registration* registration, uint32_t mask,
+                epoll_event* events, size_t* ready);
+  char* GetBuffer(uint16_t buffer_id);
+  void RecycleBuffer(uint16_t buffer_id);
+
+  static uint64_t MakeUserData(RequestKind kind, int fd, uint32_t generation);
+
+  base::FileDescriptor ring_fd_;
+
+  void* ring_ptr_;
+  size_t ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+  // Requests queued since the last io_uring_enter.
+  unsigned to_submit_;
+
+  // Provided buffers; nullptr if reading ahead isn't supported.
+  io_uring_buf_ring* buffer_ring_;
+  size_t buffer_ring_size_;
+  std::unique_ptr<char[]> buffers_;
+  // Buffers which kernel can still fill.
+  size_t free_buffers_;
+  bool is_accept_supported_;
+
+  // Indexed by descriptor.
+  std::vector<Registration> registrations_;
+  std::vector<int> pending_arms_;
+  std::vector<int> pending_events_;
+  // Descriptors which stopped reading ahead because buffers ran out.
+  std::vector<int> starved_;
+  uint64_t batch_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(UringPoller);
+};
+
+}  // namespace epoll
+
+#endif  // EPOLL_URING_POLLER_H_
@@ -1,8 +1,16 @@
+#include <string.h>
+
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include "disk_cache.h"
+#include "dns_cache.h"
 #include "epoll.h"
+#include "http_cache.h"
 #include "logger.h"
+#include "reactor.h"
 #include "server_socket.h"
 #include "signal_handler.h"
 #include "terminal_error.h"
@@ -12,29 +20,173 @@ using epoll::SignalHandler;
 using std::cout;
 using std::endl;
 
+namespace {
+
+const size_t kMaxNumberOfReactors = 256;
+const char kReactorsOption[] = "--reactors=";
+const char kEdgeTriggeredOption[] = "--edge-triggered";
+const char kCoarseClockOption[] = "--coarse-clock";
+const char kIoUringOption[] = "--io-uring";
+const char kLoopStatsOption[] = "--loop-stats";
+const char kBusyPollOption[] = "--busy-poll=";
+const char kSocketBusyPollOption[] = "--socket-busy-poll";
+const uint32_t kMaxBusyPollUs = 1000000;
+const char kSpliceOption[] = "--splice";
+const char kResolvConfOption[] = "--resolv-conf=";
+const char kHttpCacheOption[] = "--http-cache=";
+const size_t kDefaultHttpCacheMb = 0;
+const char kDiskCacheOption[] = "--disk-cache=";
+const char kDiskCacheSizeOption[] = "--disk-cache-size=";
+const size_t kDefaultDiskCacheMb = 1024;
+
+}  // namespace
+
 
 void printUsage() {
-  cout << "Usage: ./proxy port" << endl;
+  cout << "Usage: ./proxy port [" << kReactorsOption << "N] ["
+       << kEdgeTriggeredOption << "] [" << kCoarseClockOption << "] ["
+       << kIoUringOption << "] [" << kLoopStatsOption << "] ["
+       << kBusyPollOption << "US [" << kSocketBusyPollOption << "]] ["
+       << kSpliceOption << "] [" << kResolvConfOption << "PATH] ["
+       << kHttpCacheOption << "MB] [" << kDiskCacheOption << "DIR ["
+       << kDiskCacheSizeOption << "DISK_MB]]" << endl;
   cout << "port - port which your proxy will listen to." << endl;
+  cout << "N - number of event loop threads, each with its own listening "
+       << "socket (SO_REUSEPORT). Default: 1." << endl;
+  cout << kEdgeTriggeredOption << " - use EPOLLET for connections and drain "
+       << "them on every wakeup." << endl;
+  cout << kCoarseClockOption << " - read event loop's clock with "
+       << "CLOCK_MONOTONIC_COARSE." << endl;
+  cout << kIoUringOption << " - poll connections through io_uring; falls "
+       << "back to epoll if it's unavailable." << endl;
+  cout << kLoopStatsOption << " - collect event loop statistics; they are "
+       << "written to the log on SIGUSR1." << endl;
+  cout << "US - keep polling without blocking for US microseconds after "
+       << "the last activity. Experimental; it burns CPU without a measured "
+       << "gain yet." << endl;
+  cout << kSocketBusyPollOption << " - also set SO_BUSY_POLL to US for "
+       << "connections." << endl;
+  cout << kSpliceOption << " - relay responses with splice through a pipe "
+       << "without copying them to user space." << endl;
+  cout << "PATH - resolver configuration to use instead of "
+       << "/etc/resolv.conf." << endl;
+  cout << "MB - memory budget of response cache in megabytes; the cache "
+       << "is off unless it's given. Default: " << kDefaultHttpCacheMb << "."
+       << endl;
+  cout << "DIR - directory of the second tier of response cache; objects "
+       << "stored there are kept across restarts." << endl;
+  cout << "DISK_MB - size of the disk tier in megabytes. Default: "
+       << kDefaultDiskCacheMb << "." << endl;
+}
+
+bool StartsWith(const std::string& str, const std::string& prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool ParseArguments(int argc, char** argv, size_t* reactors,
+                    size_t* http_cache_mb, std::string* disk_cache_dir,
+                    size_t* disk_cache_mb, Epoll::Options* options) {
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (StartsWith(arg, kReactorsOption)) {
+      *reactors = atoi(arg.c_str() + strlen(kReactorsOption));
+      if (*reactors == 0 || *reactors > kMaxNumberOfReactors) {
+        return false;
+      }
+    } else if (arg == kEdgeTriggeredOption) {
+      options->edge_triggered = true;
+    } else if (arg == kCoarseClockOption) {
+      options->coarse_clock = true;
+    } else if (arg == kIoUringOption) {
+      options->io_uring = true;
+    } else if (arg == kLoopStatsOption) {
+      options->collect_stats = true;
+    } else if (StartsWith(arg, kBusyPollOption)) {
+      options->busy_poll_us = atoi(arg.c_str() + strlen(kBusyPollOption));
+      if (options->busy_poll_us == 0 ||
+          options->busy_poll_us > kMaxBusyPollUs) {
+        return false;
+      }
+    } else if (arg == kSocketBusyPollOption) {
+      options->socket_busy_poll = true;
+    } else if (arg == kSpliceOption) {
+      options->splice_relay = true;
+    } else if (StartsWith(arg, kResolvConfOption)) {
+      options->resolv_conf = arg.substr(strlen(kResolvConfOption));
+    } else if (StartsWith(arg, kHttpCacheOption)) {
+      *http_cache_mb = atoi(arg.c_str() + strlen(kHttpCacheOption));
+    } else if (StartsWith(arg, kDiskCacheOption)) {
+      *disk_cache_dir = arg.substr(strlen(kDiskCacheOption));
+      if (disk_cache_dir->empty()) {
+        return false;
+      }
+    } else if (StartsWith(arg, kDiskCacheSizeOption)) {
+      *disk_cache_mb = atoi(arg.c_str() + strlen(kDiskCacheSizeOption));
+      if (*disk_cache_mb == 0) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
 }
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
+  size_t reactors = 1;
+  size_t http_cache_mb = kDefaultHttpCacheMb;
+  std::string disk_cache_dir;
+  size_t disk_cache_mb = kDefaultDiskCacheMb;
+  Epoll::Options options;
+  if (argc < 2 ||
+      !ParseArguments(argc, argv, &reactors, &http_cache_mb, &disk_cache_dir,
+                      &disk_cache_mb, &options)) {
     printUsage();
     return 0;
   }
+  net_utils::HttpCache::GetInstance()->SetCapacity(http_cache_mb << 20);
 
   InitFileLogger("proxy.log");
   std::shared_ptr<Epoll> epoll_ptr;
   try {
-    epoll_ptr = std::make_shared<Epoll>();
-    std::unique_ptr<SignalHandler> handler_ptr(new SignalHandler(epoll_ptr));
-    sockets::ServerSocket server(epoll_ptr, 4, atoi(argv[1]));
-    for (;;) {
-      epoll_ptr->Process();
+    epoll_ptr = std::make_shared<Epoll>(options);
+    std::vector<std::unique_ptr<sockets::Reactor>> reactors_ptrs;
+    // Signal handler blocks signals for the current thread, so it has to be
+    // created before reactors' threads to be inherited by them.
+    std::unique_ptr<SignalHandler> handler_ptr(new SignalHandler(epoll_ptr,
+        [&epoll_ptr, &reactors_ptrs]() {
+          LOGI << "Loop stats:\n" << epoll_ptr->GetStats().ToString();
+          for (auto& reactor_ptr : reactors_ptrs) {
+            reactor_ptr->DumpStats();
+          }
+          LOGI << "DNS cache: "
+               << net_utils::DnsCache::GetInstance()->GetStats().ToString();
+          LOGI << "HTTP cache: "
+               << net_utils::HttpCache::GetInstance()->GetStats().ToString();
+          LOGI << "Disk cache: "
+               << net_utils::DiskCache::GetInstance()->GetStats().ToString();
+        }));
+    if (!disk_cache_dir.empty()) {
+      net_utils::DiskCache::GetInstance()->Open(
+          disk_cache_dir, static_cast<uint64_t>(disk_cache_mb) << 20);
+    }
+    if (reactors == 1) {
+      sockets::ServerSocket server(epoll_ptr, atoi(argv[1]));
+      for (;;) {
+        epoll_ptr->Process();
+      }
+    } else {
+      for (size_t i = 0; i < reactors; ++i) {
+        reactors_ptrs.emplace_back(
+            new sockets::Reactor(i + 1, atoi(argv[1]), options));
+      }
+      for (;;) {
+        epoll_ptr->Process();
+      }
     }
   } catch (TerminalError& error) {}
 
+  net_utils::DiskCache::GetInstance()->Close();
   epoll_ptr = nullptr;
   LOGI << "TERMINATION";
   return 0;
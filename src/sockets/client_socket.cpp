@@ -1,161 +1,574 @@
 #include "client_socket.h"
 
+#include <errno.h>
+
+#include <algorithm>
 #include <memory>
 
 #include "advanced_time.h"
+#include "dns_cache.h"
 #include "epoll.h"
 #include "epoll_record.h"
 #include "external_server_socket.h"
+#include "http_cache.h"
 #include "http_parser.h"
 #include "logger.h"
 #include "net_utils.h"
 #include "server_socket.h"
+#include "upstream_pool.h"
 
 namespace sockets {
 
 using epoll::Epoll;
 using epoll::EpollRecord;
 using base::AdvancedTime;
+using net_utils::DnsCache;
+using net_utils::HttpCache;
 using net_utils::HttpParser;
 
 namespace {
 
 const uint64_t kTimeoutForClientsIdleMs = 60000;
+// Tunneled protocols may stay quiet for long, e.g. between websocket pings.
+const uint64_t kTimeoutForTunnelIdleMs = 3600000;
+// Edge-triggered relay gives other records a chance after moving this much.
+const size_t kSpliceBudget = 256 * 1024;
+// Relay from external server pauses when this much output is buffered and
+// resumes when it's drained to the low watermark.
+const size_t kOutputHighWatermark = 64 * 1024;
+const size_t kOutputLowWatermark = 16 * 1024;
 const char kConstPortNumberString[] = "80";
+// Client stops reading when this many pipelined requests wait for responses.
+const size_t kMaxQueuedRequests = 16;
+const char kConnectionEstablished[] =
+    "HTTP/1.1 200 Connection Established\r\n\r\n";
 
 }  // namespace
 
 ClientSocket::ClientSocket(int fd, std::shared_ptr<Epoll> epoll_ptr,
                            ServerSocket* server_ptr, uint64_t id) :
-    EpollRecord(fd, epoll_ptr, EpollRecord::IN,
+    EpollRecord(fd, epoll_ptr, EpollRecord::IN | epoll_ptr->GetModeFlags(),
                 AdvancedTime::FromMilliseconds(kTimeoutForClientsIdleMs)),
-    server_ptr_(server_ptr), id_(id), is_disconnect_on_send_(false) {
+    server_ptr_(server_ptr), next_address_(0), cached_response_pos_(0),
+    id_(id), is_disconnect_on_send_(false),
+    is_exchange_active_(false), is_sending_cached_response_(false),
+    is_input_finished_(false),
+    is_tunnel_(false), is_tunnel_input_closed_(false),
+    is_waiting_for_space_(false),
+    is_shutdown_on_send_(false), is_output_shutdown_(false) {
+  EpollRecord::ReceiveAhead();
   LOGI << "Client Socket was created; fd: " << GetFD();
 }
 
 ClientSocket::~ClientSocket() {
   LOGI << "Client Socket is destroying; fd: " << GetFD();
+  server_ptr_->GetPipePoolPtr()->Release(std::move(pipe_));
 }
 
 void ClientSocket::OnIn() {
-  std::string message = IOFileDescriptor::Read();
-  if (message.empty()) {
-    LOGI << "Empty message from client: " << GetFD() << "; close connection";
-    Disconnect();
+  if (is_tunnel_ && !is_disconnect_on_send_) {
+    RelayTunnelInput();
     return;
   }
-  std::string host, port;
-  ServerSocket* server_tmp_ptr;
-  uint64_t id_tmp;
-  switch (parser_.Append(message)) {
-    case (HttpParser::AppendResult::ERROR):
-      LOGE << "Request too large. Client: " << GetFD() << "; close connection";
+  base::ReceiveBuffer message;
+  bool is_open = EpollRecord::ReadInput(&message);
+  if (is_disconnect_on_send_) {
+    // Input after the last request is dropped; closed input only speeds up
+    // disconnection.
+    if (!is_open) {
+      Disconnect();
+    }
+    return;
+  }
+  if (!message.IsEmpty() && !is_input_finished_) {
+    HttpParser::AppendResult result =
+        parser_.Append(message.GetData(), message.GetSize());
+    while (result == HttpParser::AppendResult::READY_REQUEST &&
+           !is_input_finished_) {
+      QueueRequest();
+      result = parser_.Reset();
+    }
+    if (result == HttpParser::AppendResult::ERROR) {
+      LOGE << "Bad request. Client: " << GetFD() << "; close connection";
       Disconnect();
       return;
+    }
+  } else if (!message.IsEmpty() && !requests_.empty() &&
+             requests_.back().is_connect) {
+    // Tunnel isn't established yet.
+    requests_.back().data.append(message.GetData(), message.GetSize());
+  }
+  if (!is_open) {
+    if (requests_.empty()) {
+      LOGI << "Empty message from client: " << GetFD()
+           << "; close connection";
+      Disconnect();
+      return;
+    }
+    // Client has half-closed the connection and waits for the responses.
+    is_input_finished_ = true;
+  }
+  if ((is_input_finished_ || requests_.size() >= kMaxQueuedRequests) &&
+      !EpollRecord::RemoveFlag(EpollRecord::IN)) {
+    LOGE << "Error to remove IN flag. Fd: " << GetFD();
+    Disconnect();
+    return;
+  }
+  StartNextExchange();
+}
 
-    case (HttpParser::AppendResult::READY_REQUEST):
-      host = parser_.GetHost();
-      port = parser_.GetPort();
-      server_tmp_ptr = server_ptr_;
-      id_tmp = id_;
-      server_ptr_->GetThreadPoolPtr()->PostTask(
-          [host, port, server_tmp_ptr, id_tmp]() {
-            ClientSocket::CreateExternalServer(host,
-                                               port,
-                                               server_tmp_ptr,
-                                               id_tmp);
-          });
-      if (!EpollRecord::RemoveFlag(EpollRecord::IN)) {
-        LOGE << "Error to remove IN flag. Fd: " << GetFD();
-        Disconnect();
-        return;
-      }
+void ClientSocket::QueueRequest() {
+  Request request;
+  request.host = parser_.GetHost();
+  request.port = parser_.GetPort();
+  if (request.port.empty()) {
+    request.port = kConstPortNumberString;
+  }
+  request.is_head = (parser_.GetMethod() == "HEAD");
+  request.is_connect = parser_.IsConnect();
+  request.is_invalidating = false;
+  if (request.is_connect) {
+    // Reading is resumed once the tunnel is established.
+    is_input_finished_ = true;
+    request.data = parser_.TakeRest();
+    requests_.push_back(std::move(request));
+    return;
+  }
+  if (!parser_.IsKeepAlive()) {
+    is_input_finished_ = true;
+  }
+  parser_.ModifyHeader();
+  HttpCache* cache_ptr = HttpCache::GetInstance();
+  if (cache_ptr->IsEnabled() && !request.is_head) {
+    std::string key = HttpCache::MakeKey(request.host, request.port,
+                                         parser_.GetTarget());
+    if (parser_.GetMethod() != "GET") {
+      // Other clients stop getting the response at once; it's dropped again
+      // when the request is sent in case it was stored meanwhile.
+      cache_ptr->Invalidate(key);
+      request.is_invalidating = true;
+    }
+    request.cache_key = key;
+  }
+  request.data = parser_.GetRequest();
+  requests_.push_back(std::move(request));
+}
+
+void ClientSocket::StartNextExchange() {
+  if (is_exchange_active_ || requests_.empty()) {
+    return;
+  }
+  is_exchange_active_ = true;
+  // Cache is consulted when the request's turn comes, so it sees the
+  // effect of the requests which were pipelined before it.
+  Request& request = requests_.front();
+  HttpCache* cache_ptr = HttpCache::GetInstance();
+  if (request.is_invalidating) {
+    cache_ptr->Invalidate(request.cache_key);
+    request.cache_key.clear();
+  } else if (!request.cache_key.empty()) {
+    HttpParser request_parser;
+    if (request_parser.Append(request.data.data(), request.data.size()) ==
+            HttpParser::AppendResult::READY_REQUEST &&
+        cache_ptr->Lookup(request.cache_key, request_parser,
+                          &request.cached_response)) {
+      request.cache_key.clear();
+    }
+  }
+  const HttpCache::Response& cached_response = request.cached_response;
+  if (cached_response.body != nullptr || cached_response.file != nullptr) {
+    is_sending_cached_response_ = true;
+    cached_response_pos_ = 0;
+    SendCachedResponse();
+    return;
+  }
+  std::string host = requests_.front().host;
+  std::string port = requests_.front().port;
+  // Client may be gone by the time the answer comes, so it's found by id.
+  // Answer is posted to the loop even if it's ready at once, so the
+  // exchange doesn't start inside this call; answer of another loop's
+  // resolution comes from its thread.
+  ServerSocket* server_tmp_ptr = server_ptr_;
+  uint64_t id_tmp = id_;
+  DnsCache::Callback callback =
+      [server_tmp_ptr, id_tmp](const std::vector<sockaddr_storage>& resolved) {
+        server_tmp_ptr->PostToClient(
+            id_tmp, [resolved](ClientSocket* client_ptr) {
+              client_ptr->ConnectExternalServer(resolved);
+            });
+      };
+  std::vector<sockaddr_storage> addresses;
+  switch (DnsCache::GetInstance()->Lookup(host, port, &addresses, callback)) {
+    case (DnsCache::HIT):
+      ConnectExternalServer(addresses);
+      return;
+
+    case (DnsCache::STALE):
+      // Refreshed addresses are only stored to the cache.
+      server_ptr_->GetDnsResolverPtr()->Resolve(
+          host, port, [](const std::vector<sockaddr_storage>&) {});
+      ConnectExternalServer(addresses);
+      return;
+
+    case (DnsCache::NEGATIVE):
+      ConnectExternalServer(addresses);
       return;
 
-    case (HttpParser::AppendResult::SUCCESS):
+    case (DnsCache::PENDING):
       return;
 
     default:
-      LOGE << "Unsupported Append Result; fd: " << GetFD()
-           << "; close connection";
-      Disconnect();
+      break;
+  }
+  server_ptr_->GetDnsResolverPtr()->Resolve(host, port, callback);
+}
+
+void ClientSocket::ConnectExternalServer(
+    const std::vector<sockaddr_storage>& addresses) {
+  if (addresses.empty()) {
+    LOGE << "Error to resolve external server; client: " << GetFD();
+    KillExternalServer();
+    return;
+  }
+  // Tunnel may carry anything, so it always gets a fresh connection.
+  if (!requests_.front().is_connect) {
+    external_server_ptr_ =
+        server_ptr_->GetUpstreamPoolPtr()->Acquire(addresses);
+  }
+  if (external_server_ptr_ != nullptr) {
+    external_server_ptr_->Attach(this);
+    SendRequest();
+    return;
+  }
+  addresses_ = addresses;
+  next_address_ = 0;
+  StartConnectAttempt();
+}
+
+void ClientSocket::StartConnectAttempt() {
+  while (next_address_ < addresses_.size()) {
+    const sockaddr_storage& address = addresses_[next_address_++];
+    int external_server_socket_fd = net_utils::StartConnect(address);
+    if (external_server_socket_fd < 0) {
+      continue;
+    }
+    try {
+      connect_attempts_.emplace_back(
+          new ExternalServerSocket(external_server_socket_fd,
+                                   GetEpollPtr(),
+                                   this,
+                                   address));
+    } catch (...) {
+      continue;
+    }
+    return;
+  }
+  if (!connect_attempts_.empty()) {
+    return;
+  }
+  LOGE << "Error to connect to external server; client: " << GetFD();
+  addresses_.clear();
+  KillExternalServer();
+}
+
+void ClientSocket::OnExternalServerConnected(
+    ExternalServerSocket* attempt_ptr) {
+  for (auto& connect_attempt_ptr : connect_attempts_) {
+    if (connect_attempt_ptr.get() == attempt_ptr) {
+      external_server_ptr_ = std::move(connect_attempt_ptr);
+      break;
+    }
+  }
+  connect_attempts_.clear();
+  addresses_.clear();
+  server_ptr_->SetBusyPoll(external_server_ptr_->GetFD());
+  SendRequest();
+}
+
+void ClientSocket::OnConnectAttemptDelayed() {
+  StartConnectAttempt();
+}
+
+void ClientSocket::OnConnectFailed(ExternalServerSocket* attempt_ptr,
+                                   bool is_next_started) {
+  for (auto it = connect_attempts_.begin(); it != connect_attempts_.end();
+       ++it) {
+    if (it->get() == attempt_ptr) {
+      connect_attempts_.erase(it);
+      break;
+    }
+  }
+  if (!is_next_started || connect_attempts_.empty()) {
+    StartConnectAttempt();
+  }
+}
+
+void ClientSocket::SendRequest() {
+  const Request& request = requests_.front();
+  if (request.is_connect) {
+    StartTunnel();
+    return;
+  }
+  external_server_ptr_->ReceiveMessageFromParent(request.data,
+                                                 request.is_head,
+                                                 request.cache_key);
+}
+
+void ClientSocket::SendCachedResponse() {
+  const HttpCache::Response& response = requests_.front().cached_response;
+  size_t header_size = response.header.size();
+  size_t size = header_size + ((response.body != nullptr)
+                                   ? (response.body->size())
+                                   : (response.file_size));
+  // Data in the pipe is sent after the buffer, so it has to be drained first.
+  while (cached_response_pos_ < size && !IsOutputOverloaded() &&
+         !HasSplicedOutput()) {
+    if (cached_response_pos_ >= header_size && response.file != nullptr) {
+      if (!IOFileDescriptor::IsEmpty() || !SendFileBody()) {
+        return;
+      }
+      break;
+    }
+    const char* data = nullptr;
+    size_t part_size = 0;
+    if (cached_response_pos_ < header_size) {
+      data = response.header.data() + cached_response_pos_;
+      part_size = header_size - cached_response_pos_;
+    } else {
+      data = response.body->data() + cached_response_pos_ - header_size;
+      part_size = size - cached_response_pos_;
+    }
+    part_size = std::min(part_size, IOFileDescriptor::GetFreeSpace());
+    if (!ReceiveMessageFromExternalServer(data, part_size)) {
       return;
+    }
+    cached_response_pos_ += part_size;
+  }
+  if (cached_response_pos_ == size) {
+    is_sending_cached_response_ = false;
+    FinishExchange(true);
   }
 }
 
-// static
-void ClientSocket::CreateExternalServer(std::string host,
-                                        std::string port,
-                                        ServerSocket* server_ptr,
-                                        uint64_t id) {
-  int external_server_socket_fd =
-      net_utils::CreateExternalServerSocket(
-            host.c_str(),
-            (port != "") ? (port.c_str()) : (kConstPortNumberString));
-  server_ptr->AddExternalServerToQueue(external_server_socket_fd, id);
+bool ClientSocket::SendFileBody() {
+  const HttpCache::Response& response = requests_.front().cached_response;
+  size_t size = response.header.size() + response.file_size;
+  while (cached_response_pos_ < size) {
+    uint64_t offset = response.file_offset + cached_response_pos_ -
+                      response.header.size();
+    ssize_t was_sent = net_utils::SendFile(GetFD(), response.file->GetFD(),
+                                           &offset,
+                                           size - cached_response_pos_);
+    if (was_sent > 0) {
+      cached_response_pos_ += was_sent;
+      continue;
+    }
+    if (was_sent < 0 && errno == EAGAIN) {
+      if (!(EpollRecord::GetFlags() & EpollRecord::OUT) &&
+          !EpollRecord::AddFlag(EpollRecord::OUT)) {
+        LOGE << "Error to wait for sending cached file; client: " << GetFD()
+             << "; close connection";
+        Disconnect();
+        return false;
+      }
+      return true;
+    }
+    LOGE << "Error to send cached file to client: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return false;
+  }
+  // Output is empty now, so OUT is removed as it is after the buffer.
+  if ((EpollRecord::GetFlags() & EpollRecord::OUT) &&
+      !EpollRecord::RemoveFlag(EpollRecord::OUT)) {
+    LOGE << "Error to remove OUT flag after sending cached file; client: "
+         << GetFD() << "; close connection";
+    Disconnect();
+    return false;
+  }
+  return true;
 }
 
-void ClientSocket::SetExternalServer(int external_server_socket_fd) {
-  if (external_server_socket_fd < 0) {
-    LOGE << "Error to create external server; client: " << GetFD();
-    KillExternalServer();
+void ClientSocket::StartTunnel() {
+  LOGI << "Tunnel was established; client: " << GetFD() << "; ext_server: "
+       << external_server_ptr_->GetFD();
+  is_tunnel_ = true;
+  EpollRecord::SetTimeout(
+      AdvancedTime::FromMilliseconds(kTimeoutForTunnelIdleMs));
+  external_server_ptr_->StartTunnel(
+      AdvancedTime::FromMilliseconds(kTimeoutForTunnelIdleMs));
+  std::string data = std::move(requests_.front().data);
+  if (!ReceiveMessageFromExternalServer(kConnectionEstablished,
+                                        sizeof(kConnectionEstablished) - 1)) {
     return;
   }
-  try {
-    external_server_ptr_.reset(
-        new ExternalServerSocket(external_server_socket_fd,
-                                 GetEpollPtr(),
-                                 this));
-  } catch (...) {
-    KillExternalServer();
+  if (!data.empty() &&
+      !external_server_ptr_->ReceiveTunnelData(data.data(), data.size())) {
+    return;
+  }
+  if (!EpollRecord::AddFlag(EpollRecord::IN)) {
+    LOGE << "Error to resume reading of client: " << GetFD()
+         << "; close connection";
+    Disconnect();
     return;
   }
+  // Data may have arrived while reading was stopped, so edge could be missed.
+  if (EpollRecord::IsEdgeTriggered()) {
+    EpollRecord::ScheduleIn();
+  }
+}
 
-  parser_.ModifyHeader();
+void ClientSocket::RelayTunnelInput() {
+  if (is_tunnel_input_closed_) {
+    return;
+  }
+  if (external_server_ptr_->IsOutputOverloaded()) {
+    is_waiting_for_space_ = true;
+    // Level-triggered record would be woken up by the unread data.
+    if (!EpollRecord::IsEdgeTriggered()) {
+      EpollRecord::RemoveFlag(EpollRecord::IN);
+    }
+    return;
+  }
+  base::ReceiveBuffer message;
+  bool is_open = EpollRecord::ReadInput(&message,
+                                        external_server_ptr_->GetFreeSpace());
+  if (!message.IsEmpty() &&
+      !external_server_ptr_->ReceiveTunnelData(message.GetData(),
+                                               message.GetSize())) {
+    return;
+  }
+  if (!is_open) {
+    LOGI << "Client closed tunnel input; fd: " << GetFD();
+    is_tunnel_input_closed_ = true;
+    is_waiting_for_space_ = false;
+    if (!EpollRecord::RemoveFlag(EpollRecord::IN)) {
+      LOGE << "Error to remove IN flag. Fd: " << GetFD();
+      Disconnect();
+      return;
+    }
+    external_server_ptr_->ShutdownOnSend();
+  }
+}
+
+void ClientSocket::OnTunnelSpaceAvailable() {
+  if (!is_waiting_for_space_) {
+    return;
+  }
+  is_waiting_for_space_ = false;
+  // Time spent waiting isn't counted as idle.
+  EpollRecord::ResetDeadline();
+  if (EpollRecord::IsEdgeTriggered()) {
+    EpollRecord::ScheduleIn();
+  } else {
+    EpollRecord::AddFlag(EpollRecord::IN);
+  }
+}
 
-  external_server_ptr_->ReceiveMessageFromParent(parser_.GetRequest());
+void ClientSocket::ShutdownOnSend() {
+  if (IsOutputEmpty()) {
+    ShutdownOutput();
+    return;
+  }
+  is_shutdown_on_send_ = true;
+}
+
+void ClientSocket::ShutdownOutput() {
+  is_shutdown_on_send_ = false;
+  if (!net_utils::ShutdownOutput(GetFD())) {
+    LOGE << "Error to shutdown tunnel output; client: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return;
+  }
+  is_output_shutdown_ = true;
+  OnTunnelHalfClosed();
+}
+
+void ClientSocket::OnTunnelHalfClosed() {
+  if (is_output_shutdown_ && external_server_ptr_->IsOutputShutdown()) {
+    LOGI << "Tunnel was closed; client: " << GetFD();
+    Disconnect();
+  }
 }
 
 void ClientSocket::OnOut() {
-  if (IOFileDescriptor::IsEmpty()) {
+  if (IsOutputEmpty()) {
     LOGE << "Nothing to write. Client: " << GetFD() << "; close connection";
     Disconnect();
     return;
   }
-  if (!IOFileDescriptor::Write()) {
+  if (!IOFileDescriptor::IsEmpty() && !EpollRecord::WriteOutput()) {
     LOGE << "Writing error. Client: " << GetFD() << "; close connection";
     Disconnect();
     return;
   }
-  if (IOFileDescriptor::IsEmpty()) {
+  if (IOFileDescriptor::IsEmpty() && pipe_ != nullptr && !FlushPipe()) {
+    LOGE << "Splice error. Client: " << GetFD() << "; close connection";
+    Disconnect();
+    return;
+  }
+  if (external_server_ptr_ != nullptr &&
+      GetOutputSize() <= kOutputLowWatermark) {
+    external_server_ptr_->OnParentSpaceAvailable();
+  }
+  if (IsOutputEmpty()) {
     if (!EpollRecord::RemoveFlag(EpollRecord::OUT)) {
       LOGE << "Error to remove OUT flag from client after buffer became empty"
            << "; client: " << GetFD() << "; close connection";
       Disconnect();
+      return;
     }
 
     if (is_disconnect_on_send_) {
       Disconnect();
+      return;
+    } else if (is_shutdown_on_send_) {
+      ShutdownOutput();
+      return;
     }
   }
+  // Drained output has no OUT flag, so appending sets it again and
+  // edge-triggered record gets a new edge.
+  if (is_sending_cached_response_ &&
+      GetOutputSize() <= kOutputLowWatermark) {
+    SendCachedResponse();
+  }
 }
 
 void ClientSocket::OnTimeExpired() {
+  if (is_tunnel_ && is_waiting_for_space_) {
+    // Reading is paused by the server's backpressure, so the client isn't
+    // idle; server which stops reading is expired by its own deadline.
+    EpollRecord::SetTimeout(EpollRecord::GetTimeout());
+    return;
+  }
   LOGW << "Time expired for client: " << GetFD();
   Disconnect();
 }
 
 void ClientSocket::OnError() {
+  // Client has closed the tunnel after server's half-close; the rest of its
+  // data is read as usual.
+  if (is_tunnel_ && net_utils::GetSocketError(GetFD()) == 0) {
+    EpollRecord::SwitchToEdgeTriggered();
+    OnIn();
+    return;
+  }
   LOGE << "Error ocurred for client: " << GetFD();
   Disconnect();
 }
 
+const char* ClientSocket::GetTypeName() const {
+  return "ClientSocket";
+}
+
 void ClientSocket::Disconnect() {
   server_ptr_->KillClient(id_);
 }
 
 void ClientSocket::DisconnectOnSend() {
-  if (IOFileDescriptor::IsEmpty()) {
+  if (IsOutputEmpty()) {
     Disconnect();
     return;
   }
@@ -163,32 +576,164 @@ void ClientSocket::DisconnectOnSend() {
   is_disconnect_on_send_ = true;
 }
 
+void ClientSocket::ReleaseExternalServer() {
+  server_ptr_->GetUpstreamPoolPtr()->Release(std::move(external_server_ptr_));
+  FinishExchange(true);
+}
+
+void ClientSocket::CloseExternalServer() {
+  external_server_ptr_.reset(nullptr);
+  FinishExchange(true);
+}
+
 void ClientSocket::KillExternalServer() {
   external_server_ptr_.reset(nullptr);
+  FinishExchange(false);
+}
 
-  uint32_t flags = EpollRecord::GetFlags();
-  if (!EpollRecord::SetFlags(flags | EpollRecord::IN)) {
-    LOGE << "Error to restore IN flag after kill external server; client: "
-         << GetFD() << "; close connection";
+void ClientSocket::FinishExchange(bool is_response_complete) {
+  is_exchange_active_ = false;
+  if (!requests_.empty()) {
+    requests_.pop_front();
+  }
+  if (!is_response_complete || (is_input_finished_ && requests_.empty())) {
+    requests_.clear();
+    // Closed input is noticed while the rest of output is sent.
+    uint32_t flags = EpollRecord::GetFlags();
+    if (!EpollRecord::SetFlags(flags | EpollRecord::IN)) {
+      LOGE << "Error to restore IN flag after kill external server; client: "
+           << GetFD() << "; close connection";
+    }
+    DisconnectOnSend();
+    return;
+  }
+  if (!is_input_finished_ && requests_.size() < kMaxQueuedRequests &&
+      !EpollRecord::AddFlag(EpollRecord::IN)) {
+    LOGE << "Error to resume reading of client: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return;
   }
-  DisconnectOnSend();
+  StartNextExchange();
 }
 
-void ClientSocket::ReceiveMessageFromExternalServer(const std::string& data) {
-  if (!IOFileDescriptor::Append(data.c_str(), data.size())) {
+bool ClientSocket::ReceiveMessageFromExternalServer(const char* data,
+                                                    size_t size) {
+  if (!IOFileDescriptor::Append(data, size)) {
     LOGE << "Client buffer overflowed; fd: " << GetFD()
          << "; close connection";
     Disconnect();
-    return;
+    return false;
   }
   uint32_t flags = EpollRecord::GetFlags();
   if (flags & EpollRecord::OUT) {
-    return;
+    return true;
   }
   if (!EpollRecord::AddFlag(EpollRecord::OUT)) {
     LOGE << "Error to change flags after receiving message; client: "
          << GetFD() << "; close connection";
   }
+  return true;
+}
+
+bool ClientSocket::CanSplice() {
+  // Pipe is kept between responses, but data read in user space (e.g. the
+  // header of the next response) has to be sent first.
+  if (!IOFileDescriptor::IsEmpty()) {
+    return false;
+  }
+  if (pipe_ != nullptr) {
+    return true;
+  }
+  if (!GetEpollPtr()->GetOptions().splice_relay) {
+    return false;
+  }
+  pipe_ = server_ptr_->GetPipePoolPtr()->Acquire();
+  return pipe_ != nullptr;
+}
+
+ClientSocket::RelayResult ClientSocket::SpliceFromExternalServer(
+    int external_server_fd, size_t limit, size_t* was_moved_ptr) {
+  RelayResult result = RELAY_WOULD_BLOCK;
+  size_t& was_moved = *was_moved_ptr;
+  for (;;) {
+    // Pipe is emptied first, so it's full only if the client is slow.
+    if (!FlushPipe()) {
+      LOGE << "Splice error. Client: " << GetFD() << "; close connection";
+      Disconnect();
+      return RELAY_DISCONNECTED;
+    }
+    if (pipe_->IsFull()) {
+      result = RELAY_PIPE_FULL;
+      break;
+    }
+    // Level-triggered record is called again while data is available.
+    if (was_moved > 0 && !EpollRecord::IsEdgeTriggered()) {
+      break;
+    }
+    if (was_moved == limit) {
+      break;
+    }
+    if (was_moved >= kSpliceBudget) {
+      result = RELAY_BUDGET_EXHAUSTED;
+      break;
+    }
+    ssize_t moved = pipe_->SpliceFrom(external_server_fd, limit - was_moved);
+    if (moved > 0) {
+      was_moved += moved;
+      continue;
+    }
+    if (moved == 0) {
+      result = RELAY_END_OF_FILE;
+    } else if (errno != EAGAIN) {
+      LOGE << "Error to splice from external server: " << external_server_fd;
+      result = RELAY_ERROR;
+    }
+    break;
+  }
+  FLOGI << "Spliced " << was_moved << " bytes to client: " << GetFD();
+
+  if (!pipe_->IsEmpty() && !(EpollRecord::GetFlags() & EpollRecord::OUT)) {
+    EpollRecord::AddFlag(EpollRecord::OUT);
+  }
+  return result;
+}
+
+bool ClientSocket::FlushPipe() {
+  while (!pipe_->IsEmpty()) {
+    ssize_t moved = pipe_->SpliceTo(GetFD());
+    if (moved > 0) {
+      continue;
+    }
+    return moved < 0 && errno == EAGAIN;
+  }
+  return true;
+}
+
+bool ClientSocket::HasSplicedOutput() const {
+  return pipe_ != nullptr && !pipe_->IsEmpty();
+}
+
+bool ClientSocket::IsOutputOverloaded() const {
+  return GetOutputSize() >= kOutputHighWatermark;
+}
+
+size_t ClientSocket::GetOutputSize() const {
+  size_t size = IOFileDescriptor::GetSize();
+  if (pipe_ != nullptr) {
+    size += pipe_->GetSize();
+  }
+  return size;
+}
+
+bool ClientSocket::IsOutputEmpty() const {
+  return IOFileDescriptor::IsEmpty() &&
+         (pipe_ == nullptr || pipe_->IsEmpty()) && !IsFileBodyPending();
+}
+
+bool ClientSocket::IsFileBodyPending() const {
+  return is_sending_cached_response_ && !requests_.empty() &&
+         requests_.front().cached_response.file != nullptr;
 }
 
 }  // namespace sockets
@@ -1,13 +1,21 @@
 #ifndef SOCKETS_CLIENT_SOCKET_H_
 #define SOCKETS_CLIENT_SOCKET_H_
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <deque>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "advanced_time.h"
 #include "epoll.h"
 #include "epoll_record.h"
 #include "external_server_socket.h"
+#include "http_cache.h"
 #include "http_parser.h"
+#include "pipe.h"
 
 namespace sockets {
 
@@ -15,6 +23,16 @@ class ServerSocket;
 
 class ClientSocket : public epoll::EpollRecord {
  public:
+  enum RelayResult {
+    RELAY_WOULD_BLOCK,
+    RELAY_BUDGET_EXHAUSTED,
+    RELAY_PIPE_FULL,
+    RELAY_END_OF_FILE,
+    RELAY_ERROR,
+    // Client was disconnected together with its external server.
+    RELAY_DISCONNECTED
+  };
+
   ClientSocket(int fd, std::shared_ptr<epoll::Epoll> epoll_ptr,
                ServerSocket* server_ptr, uint64_t id);
 
@@ -24,24 +42,135 @@ class ClientSocket : public epoll::EpollRecord {
   void OnOut() override;
   void OnTimeExpired() override;
   void OnError() override;
+  const char* GetTypeName() const override;
 
   void Disconnect();
   void DisconnectOnSend();
 
-  static void CreateExternalServer(std::string host,
-                                   std::string port,
-                                   ServerSocket* server_ptr,
-                                   uint64_t id);
-  void SetExternalServer(int external_server_socket_fd);
+  // Takes idle connection from the upstream pool or opens a new one. New
+  // connection is raced across the addresses: attempts start one after
+  // another with a delay and the first connected one wins.
+  void ConnectExternalServer(const std::vector<sockaddr_storage>& addresses);
+  // Losing attempts are closed.
+  void OnExternalServerConnected(ExternalServerSocket* attempt_ptr);
+  void OnConnectAttemptDelayed();
+  // Destroys the attempt. The next address is tried unless it has already
+  // been started because of delay.
+  void OnConnectFailed(ExternalServerSocket* attempt_ptr,
+                       bool is_next_started);
   void KillExternalServer();
-  void ReceiveMessageFromExternalServer(const std::string& data);
+  // Response was relayed and the server keeps the connection alive; the
+  // next queued request is processed.
+  void ReleaseExternalServer();
+  // Response was relayed but the server's connection can't be reused; it's
+  // closed and the next queued request is processed.
+  void CloseExternalServer();
+  // Returns false if client was disconnected.
+  bool ReceiveMessageFromExternalServer(const char* data, size_t size);
+  // External server stops reading while output buffered for the client is
+  // above the high watermark; it's resumed through OnParentSpaceAvailable
+  // once output is drained below the low watermark.
+  bool IsOutputOverloaded() const;
+  // Data read in user space can't be queued behind spliced data which is
+  // still in the pipe.
+  bool HasSplicedOutput() const;
+
+  // Response can be relayed with splice if it's enabled and nothing is
+  // buffered in user space.
+  bool CanSplice();
+  // Moves data which is available in external server's socket to the
+  // client through the pipe, no more than limit bytes. Number of moved
+  // bytes is stored to was_moved.
+  RelayResult SpliceFromExternalServer(int external_server_fd, size_t limit,
+                                       size_t* was_moved);
+
+  // Output buffered for the external server of the tunnel was drained below
+  // the low watermark.
+  void OnTunnelSpaceAvailable();
+  // Client is told that server has nothing more to send once buffered output
+  // is written.
+  void ShutdownOnSend();
+  // Tunnel is closed once both directions are half-closed.
+  void OnTunnelHalfClosed();
 
  private:
+  // Parsed request which waits for its turn. Requests are processed one at a
+  // time, so responses are written in order.
+  struct Request {
+    std::string data;
+    std::string host;
+    std::string port;
+    bool is_head;
+    // Data of CONNECT is what client has sent after it to the tunnel.
+    bool is_connect;
+    // Empty if response can't be cached.
+    std::string cache_key;
+    // Request may change the resource, so its cached response is dropped.
+    bool is_invalidating;
+    // Response found in the cache when the exchange started; body and file
+    // are null on miss.
+    net_utils::HttpCache::Response cached_response;
+  };
+
+  void QueueRequest();
+  // Resolves the server of the first queued request unless its exchange has
+  // already started.
+  void StartNextExchange();
+  // Starts connect to the next address which accepts it; external server
+  // is killed if none is left and no attempt is in progress.
+  void StartConnectAttempt();
+  void SendRequest();
+  // Appends cached response of the first request to the output as it's
+  // drained, the way relayed response is; exchange is finished once it's
+  // all appended. Body which is in a file is sent with sendfile after the
+  // buffered header.
+  void SendCachedResponse();
+  // Sends file body until socket would block. Returns false if client was
+  // disconnected.
+  bool SendFileBody();
+  // Answers CONNECT and switches both sockets to relaying bytes as is.
+  void StartTunnel();
+  // Moves client's input to the external server of the tunnel.
+  void RelayTunnelInput();
+  void ShutdownOutput();
+  // External server of the first request is gone. Client is closed once
+  // output is sent unless the response was complete and client keeps the
+  // connection alive.
+  void FinishExchange(bool is_response_complete);
+  // Returns false on writing error.
+  bool FlushPipe();
+  // File body which isn't sent yet is a part of the output.
+  bool IsOutputEmpty() const;
+  bool IsFileBodyPending() const;
+  // Bytes in user-space buffer and in the pipe.
+  size_t GetOutputSize() const;
+
   ServerSocket* const server_ptr_;
   net_utils::HttpParser parser_;
   std::unique_ptr<ExternalServerSocket> external_server_ptr_;
+  std::unique_ptr<base::Pipe> pipe_;
+  std::deque<Request> requests_;
+  // Addresses of the server of the first request which are tried in turn.
+  std::vector<sockaddr_storage> addresses_;
+  size_t next_address_;
+  std::vector<std::unique_ptr<ExternalServerSocket>> connect_attempts_;
+  // Bytes of cached response which were appended to the output.
+  size_t cached_response_pos_;
   uint64_t id_;
   bool is_disconnect_on_send_;
+  // First request is being sent or its response is being relayed.
+  bool is_exchange_active_;
+  bool is_sending_cached_response_;
+  // Client has closed input or asked to close the connection; no requests
+  // are read anymore.
+  bool is_input_finished_;
+  // CONNECT was answered; HTTP isn't parsed anymore.
+  bool is_tunnel_;
+  bool is_tunnel_input_closed_;
+  // Reading is paused until OnTunnelSpaceAvailable.
+  bool is_waiting_for_space_;
+  bool is_shutdown_on_send_;
+  bool is_output_shutdown_;
 };
 
 }  // namespace sockets
@@ -0,0 +1,385 @@
+#include "dns_resolver.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "advanced_time.h"
+#include "dns_cache.h"
+#include "dns_message.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "logger.h"
+#include "net_utils.h"
+
+namespace sockets {
+
+using base::AdvancedTime;
+using epoll::Epoll;
+using epoll::EpollRecord;
+using net_utils::DnsCache;
+using net_utils::DnsResponse;
+
+namespace {
+
+const char kHostsFilePath[] = "/etc/hosts";
+// Answers are read in one wakeup up to this number; level-triggered record
+// is woken up again for the rest.
+const size_t kMaxResponsesPerWakeup = 64;
+// Answers without EDNS are limited by 512 bytes; bigger ones are cut.
+const size_t kMaxResponseSize = 4096;
+// Protects from a burst of distinct names when the server doesn't answer.
+const size_t kMaxPendingQueries = 4096;
+// Time the slower family has after the other one returned addresses.
+const uint64_t kResolutionDelayMs = 50;
+
+std::string NormalizeName(const std::string& host) {
+  std::string name = host;
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+  return name;
+}
+
+bool ParsePort(const std::string& port, uint16_t* result) {
+  char* end = nullptr;
+  unsigned long value = strtoul(port.c_str(), &end, 10);
+  if (port.empty() || *end != '\0' || value == 0 || value > UINT16_MAX) {
+    return false;
+  }
+  *result = value;
+  return true;
+}
+
+// Families are interleaved (RFC 8305), so a broken family delays
+// connection by one attempt only.
+std::vector<sockaddr_storage> MakeAddresses(
+    const std::vector<std::string>& ipv6_addresses,
+    const std::vector<std::string>& ipv4_addresses, uint16_t port) {
+  std::vector<sockaddr_storage> addresses;
+  for (size_t i = 0;
+       i < std::max(ipv6_addresses.size(), ipv4_addresses.size()); ++i) {
+    sockaddr_storage address;
+    if (i < ipv6_addresses.size() &&
+        net_utils::MakeAddress(ipv6_addresses[i], port, &address)) {
+      addresses.push_back(address);
+    }
+    if (i < ipv4_addresses.size() &&
+        net_utils::MakeAddress(ipv4_addresses[i], port, &address)) {
+      addresses.push_back(address);
+    }
+  }
+  return addresses;
+}
+
+}  // namespace
+
+DnsResolver::DnsResolver(std::shared_ptr<Epoll> epoll_ptr,
+                         const net_utils::ResolverConfig& config) :
+    EpollRecord(net_utils::CreateUdpSocket(), epoll_ptr, EpollRecord::IN,
+                AdvancedTime::Infinity()),
+    config_(config),
+    random_(std::random_device()()) {
+  net_utils::ParseHostsFile(kHostsFilePath, &hosts_);
+  LOGI << "DNS Resolver was created; fd: " << GetFD() << "; servers: "
+       << config_.nameservers.size() << "; hosts: " << hosts_.size();
+}
+
+DnsResolver::~DnsResolver() {
+  LOGI << "DNS Resolver was destroyed; fd: " << GetFD();
+}
+
+void DnsResolver::Resolve(const std::string& host, const std::string& port,
+                          const Callback& callback) {
+  uint16_t port_number = 0;
+  if (!ParsePort(port, &port_number)) {
+    LOGE << "Wrong port: " << port << "; host: " << host;
+    DnsCache::GetInstance()->StoreFailure(host, port);
+    callback(std::vector<sockaddr_storage>());
+    return;
+  }
+  std::string name = NormalizeName(host);
+  sockaddr_storage address;
+  auto host_it = hosts_.find(name);
+  if (host_it != hosts_.end() ||
+      net_utils::MakeAddress(name, port_number, &address)) {
+    std::vector<sockaddr_storage> addresses;
+    if (host_it == hosts_.end()) {
+      addresses.push_back(address);
+    } else {
+      for (const std::string& ip : host_it->second) {
+        if (net_utils::MakeAddress(ip, port_number, &address)) {
+          addresses.push_back(address);
+        }
+      }
+    }
+    // They never change, so the longest TTL is used.
+    DnsCache::GetInstance()->Store(host, port, addresses, UINT32_MAX);
+    callback(addresses);
+    return;
+  }
+
+  Waiter waiter;
+  waiter.host = host;
+  waiter.port = port;
+  waiter.port_number = port_number;
+  waiter.callback = callback;
+  auto resolution_it = resolutions_.find(name);
+  if (resolution_it != resolutions_.end()) {
+    resolution_it->second.waiters.push_back(std::move(waiter));
+    return;
+  }
+  if (queries_.size() + 2 > kMaxPendingQueries ||
+      !StartQuery(name, net_utils::kDnsTypeAAAA) ||
+      !StartQuery(name, net_utils::kDnsTypeA)) {
+    LOGE << "Can't query name: " << host;
+    for (auto it = queries_.begin(); it != queries_.end();) {
+      if (it->second.name == name) {
+        timers_.Erase(it->second.timer_it);
+        it = queries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    DnsCache::GetInstance()->StoreFailure(host, port);
+    callback(std::vector<sockaddr_storage>());
+    return;
+  }
+  Resolution& resolution = resolutions_[name];
+  resolution.pending = 2;
+  resolution.waiters.push_back(std::move(waiter));
+  ArmTimer();
+}
+
+bool DnsResolver::StartQuery(const std::string& name, uint16_t type) {
+  std::string message;
+  uint16_t id = GenerateId();
+  if (!net_utils::BuildDnsQuery(id, name, type, &message)) {
+    return false;
+  }
+  Query& query = queries_[id];
+  query.name = name;
+  query.type = type;
+  query.message = std::move(message);
+  query.sent = 0;
+  AdvancedTime timeout = AdvancedTime::FromMilliseconds(config_.timeout_ms);
+  query.timer_it = timers_.Insert(id, timeout,
+                                  GetEpollPtr()->GetNow() + timeout);
+  Send(&query);
+  return true;
+}
+
+void DnsResolver::OnIn() {
+  char buffer[kMaxResponseSize];
+  for (size_t i = 0; i < kMaxResponsesPerWakeup; ++i) {
+    sockaddr_in source;
+    socklen_t source_size = sizeof(source);
+    ssize_t size = ::recvfrom(GetFD(), buffer, sizeof(buffer), 0,
+                              reinterpret_cast<sockaddr*>(&source),
+                              &source_size);
+    if (size < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        LOGE << "Error to receive DNS answer; fd: " << GetFD();
+      }
+      break;
+    }
+    OnResponse(buffer, size, source);
+  }
+  ProcessTimers();
+  ArmTimer();
+}
+
+void DnsResolver::OnOut() {
+  LOGE << "DNS Resolver doesn't wait for OUT; fd: " << GetFD();
+  EpollRecord::RemoveFlag(EpollRecord::OUT);
+}
+
+void DnsResolver::OnTimeExpired() {
+  ProcessTimers();
+  ArmTimer();
+}
+
+void DnsResolver::OnError() {
+  // Reading the error clears it; lost queries are sent again on timeout.
+  LOGW << "DNS Resolver socket error: " << net_utils::GetSocketError(GetFD())
+       << "; fd: " << GetFD();
+}
+
+const char* DnsResolver::GetTypeName() const {
+  return "DnsResolver";
+}
+
+void DnsResolver::OnResponse(const char* data, size_t size,
+                             const sockaddr_in& source) {
+  DnsResponse response;
+  if (!IsNameserver(source) ||
+      !net_utils::ParseDnsResponse(data, size, &response)) {
+    FLOGI << "Drop DNS message from " << net_utils::AddressToString(source);
+    return;
+  }
+  auto it = queries_.find(response.id);
+  if (it == queries_.end() || it->second.name != response.name ||
+      it->second.type != response.type) {
+    FLOGI << "Drop unexpected DNS answer; id: " << response.id;
+    return;
+  }
+  switch (response.rcode) {
+    case (net_utils::kDnsRcodeSuccess):
+      FinishQuery(response.id, &response);
+      return;
+
+    case (net_utils::kDnsRcodeNameError):
+      FinishQuery(response.id, nullptr);
+      return;
+
+    default:
+      FLOGE << "DNS server " << net_utils::AddressToString(source)
+            << " failed to answer for " << response.name << "; rcode: "
+            << static_cast<int>(response.rcode);
+      Retry(response.id);
+      return;
+  }
+}
+
+void DnsResolver::Retry(uint16_t id) {
+  Query& query = queries_[id];
+  if (query.sent == SIZE_MAX) {
+    FLOGI << "Stop waiting for " << query.name << "; type: " << query.type;
+    FinishQuery(id, nullptr);
+    return;
+  }
+  if (query.sent >= config_.attempts * config_.nameservers.size()) {
+    LOGE << "Error to resolve " << query.name << "; type: " << query.type
+         << "; no answer";
+    FinishQuery(id, nullptr);
+    return;
+  }
+  query.timer_it = timers_.Update(query.timer_it, GetEpollPtr()->GetNow());
+  Send(&query);
+}
+
+void DnsResolver::Send(Query* query) {
+  const sockaddr_in& server =
+      config_.nameservers[query->sent % config_.nameservers.size()];
+  ++query->sent;
+  // Lost query is sent again on timeout.
+  if (::sendto(GetFD(), query->message.data(), query->message.size(), 0,
+               reinterpret_cast<const sockaddr*>(&server),
+               sizeof(server)) < 0) {
+    FLOGE << "Error to send DNS query to "
+          << net_utils::AddressToString(server);
+  }
+}
+
+void DnsResolver::FinishQuery(uint16_t id,
+                              const net_utils::DnsResponse* response) {
+  auto it = queries_.find(id);
+  std::string name = it->second.name;
+  timers_.Erase(it->second.timer_it);
+  queries_.erase(it);
+
+  Resolution& resolution = resolutions_[name];
+  --resolution.pending;
+  if (response != nullptr) {
+    char ip[INET6_ADDRSTRLEN];
+    for (const in_addr& address : response->ipv4_addresses) {
+      ::inet_ntop(AF_INET, &address, ip, sizeof(ip));
+      resolution.ipv4_addresses.push_back(ip);
+    }
+    for (const in6_addr& address : response->ipv6_addresses) {
+      ::inet_ntop(AF_INET6, &address, ip, sizeof(ip));
+      resolution.ipv6_addresses.push_back(ip);
+    }
+    if (!response->ipv4_addresses.empty() ||
+        !response->ipv6_addresses.empty()) {
+      resolution.ttl = std::min(resolution.ttl, response->ttl);
+    }
+  }
+  if (resolution.pending == 0) {
+    Complete(name);
+    return;
+  }
+  bool has_addresses = !resolution.ipv4_addresses.empty() ||
+                       !resolution.ipv6_addresses.empty();
+  if (!has_addresses) {
+    return;
+  }
+  // Other family gets a short time to answer and isn't asked again.
+  AdvancedTime delay = AdvancedTime::FromMilliseconds(kResolutionDelayMs);
+  for (auto& query : queries_) {
+    if (query.second.name != name) {
+      continue;
+    }
+    query.second.sent = SIZE_MAX;
+    timers_.Erase(query.second.timer_it);
+    query.second.timer_it = timers_.Insert(query.first, delay,
+                                           GetEpollPtr()->GetNow() + delay);
+  }
+}
+
+void DnsResolver::Complete(const std::string& name) {
+  auto it = resolutions_.find(name);
+  Resolution resolution = std::move(it->second);
+  resolutions_.erase(it);
+
+  DnsCache* cache = DnsCache::GetInstance();
+  for (const Waiter& waiter : resolution.waiters) {
+    std::vector<sockaddr_storage> addresses =
+        MakeAddresses(resolution.ipv6_addresses, resolution.ipv4_addresses,
+                      waiter.port_number);
+    if (addresses.empty()) {
+      cache->StoreFailure(waiter.host, waiter.port);
+    } else {
+      cache->Store(waiter.host, waiter.port, addresses, resolution.ttl);
+    }
+    waiter.callback(addresses);
+  }
+}
+
+void DnsResolver::ProcessTimers() {
+  timers_.Advance(GetEpollPtr()->GetNow());
+  while (timers_.HasDue()) {
+    base::TimerContainer<uint16_t>::Iterator it = timers_.GetDue();
+    FLOGI << "DNS query timed out; id: " << it.GetValue();
+    Retry(it.GetValue());
+  }
+}
+
+void DnsResolver::ArmTimer() {
+  if (timers_.IsEmpty()) {
+    EpollRecord::SetTimeout(AdvancedTime::Infinity());
+    return;
+  }
+  AdvancedTime next = timers_.GetNextExpirationTime();
+  AdvancedTime now = GetEpollPtr()->GetNow();
+  EpollRecord::SetTimeout((next > now) ? (next - now)
+                                       : AdvancedTime::FromMilliseconds(0));
+}
+
+bool DnsResolver::IsNameserver(const sockaddr_in& address) const {
+  for (const sockaddr_in& server : config_.nameservers) {
+    if (server.sin_addr.s_addr == address.sin_addr.s_addr &&
+        server.sin_port == address.sin_port) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t DnsResolver::GenerateId() {
+  uint16_t id = 0;
+  do {
+    id = static_cast<uint16_t>(random_());
+  } while (queries_.count(id) != 0);
+  return id;
+}
+
+}  // namespace sockets
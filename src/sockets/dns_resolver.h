@@ -0,0 +1,107 @@
+#ifndef SOCKETS_DNS_RESOLVER_H_
+#define SOCKETS_DNS_RESOLVER_H_
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dns_message.h"
+#include "epoll.h"
+#include "epoll_record.h"
+#include "macros.h"
+#include "timer_container.h"
+
+namespace sockets {
+
+// Stub resolver which sends A and AAAA queries over UDP to the servers of
+// resolv.conf and waits for answers in the loop, so pending resolutions
+// don't hold threads. Query which isn't answered in time is sent again to
+// the next server. Resolutions of the same name are merged. Results are
+// stored to the DnsCache with families interleaved, IPv6 first, so
+// connection attempts alternate between them.
+class DnsResolver : public epoll::EpollRecord {
+ public:
+  // Gets empty addresses if the host can't be resolved.
+  typedef std::function<void(const std::vector<sockaddr_storage>&)> Callback;
+
+  DnsResolver(std::shared_ptr<epoll::Epoll> epoll_ptr,
+              const net_utils::ResolverConfig& config);
+  ~DnsResolver() override;
+
+  // Callback is called on the loop thread, possibly before Resolve returns
+  // (for numeric hosts and names of the hosts file).
+  void Resolve(const std::string& host, const std::string& port,
+               const Callback& callback);
+
+  void OnIn() override;
+  void OnOut() override;
+  void OnTimeExpired() override;
+  void OnError() override;
+  const char* GetTypeName() const override;
+
+ private:
+  struct Waiter {
+    // As they are given to Resolve; they make the key of the DnsCache.
+    std::string host;
+    std::string port;
+    uint16_t port_number;
+    Callback callback;
+  };
+
+  // Queries of both types for a name.
+  struct Resolution {
+    Resolution() : pending(0), ttl(UINT32_MAX) {}
+
+    std::vector<Waiter> waiters;
+    std::vector<std::string> ipv4_addresses;
+    std::vector<std::string> ipv6_addresses;
+    size_t pending;
+    uint32_t ttl;
+  };
+
+  struct Query {
+    std::string name;
+    uint16_t type;
+    std::string message;
+    // Number of sent copies; copy i goes to server i % servers.
+    size_t sent;
+    base::TimerContainer<uint16_t>::Iterator timer_it;
+  };
+
+  // Returns false if query can't be built.
+  bool StartQuery(const std::string& name, uint16_t type);
+  void OnResponse(const char* data, size_t size, const sockaddr_in& source);
+  // Sends the query to the next server or fails it after the last attempt.
+  void Retry(uint16_t id);
+  void Send(Query* query);
+  // Removes the query; resolution is completed when both queries are done.
+  // Response is nullptr if query failed.
+  void FinishQuery(uint16_t id, const net_utils::DnsResponse* response);
+  // Calls waiters; no addresses mean failure.
+  void Complete(const std::string& name);
+  void ProcessTimers();
+  // Sets record's timeout to the nearest retransmission.
+  void ArmTimer();
+  bool IsNameserver(const sockaddr_in& address) const;
+  uint16_t GenerateId();
+
+  const net_utils::ResolverConfig config_;
+  std::unordered_map<std::string, std::vector<std::string>> hosts_;
+  std::unordered_map<std::string, Resolution> resolutions_;
+  std::unordered_map<uint16_t, Query> queries_;
+  base::TimerContainer<uint16_t> timers_;
+  // Random ids make answers harder to spoof.
+  std::mt19937 random_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(DnsResolver);
+};
+
+}  // namespace sockets
+
+#endif  // SOCKETS_DNS_RESOLVER_H_
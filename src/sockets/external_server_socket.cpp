@@ -6,8 +6,11 @@
 #include "client_socket.h"
 #include "epoll.h"
 #include "epoll_record.h"
+#include "http_cache.h"
 #include "http_parser.h"
 #include "logger.h"
+#include "net_utils.h"
+#include "upstream_pool.h"
 
 namespace sockets {
 
@@ -15,21 +18,42 @@ using base::AdvancedTime;
 using base::IOFileDescriptor;
 using epoll::Epoll;
 using epoll::EpollRecord;
+using net_utils::HttpCache;
 using net_utils::HttpParser;
 
 namespace {
 
 const uint64_t kTimeoutForExternalServerIdleMs = 60000;
+// Next address is tried in parallel if connect takes longer (RFC 8305).
+const uint64_t kConnectAttemptDelayMs = 250;
+// Attempt is abandoned if connect takes longer.
+const uint64_t kTimeoutForConnectMs = 5000;
+// Reading of the client pauses when this much tunneled data is buffered for
+// the server and resumes when it's drained to the low watermark.
+const size_t kOutputHighWatermark = 64 * 1024;
+const size_t kOutputLowWatermark = 16 * 1024;
 
 }  // namespace
 
 ExternalServerSocket::ExternalServerSocket(int fd,
                                            std::shared_ptr<Epoll> epoll_ptr,
-                                           ClientSocket* parent_ptr) :
-    EpollRecord(fd, epoll_ptr, EpollRecord::IN,
-            AdvancedTime::FromMilliseconds(kTimeoutForExternalServerIdleMs)),
+                                           ClientSocket* parent_ptr,
+                                           const sockaddr_storage& address) :
+    EpollRecord(fd, epoll_ptr, EpollRecord::OUT | epoll_ptr->GetModeFlags(),
+                AdvancedTime::FromMilliseconds(kConnectAttemptDelayMs)),
     parent_ptr_(parent_ptr),
-    parser_(false) {
+    pool_ptr_(nullptr),
+    pool_key_(net_utils::AddressToString(address)),
+    parser_(false),
+    is_capturing_(false),
+    is_cacheability_checked_(false),
+    is_waiting_for_space_(false),
+    is_connecting_(true),
+    is_attempt_delayed_(false),
+    is_tunnel_(false),
+    is_input_closed_(false),
+    is_shutdown_on_send_(false),
+    is_output_shutdown_(false) {
   LOGI << "External Server was created; fd: " << GetFD();
 }
 
@@ -38,56 +62,339 @@ ExternalServerSocket::~ExternalServerSocket() {
 }
 
 void ExternalServerSocket::OnIn() {
-  std::string message = IOFileDescriptor::Read();
-  if (message == "") {
+  if (parent_ptr_ == nullptr) {
+    // Idle connection is woken up if server closes it or sends something
+    // unexpected; spurious wakeups are ignored.
+    if (EpollRecord::HasReceivedInput() ||
+        !net_utils::IsIdleConnectionAlive(GetFD())) {
+      LOGI << "Idle External Server was closed; fd: " << GetFD();
+      Disconnect();
+    }
+    return;
+  }
+  if (is_input_closed_) {
+    return;
+  }
+  if (parent_ptr_->IsOutputOverloaded()) {
+    WaitForParentSpace();
+    return;
+  }
+  // Only body which doesn't have to be parsed is relayed through the pipe;
+  // tunnel isn't parsed at all.
+  size_t opaque_length =
+      (is_tunnel_) ? (SIZE_MAX) : (parser_.GetOpaqueBodyLength());
+  if (opaque_length > 0 && !is_capturing_ && parent_ptr_->CanSplice()) {
+    RelayBySplice(opaque_length);
+    return;
+  }
+  if (parent_ptr_->HasSplicedOutput()) {
+    WaitForParentSpace();
+    return;
+  }
+  base::ReceiveBuffer message;
+  bool is_open = EpollRecord::ReadInput(&message,
+                                        parent_ptr_->GetFreeSpace());
+  HttpParser::AppendResult result = HttpParser::AppendResult::SUCCESS;
+  size_t size = message.GetSize();
+  if (!is_tunnel_ && size > 0) {
+    // Bytes after the end of the response would be taken by the client as
+    // the start of the next response, so they're dropped.
+    result = parser_.Append(message.GetData(), message.GetSize(), &size);
+  }
+  if (size > 0) {
+    if (is_capturing_) {
+      CaptureResponse(message.GetData(), size);
+    }
+    if (!parent_ptr_->ReceiveMessageFromExternalServer(message.GetData(),
+                                                       size)) {
+      return;
+    }
+  }
+  if (result == HttpParser::AppendResult::READY_RESPONSE) {
+    FinishResponse(is_open);
+    return;
+  }
+  if (!is_open && is_tunnel_) {
+    FinishTunnelInput();
+    return;
+  }
+  if (!is_open) {
     LOGI << "External Server read empty message; fd: " << GetFD()
          << "; close connection";
     Disconnect();
     return;
   }
-  parent_ptr_->ReceiveMessageFromExternalServer(message);
+  if (parent_ptr_->IsOutputOverloaded()) {
+    WaitForParentSpace();
+  }
 }
 
 void ExternalServerSocket::OnOut() {
+  if (parent_ptr_ == nullptr) {
+    return;
+  }
+  if (is_connecting_) {
+    FinishConnect();
+    return;
+  }
   if (IOFileDescriptor::IsEmpty()) {
     LOGE << "Nothing to write. External Server: " << GetFD()
          << "; close connection";
     Disconnect();
     return;
   }
-  if (!IOFileDescriptor::Write()) {
+  if (!EpollRecord::WriteOutput()) {
     LOGE << "Writing error. External Server: " << GetFD()
          << "; close connection";
     Disconnect();
     return;
   }
+  if (is_tunnel_ && IOFileDescriptor::GetSize() <= kOutputLowWatermark) {
+    parent_ptr_->OnTunnelSpaceAvailable();
+  }
   if (IOFileDescriptor::IsEmpty()) {
     uint32_t flags = EpollRecord::GetFlags();
     if (!EpollRecord::SetFlags(flags & (~EpollRecord::OUT))) {
       LOGE << "Error to set OUT flag after empty buffer of ext_server: "
            << GetFD() << "; close connection";
       Disconnect();
+      return;
+    }
+    if (is_shutdown_on_send_) {
+      ShutdownOutput();
     }
   }
 }
 
 void ExternalServerSocket::OnTimeExpired() {
+  if (is_connecting_ && !is_attempt_delayed_) {
+    is_attempt_delayed_ = true;
+    EpollRecord::SetTimeout(AdvancedTime::FromMilliseconds(
+        kTimeoutForConnectMs - kConnectAttemptDelayMs));
+    parent_ptr_->OnConnectAttemptDelayed();
+    return;
+  }
+  if (is_connecting_) {
+    LOGE << "Connect to " << pool_key_ << " was expired; fd: " << GetFD();
+    FailConnect();
+    return;
+  }
+  if (parent_ptr_ == nullptr) {
+    LOGI << "Idle External Server was expired; fd: " << GetFD();
+    Disconnect();
+    return;
+  }
+  if (is_waiting_for_space_) {
+    // Reading is paused by parent's backpressure, so the server isn't idle;
+    // client which stops reading is expired by its own deadline.
+    EpollRecord::SetTimeout(EpollRecord::GetTimeout());
+    return;
+  }
   LOGE << "External server was expired; fd: " << GetFD()
        << "; close connection";
   Disconnect();
 }
 
 void ExternalServerSocket::OnError() {
+  // Server has closed the tunnel after client's half-close; the rest of its
+  // data is read as usual.
+  if (is_tunnel_ && net_utils::GetSocketError(GetFD()) == 0) {
+    EpollRecord::SwitchToEdgeTriggered();
+    OnIn();
+    return;
+  }
+  if (is_connecting_) {
+    LOGE << "Error to connect to " << pool_key_ << "; fd: " << GetFD();
+    FailConnect();
+    return;
+  }
   LOGE << "External server error occured; fd: " << GetFD()
        << "; close connection";
   Disconnect();
 }
 
+const char* ExternalServerSocket::GetTypeName() const {
+  return "ExternalServerSocket";
+}
+
 void ExternalServerSocket::Disconnect() {
+  if (parent_ptr_ == nullptr) {
+    pool_ptr_->Remove(this);
+    return;
+  }
   parent_ptr_->KillExternalServer();
 }
 
-void ExternalServerSocket::ReceiveMessageFromParent(const std::string& data) {
+void ExternalServerSocket::FinishConnect() {
+  int error = net_utils::GetSocketError(GetFD());
+  if (error != 0) {
+    LOGE << "Error to connect to " << pool_key_ << "; fd: " << GetFD()
+         << "; error: " << error;
+    FailConnect();
+    return;
+  }
+  is_connecting_ = false;
+  if (!EpollRecord::SetFlags(EpollRecord::IN |
+                             GetEpollPtr()->GetModeFlags())) {
+    LOGE << "Error to set IN flag after connect; ext_server: " << GetFD()
+         << "; close connection";
+    FailConnect();
+    return;
+  }
+  // Spliced response is moved from the socket itself.
+  if (!GetEpollPtr()->GetOptions().splice_relay) {
+    EpollRecord::ReceiveAhead();
+  }
+  EpollRecord::SetTimeout(
+      AdvancedTime::FromMilliseconds(kTimeoutForExternalServerIdleMs));
+  LOGI << "External Server was connected to " << pool_key_ << "; fd: "
+       << GetFD();
+  parent_ptr_->OnExternalServerConnected(this);
+}
+
+void ExternalServerSocket::FailConnect() {
+  // Destroys this record.
+  parent_ptr_->OnConnectFailed(this, is_attempt_delayed_);
+}
+
+void ExternalServerSocket::Detach(UpstreamPool* pool_ptr,
+                                  AdvancedTime idle_timeout) {
+  parent_ptr_ = nullptr;
+  pool_ptr_ = pool_ptr;
+  is_waiting_for_space_ = false;
+  EpollRecord::SetFlags(EpollRecord::IN | GetEpollPtr()->GetModeFlags());
+  EpollRecord::SetTimeout(idle_timeout);
+}
+
+void ExternalServerSocket::Attach(ClientSocket* parent_ptr) {
+  parent_ptr_ = parent_ptr;
+  pool_ptr_ = nullptr;
+  EpollRecord::SetTimeout(
+      AdvancedTime::FromMilliseconds(kTimeoutForExternalServerIdleMs));
+}
+
+const std::string& ExternalServerSocket::GetPoolKey() const {
+  return pool_key_;
+}
+
+void ExternalServerSocket::CaptureResponse(const char* data, size_t size) {
+  if (!is_cacheability_checked_ && parser_.GetStatusCode() != 0) {
+    is_cacheability_checked_ = true;
+    if (!HttpCache::IsCacheable(parser_)) {
+      StopCapture();
+      return;
+    }
+  }
+  cache_response_.append(data, size);
+  if (cache_response_.size() > HttpCache::GetInstance()->GetMaxObjectSize()) {
+    StopCapture();
+  }
+}
+
+void ExternalServerSocket::StopCapture() {
+  is_capturing_ = false;
+  cache_key_.clear();
+  cache_request_.clear();
+  std::string().swap(cache_response_);
+}
+
+void ExternalServerSocket::FinishResponse(bool is_open) {
+  if (is_capturing_) {
+    HttpCache::GetInstance()->Store(cache_key_, cache_request_, parser_,
+                                    std::move(cache_response_));
+    StopCapture();
+  }
+  // Server may still read the request if it has answered early.
+  if (!is_open || !parser_.IsKeepAlive() || !IOFileDescriptor::IsEmpty()) {
+    LOGI << "External Server finished response; fd: " << GetFD()
+         << "; close connection";
+    parent_ptr_->CloseExternalServer();
+    return;
+  }
+  LOGI << "External Server finished response; fd: " << GetFD()
+       << "; keep connection";
+  parent_ptr_->ReleaseExternalServer();
+}
+
+void ExternalServerSocket::RelayBySplice(size_t limit) {
+  size_t was_moved = 0;
+  ClientSocket::RelayResult result =
+      parent_ptr_->SpliceFromExternalServer(GetFD(), limit, &was_moved);
+  if (result == ClientSocket::RELAY_DISCONNECTED) {
+    return;
+  }
+  if (was_moved > 0 && !is_tunnel_ &&
+      parser_.SkipBody(was_moved) == HttpParser::AppendResult::READY_RESPONSE) {
+    FinishResponse(result != ClientSocket::RELAY_END_OF_FILE &&
+                   result != ClientSocket::RELAY_ERROR);
+    return;
+  }
+  switch (result) {
+    case (ClientSocket::RELAY_WOULD_BLOCK):
+      return;
+
+    case (ClientSocket::RELAY_BUDGET_EXHAUSTED):
+      EpollRecord::ScheduleIn();
+      return;
+
+    case (ClientSocket::RELAY_PIPE_FULL):
+      WaitForParentSpace();
+      return;
+
+    case (ClientSocket::RELAY_END_OF_FILE):
+      if (is_tunnel_) {
+        FinishTunnelInput();
+        return;
+      }
+      LOGI << "External Server finished relay; fd: " << GetFD()
+           << "; close connection";
+      Disconnect();
+      return;
+
+    case (ClientSocket::RELAY_DISCONNECTED):
+      return;
+
+    default:
+      LOGE << "Relay error. External Server: " << GetFD()
+           << "; close connection";
+      Disconnect();
+      return;
+  }
+}
+
+void ExternalServerSocket::WaitForParentSpace() {
+  is_waiting_for_space_ = true;
+  // Level-triggered record would be woken up by the unread data.
+  if (!EpollRecord::IsEdgeTriggered()) {
+    EpollRecord::RemoveFlag(EpollRecord::IN);
+  }
+}
+
+void ExternalServerSocket::OnParentSpaceAvailable() {
+  if (!is_waiting_for_space_) {
+    return;
+  }
+  is_waiting_for_space_ = false;
+  // Time spent waiting isn't counted as idle.
+  EpollRecord::ResetDeadline();
+  if (EpollRecord::IsEdgeTriggered()) {
+    EpollRecord::ScheduleIn();
+  } else {
+    EpollRecord::AddFlag(EpollRecord::IN);
+  }
+}
+
+void ExternalServerSocket::ReceiveMessageFromParent(
+    const std::string& data, bool is_head_request,
+    const std::string& cache_key) {
+  parser_ = HttpParser(false, is_head_request);
+  StopCapture();
+  if (!cache_key.empty()) {
+    cache_key_ = cache_key;
+    cache_request_ = data;
+    is_capturing_ = true;
+    is_cacheability_checked_ = false;
+  }
   if (!IOFileDescriptor::Append(data.c_str(), data.size())) {
     LOGE << "Error to receive message from parent; ext_server: " << GetFD()
          << "; close connection";
@@ -105,4 +412,70 @@ void ExternalServerSocket::ReceiveMessageFromParent(const std::string& data) {
   }
 }
 
+void ExternalServerSocket::StartTunnel(AdvancedTime idle_timeout) {
+  is_tunnel_ = true;
+  EpollRecord::SetTimeout(idle_timeout);
+}
+
+bool ExternalServerSocket::ReceiveTunnelData(const char* data, size_t size) {
+  if (!IOFileDescriptor::Append(data, size)) {
+    LOGE << "Tunnel buffer overflowed; ext_server: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return false;
+  }
+  uint32_t flags = EpollRecord::GetFlags();
+  if (flags & EpollRecord::OUT) {
+    return true;
+  }
+  if (!EpollRecord::SetFlags(flags | EpollRecord::OUT)) {
+    LOGE << "Error to set OUT flag after receiving tunnel data; "
+         << "ext_server: " << GetFD() << "; close connection";
+    Disconnect();
+    return false;
+  }
+  return true;
+}
+
+bool ExternalServerSocket::IsOutputOverloaded() const {
+  return IOFileDescriptor::GetSize() >= kOutputHighWatermark;
+}
+
+void ExternalServerSocket::ShutdownOnSend() {
+  if (IOFileDescriptor::IsEmpty()) {
+    ShutdownOutput();
+    return;
+  }
+  is_shutdown_on_send_ = true;
+}
+
+bool ExternalServerSocket::IsOutputShutdown() const {
+  return is_output_shutdown_;
+}
+
+void ExternalServerSocket::FinishTunnelInput() {
+  LOGI << "External Server closed tunnel input; fd: " << GetFD();
+  is_input_closed_ = true;
+  is_waiting_for_space_ = false;
+  if (!EpollRecord::RemoveFlag(EpollRecord::IN)) {
+    LOGE << "Error to remove IN flag from ext_server: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return;
+  }
+  parent_ptr_->ShutdownOnSend();
+}
+
+void ExternalServerSocket::ShutdownOutput() {
+  is_shutdown_on_send_ = false;
+  if (!net_utils::ShutdownOutput(GetFD())) {
+    LOGE << "Error to shutdown tunnel output; ext_server: " << GetFD()
+         << "; close connection";
+    Disconnect();
+    return;
+  }
+  is_output_shutdown_ = true;
+  parent_ptr_->OnTunnelHalfClosed();
+}
+
 }  // namespace sockets
@@ -1,9 +1,13 @@
 #ifndef SOCKETS_EXTERNAL_SERVER_SOCKET_H_
 #define SOCKETS_EXTERNAL_SERVER_SOCKET_H_
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
 #include <memory>
 #include <string>
 
+#include "advanced_time.h"
 #include "epoll.h"
 #include "epoll_record.h"
 #include "http_parser.h"
@@ -11,25 +15,91 @@
 namespace sockets {
 
 class ClientSocket;
+class UpstreamPool;
 
 class ExternalServerSocket : public epoll::EpollRecord {
  public:
+  // Descriptor is connecting to the address; parent is notified through
+  // OnExternalServerConnected or OnConnectFailed. If connect takes longer
+  // than the attempt delay, parent is told to start the next attempt in
+  // parallel through OnConnectAttemptDelayed.
   ExternalServerSocket(int fd,
                        std::shared_ptr<epoll::Epoll>,
-                       ClientSocket* parent_ptr);
+                       ClientSocket* parent_ptr,
+                       const sockaddr_storage& address);
   ~ExternalServerSocket() override;
 
   void OnIn() override;
   void OnOut() override;
   void OnTimeExpired() override;
   void OnError() override;
+  const char* GetTypeName() const override;
 
   void Disconnect();
-  void ReceiveMessageFromParent(const std::string& message);
+  // Sends the request and starts tracking of its response. Response is
+  // captured for the cache unless cache key is empty.
+  void ReceiveMessageFromParent(const std::string& message,
+                                bool is_head_request,
+                                const std::string& cache_key);
+  // Parent's output was drained below the low watermark.
+  void OnParentSpaceAvailable();
+
+  // Response isn't tracked anymore: bytes are relayed both ways as is until
+  // each side half-closes. Idle timeout is replaced with the tunnel's one.
+  void StartTunnel(base::AdvancedTime idle_timeout);
+  // Returns false if the connection was closed.
+  bool ReceiveTunnelData(const char* data, size_t size);
+  // Parent stops reading its client while output buffered for the server is
+  // above the high watermark; it's resumed through OnTunnelSpaceAvailable.
+  bool IsOutputOverloaded() const;
+  // Server is told that client has nothing more to send once buffered
+  // output is written.
+  void ShutdownOnSend();
+  bool IsOutputShutdown() const;
+
+  // Connection without parent waits in the pool for the next request.
+  void Detach(UpstreamPool* pool_ptr, base::AdvancedTime idle_timeout);
+  void Attach(ClientSocket* parent_ptr);
+  // Address of the server; empty if it's unknown.
+  const std::string& GetPoolKey() const;
 
  private:
-  ClientSocket* const parent_ptr_;
+  // Checks result of the connect once the socket became writable.
+  void FinishConnect();
+  void FailConnect();
+  // Moves no more than limit bytes of the body.
+  void RelayBySplice(size_t limit);
+  // Stops reading until OnParentSpaceAvailable.
+  void WaitForParentSpace();
+  // Copies relayed part of the response while it may be cached.
+  void CaptureResponse(const char* data, size_t size);
+  void StopCapture();
+  // Returns connection to the pool if the server keeps it alive.
+  void FinishResponse(bool is_open);
+  // Server has half-closed the tunnel; client is half-closed in turn.
+  void FinishTunnelInput();
+  void ShutdownOutput();
+
+  ClientSocket* parent_ptr_;
+  // Set while the connection is idle.
+  UpstreamPool* pool_ptr_;
+  const std::string pool_key_;
+  // Tracks the response to find its end.
   net_utils::HttpParser parser_;
+  std::string cache_key_;
+  std::string cache_request_;
+  std::string cache_response_;
+  // Response is copied until it turns out it can't be cached; it isn't
+  // spliced meanwhile.
+  bool is_capturing_;
+  bool is_cacheability_checked_;
+  bool is_waiting_for_space_;
+  bool is_connecting_;
+  bool is_attempt_delayed_;
+  bool is_tunnel_;
+  bool is_input_closed_;
+  bool is_shutdown_on_send_;
+  bool is_output_shutdown_;
 };
 
 }  // namespace sockets
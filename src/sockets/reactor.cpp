@@ -0,0 +1,93 @@
+#include "reactor.h"
+
+#include <netinet/in.h>
+
+#include <exception>
+#include <memory>
+#include <sstream>
+
+#include "epoll.h"
+#include "logger.h"
+#include "scoped_mutex.h"
+#include "server_socket.h"
+#include "terminal_error.h"
+
+namespace sockets {
+
+using epoll::Epoll;
+using epoll::EpollNotifier;
+
+Reactor::Reactor(size_t index, uint16_t port, const Epoll::Options& options) :
+    index_(index),
+    port_(port),
+    options_(options),
+    is_stopped_(false),
+    is_stats_requested_(false),
+    stop_notifier_(nullptr) {
+  thread_ = std::thread([this]() {
+    Run();
+  });
+  LOGI << "Reactor " << index_ << " was started";
+}
+
+Reactor::~Reactor() {
+  Stop();
+  thread_.join();
+  LOGI << "Reactor " << index_ << " was stopped";
+}
+
+void Reactor::Stop() {
+  ScopedMutex scoped_mutex(&notifier_locker_);
+  is_stopped_.store(true);
+  if (stop_notifier_ != nullptr) {
+    stop_notifier_->Notify();
+  }
+}
+
+void Reactor::DumpStats() {
+  ScopedMutex scoped_mutex(&notifier_locker_);
+  is_stats_requested_.store(true);
+  if (stop_notifier_ != nullptr) {
+    stop_notifier_->Notify();
+  }
+}
+
+void Reactor::Run() {
+  std::stringstream name_stream;
+  name_stream << "proxy_reactor_" << index_ << ".log";
+  InitFileLogger(name_stream.str());
+
+  std::shared_ptr<Epoll> epoll_ptr;
+  std::unique_ptr<EpollNotifier> notifier_ptr;
+  try {
+    epoll_ptr = std::make_shared<Epoll>(options_);
+    notifier_ptr.reset(new EpollNotifier(epoll_ptr, [this, &epoll_ptr]() {
+      if (is_stats_requested_.exchange(false)) {
+        LOGI << "Reactor " << index_ << " loop stats:\n"
+             << epoll_ptr->GetStats().ToString();
+      }
+      FLOGI << "Reactor " << index_ << " was notified";
+    }));
+    ServerSocket server(epoll_ptr, port_, INADDR_ANY, true);
+
+    ScopedMutex scoped_mutex(&notifier_locker_);
+    stop_notifier_ = notifier_ptr.get();
+    scoped_mutex.Release();
+
+    while (!is_stopped_.load()) {
+      epoll_ptr->Process();
+    }
+  } catch (TerminalError& error) {
+    LOGE << "Reactor " << index_ << " was terminated";
+  } catch (std::exception& error) {
+    LOGE << "Reactor " << index_ << " failed: " << error.what();
+  }
+
+  ScopedMutex scoped_mutex(&notifier_locker_);
+  stop_notifier_ = nullptr;
+  scoped_mutex.Release();
+  notifier_ptr = nullptr;
+  epoll_ptr = nullptr;
+}
+
+}  // namespace sockets
@@ -0,0 +1,43 @@
+#ifndef SOCKETS_REACTOR_H_
+#define SOCKETS_REACTOR_H_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "epoll.h"
+#include "epoll_notifier.h"
+#include "macros.h"
+
+namespace sockets {
+
+// Event loop thread which owns its own Epoll, listening socket (shared with
+// other reactors through SO_REUSEPORT) and clients.
+class Reactor {
+ public:
+  Reactor(size_t index, uint16_t port, const epoll::Epoll::Options& options);
+  ~Reactor();
+
+  void Stop();
+  // Asks the reactor to log its loop statistics. Thread-safe.
+  void DumpStats();
+
+ private:
+  void Run();
+
+  const size_t index_;
+  const uint16_t port_;
+  const epoll::Epoll::Options options_;
+
+  std::atomic<bool> is_stopped_;
+  std::atomic<bool> is_stats_requested_;
+  std::mutex notifier_locker_;
+  epoll::EpollNotifier* stop_notifier_;
+  std::thread thread_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(Reactor);
+};
+
+}  // namespace sockets
+
+#endif  // SOCKETS_REACTOR_H_
@@ -1,12 +1,11 @@
 #include "server_socket.h"
 
 #include "client_socket.h"
+#include "dns_message.h"
 #include "id_generator.h"
 #include "logger.h"
 #include "net_utils.h"
-#include "scoped_mutex.h"
 #include "terminal_error.h"
-#include "thread_pool.h"
 
 namespace sockets {
 
@@ -14,18 +13,28 @@ using epoll::Epoll;
 using epoll::EpollRecord;
 using base::AdvancedTime;
 
+namespace {
+
+net_utils::ResolverConfig ReadResolverConfig(const std::string& path) {
+  net_utils::ResolverConfig config;
+  net_utils::ParseResolvConf(path, &config);
+  return config;
+}
+
+}  // namespace
+
 ServerSocket::ServerSocket(std::shared_ptr<Epoll> epoll_ptr,
-                           size_t number_of_threads,
                            uint16_t port,
-                           uint32_t s_addr) :
-    EpollRecord(net_utils::CreateServerSocket(port, s_addr),
+                           uint32_t s_addr,
+                           bool reuse_port) :
+    EpollRecord(net_utils::CreateServerSocket(port, s_addr, reuse_port),
                 epoll_ptr,
                 EpollRecord::IN,
                 AdvancedTime::Infinity()),
-    thread_pool_(number_of_threads) {
-  notifier_.reset(new epoll::EpollNotifier(epoll_ptr, [this](){
-    ProcessQueue();
-  }));
+    dns_resolver_(epoll_ptr,
+                  ReadResolverConfig(epoll_ptr->GetOptions().resolv_conf)),
+    completion_queue_(epoll_ptr) {
+  EpollRecord::AcceptAhead();
   LOGI << "Server Socket was created; fd: " << GetFD()
        << "; for port: " << port;
 }
@@ -35,7 +44,7 @@ ServerSocket::~ServerSocket() {
 }
 
 void ServerSocket::OnIn() {
-  int client_fd = net_utils::AcceptNonblocking(GetFD());
+  int client_fd = EpollRecord::Accept();
   if (client_fd < 0) {
     LOGE << "Can't accept client. Skip it. " << client_fd;
     return;
@@ -62,7 +71,12 @@ void ServerSocket::OnError() {
   throw TerminalError();
 }
 
+const char* ServerSocket::GetTypeName() const {
+  return "ServerSocket";
+}
+
 bool ServerSocket::AddClient(int client_fd) {
+  SetBusyPoll(client_fd);
   uint64_t new_id = generator_.GetNext();
   std::shared_ptr<ClientSocket> client_ptr =
       std::make_shared<ClientSocket>(client_fd,
@@ -77,23 +91,28 @@ void ServerSocket::KillClient(uint64_t id) {
   clients_.erase(id);
 }
 
-void ServerSocket::AddExternalServerToQueue(int external_server_socket_fd,
-                                            uint64_t client_id) {
-  ScopedMutex scoped_mutex(&queue_locker_);
-  queue_.push_back({external_server_socket_fd, client_id});
-  notifier_->Notify();
+void ServerSocket::PostToLoop(const std::function<void(void)>& task) {
+  completion_queue_.Post(task);
 }
 
-void ServerSocket::ProcessQueue() {
-  ScopedMutex scoped_mutex(&queue_locker_);
-  for (auto p : queue_) {
-    int fd = p.first;
-    int client_id = p.second;
-    if (clients_.find(client_id) != clients_.end()) {
-      clients_[client_id]->SetExternalServer(fd);
+void ServerSocket::PostToClient(
+    uint64_t client_id, const std::function<void(ClientSocket*)>& task) {
+  PostToLoop([this, client_id, task]() {
+    auto it = clients_.find(client_id);
+    if (it == clients_.end()) {
+      FLOGI << "Client " << client_id << " is gone; drop its task";
+      return;
     }
+    task(it->second.get());
+  });
+}
+
+void ServerSocket::SetBusyPoll(int fd) {
+  const Epoll::Options& options = GetEpollPtr()->GetOptions();
+  if (options.socket_busy_poll && options.busy_poll_us != 0) {
+    // Not fatal: without the privilege the loop still spins on its own.
+    net_utils::SetBusyPoll(fd, options.busy_poll_us);
   }
-  queue_.clear();
 }
 
 }  // namespace sockets
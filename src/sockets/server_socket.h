@@ -1,18 +1,19 @@
 #ifndef SOCKETS_SERVER_SOCKET_H_
 #define SOCKETS_SERVER_SOCKET_H_
 
+#include <functional>
 #include <memory>
-#include <mutex>
 #include <unordered_map>
-#include <vector>
 
 #include <netinet/in.h>
 
 #include "epoll.h"
-#include "epoll_notifier.h"
+#include "completion_queue.h"
+#include "dns_resolver.h"
 #include "epoll_record.h"
 #include "id_generator.h"
-#include "thread_pool.h"
+#include "pipe.h"
+#include "upstream_pool.h"
 
 namespace sockets {
 
@@ -21,9 +22,9 @@ class ClientSocket;
 class ServerSocket : public epoll::EpollRecord {
  public:
   ServerSocket(std::shared_ptr<epoll::Epoll> epoll_ptr,
-               size_t number_of_threads,
                uint16_t port,
-               uint32_t s_addr = INADDR_ANY);
+               uint32_t s_addr = INADDR_ANY,
+               bool reuse_port = false);
 
   ~ServerSocket() override;
 
@@ -31,27 +32,42 @@ class ServerSocket : public epoll::EpollRecord {
   void OnOut() override;
   void OnTimeExpired() override;
   void OnError() override;
+  const char* GetTypeName() const override;
 
   void KillClient(uint64_t id);
 
-  void AddExternalServerToQueue(int external_server_socket_fd,
-                                uint64_t client_id);
-  void ProcessQueue();
+  // Runs the task on the loop thread. Can be called from any thread.
+  void PostToLoop(const std::function<void(void)>& task);
+  // Runs the task on the loop thread if the client is still alive. Can be
+  // called from any thread.
+  void PostToClient(uint64_t client_id,
+                    const std::function<void(ClientSocket*)>& task);
+  // Enables busy polling of the socket if it's configured.
+  void SetBusyPoll(int fd);
+
+  base::PipePool* GetPipePoolPtr() {
+    return &pipe_pool_;
+  }
+
+  UpstreamPool* GetUpstreamPoolPtr() {
+    return &upstream_pool_;
+  }
 
-  base::ThreadPool* GetThreadPoolPtr() {
-    return &thread_pool_;
+  DnsResolver* GetDnsResolverPtr() {
+    return &dns_resolver_;
   }
 
  private:
   bool AddClient(int client_fd);
 
+  // Clients return their pipes on destruction, so the pool outlives them.
+  base::PipePool pipe_pool_;
+  UpstreamPool upstream_pool_;
+  DnsResolver dns_resolver_;
   std::unordered_map<uint64_t, std::shared_ptr<ClientSocket>> clients_;
   base::IdGenerator generator_;
 
-  std::vector<std::pair<int, uint64_t>> queue_;
-  std::mutex queue_locker_;
-  std::unique_ptr<epoll::EpollNotifier> notifier_;
-  base::ThreadPool thread_pool_;
+  epoll::CompletionQueue completion_queue_;
 };
 
 }  // namespace sockets
@@ -0,0 +1,88 @@
+#include "upstream_pool.h"
+
+#include <utility>
+
+#include "external_server_socket.h"
+#include "logger.h"
+#include "net_utils.h"
+
+namespace sockets {
+
+using base::AdvancedTime;
+
+namespace {
+
+const size_t kMaxIdleConnectionsPerServer = 8;
+const uint64_t kTimeoutForIdleConnectionMs = 30000;
+
+}  // namespace
+
+UpstreamPool::UpstreamPool() {}
+
+UpstreamPool::~UpstreamPool() {}
+
+std::unique_ptr<ExternalServerSocket> UpstreamPool::Acquire(
+    const std::vector<sockaddr_storage>& addresses) {
+  for (const sockaddr_storage& address : addresses) {
+    auto it = connections_.find(net_utils::AddressToString(address));
+    if (it == connections_.end()) {
+      continue;
+    }
+    Connections& connections = it->second;
+    while (!connections.empty()) {
+      std::unique_ptr<ExternalServerSocket> external_server_ptr =
+          std::move(connections.back());
+      connections.pop_back();
+      if (!external_server_ptr->HasReceivedInput() &&
+          net_utils::IsIdleConnectionAlive(external_server_ptr->GetFD())) {
+        FLOGI << "Reuse connection to " << it->first << "; fd: "
+              << external_server_ptr->GetFD();
+        if (connections.empty()) {
+          connections_.erase(it);
+        }
+        return external_server_ptr;
+      }
+      LOGI << "Idle connection was closed by server; fd: "
+           << external_server_ptr->GetFD();
+    }
+    connections_.erase(it);
+  }
+  return nullptr;
+}
+
+void UpstreamPool::Release(
+    std::unique_ptr<ExternalServerSocket> external_server_ptr) {
+  const std::string& key = external_server_ptr->GetPoolKey();
+  if (key.empty()) {
+    return;
+  }
+  external_server_ptr->Detach(
+      this, AdvancedTime::FromMilliseconds(kTimeoutForIdleConnectionMs));
+  FLOGI << "Keep connection to " << key << "; fd: "
+        << external_server_ptr->GetFD();
+  Connections& connections = connections_[key];
+  connections.push_back(std::move(external_server_ptr));
+  if (connections.size() > kMaxIdleConnectionsPerServer) {
+    connections.pop_front();
+  }
+}
+
+void UpstreamPool::Remove(ExternalServerSocket* external_server_ptr) {
+  auto it = connections_.find(external_server_ptr->GetPoolKey());
+  if (it == connections_.end()) {
+    return;
+  }
+  Connections& connections = it->second;
+  for (auto conn_it = connections.begin(); conn_it != connections.end();
+       ++conn_it) {
+    if (conn_it->get() == external_server_ptr) {
+      connections.erase(conn_it);
+      break;
+    }
+  }
+  if (connections.empty()) {
+    connections_.erase(it);
+  }
+}
+
+}  // namespace sockets
@@ -0,0 +1,46 @@
+#ifndef SOCKETS_UPSTREAM_POOL_H_
+#define SOCKETS_UPSTREAM_POOL_H_
+
+#include <netinet/in.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "advanced_time.h"
+#include "macros.h"
+
+namespace sockets {
+
+class ExternalServerSocket;
+
+// Idle keep-alive connections to external servers of one loop, keyed by
+// server's address and port. Idle connection stays subscribed to the loop:
+// it's closed when its idle timeout expires or the server sends anything.
+class UpstreamPool {
+ public:
+  UpstreamPool();
+  ~UpstreamPool();
+
+  // Returns the most recently used live connection to one of the addresses
+  // or nullptr.
+  std::unique_ptr<ExternalServerSocket> Acquire(
+      const std::vector<sockaddr_storage>& addresses);
+  // Oldest connection to the same server is closed if there are too many.
+  void Release(std::unique_ptr<ExternalServerSocket> external_server_ptr);
+  // Closes idle connection.
+  void Remove(ExternalServerSocket* external_server_ptr);
+
+ private:
+  typedef std::deque<std::unique_ptr<ExternalServerSocket>> Connections;
+
+  std::unordered_map<std::string, Connections> connections_;
+
+  PROHIBIT_COPY_AND_COPY_ASSIGN(UpstreamPool);
+};
+
+}  // namespace sockets
+
+#endif  // SOCKETS_UPSTREAM_POOL_H_